@@ -0,0 +1,55 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bumped whenever the layout of the file changes, older files are rejected
+#define CHECKPOINT_VERSION 5
+
+/**
+ * Checkpoints hold the configuration, the particle arrays, the rng state and
+ * the step count in native byte order. Every array starts at a multiple of
+ * PARTICLE_ALIGNMENT, so a loaded store can point straight into the mapping.
+ */
+typedef struct CheckpointWriter CheckpointWriter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writes to a temporary file and renames it over path, readers never see a partial checkpoint
+void saveCheckpoint(const Domain *domain, const char *path);
+
+/**
+ * Initialises the domain from a checkpoint. The physical settings (dimensions,
+ * forces and self gravity, timestep, particle count and size, chunk count)
+ * come from the file, how to run them (builders, kernels, threads, metrics)
+ * from runtime. So do the emitters and sinks, with either the store keeps the
+ * capacity of runtime if that holds the particles of the file. A builder,
+ * stencil, kernel, skin or threading that differs from the file is warned
+ * about, the restart then no longer follows the run that wrote it.
+ */
+void loadCheckpoint(Domain *domain, const char *path, Config runtime);
+
+// Holds up to count particles, the capacity of the domain
+CheckpointWriter *createCheckpointWriter(size_t count);
+
+// Waits for a checkpoint still being written
+void destroyCheckpointWriter(CheckpointWriter *writer);
+
+/**
+ * Copies the state and saves it on a background thread. Returns false, and
+ * skips this checkpoint, if the previous one is still being written.
+ */
+bool requestCheckpoint(CheckpointWriter *writer, const Domain *domain, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,20 +7,61 @@
 
 #include "simulation/containers/particle.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
 // Predeclare Chunk
 typedef struct Chunk Chunk;
 
-#include "simulation/containers/domain.h"
+// Pair counters at the last retune of CHUNK_SIZING_AUTO
+typedef struct {
+    size_t rebuilds;
+    size_t steps;
+    size_t pairTests;
+    size_t pairHits;
+} ChunkTuner;
 
-struct Chunk {
-    Chunk *adj[26];
+// Store sorts of CHUNK_BUILDER_LISTS
+typedef struct {
+    size_t rebuilds;
+    // Locality right after the last sort, 0 until the first rebuild
+    double locality;
+} StoreReorder;
 
+// Complete before domain.h, whose inline helpers step through chunks
+struct Chunk {
     int numParticles;
+
+    // CHUNK_BUILDER_LISTS: indices into the particle store
     int size;
-    Particle **particles;
+    int *particles;
+
+    // CHUNK_BUILDER_SORTED: particles [begin, end) of the store
+    int begin;
+    int end;
+
+    // Sleeping, see Config.sleepSteps: the fewest calm substeps of any of its particles,
+    // and whether the whole chunk sleeps through the current substep
+    float calm;
+    bool asleep;
 };
 
+#include "simulation/containers/domain.h"
+
+// Domain.chunkOffsets[HALF_STENCIL_BEGIN..25] are the 13 neighbours with offsets after (0, 0, 0)
+#define HALF_STENCIL_BEGIN 13
+
 
 void initChunks(Domain *domain);
+void freeChunks(Domain *domain);
+
+// Largest distance at which two particles can interact, including the neighbour skin
+float contactReach(const Domain *domain);
+
+// New grid of the given edge, empty until the next updateChunks
+void resizeChunks(Domain *domain, float chunkSize);
+
+// Memory held by the grid itself, without the particle index lists
+size_t chunkGridBytes(const Domain *domain);
 
 void updateChunks(Domain *domain);
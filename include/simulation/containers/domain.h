@@ -5,7 +5,17 @@
  */
 
 #include "simulation/containers/particle.h"
+#include "simulation/containers/particleStore.h"
 #include "simulation/containers/domainConfig.h"
+#include "simulation/containers/neighbourList.h"
+#include "simulation/containers/octree.h"
+#include "simulation/containers/population.h"
+#include "simulation/math/random.h"
+#include "simulation/parallel/threadPool.h"
+#include "simulation/parallel/numa.h"
+#include "simulation/parallel/pairTasks.h"
+#include "simulation/metrics.h"
+#include "simulation/forces/contactBlock.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -15,17 +25,127 @@
 typedef struct Domain Domain;
 
 #include "simulation/containers/chunk.h"
+#include "simulation/containers/sparseGrid.h"
 
 struct Domain {
-    bool drawable;
-    Particle *particles;
+    ParticleStore particles;
 
     float chunkSize;
     int chunkCounts[3];
-    Chunk ***chunks;
+
+    // CHUNK_GRID_DENSE: flat grid of (x + 2) * (y + 2) * (z + 2) chunks, the outer layer stays empty.
+    // CHUNK_GRID_SPARSE: the occupied chunks of sparse
+    Chunk *chunks;
+
+    // Dense neighbour n of a chunk is chunk + chunkOffsets[n], ghosts make every one valid
+    int chunkOffsets[26];
+
+    // Set with CHUNK_GRID_SPARSE, which looks neighbours up in sparse->neighbours instead
+    SparseGrid *sparse;
+
+    // Interior chunks, as indices into chunks, in the order their ranges take in the store
+    int *chunkOrder;
+    size_t chunkOrderCount;
+
+    ChunkTuner chunkTuner;
+    StoreReorder reorder;
+
+    // Live and dead particles between compactions, and the state of the emitters
+    Population population;
+
+    // Only used with a neighbour skin
+    NeighbourList neighbours;
+
+    // Only used with Config.selfGravity, rebuilt every step
+    Octree gravityTree;
+
+    // Scratch space of CHUNK_BUILDER_SORTED and of reorders
+    ParticleStore sortBuffer;
+    Chunk **particleChunks;
+    int *sortDestination;
+
+    // Substeps in a row each particle stayed below Config.sleepTravel, counted in part under an
+    // external acceleration, see calmRange. Sorted along with the store, only set up with sleeping
+    float *calmSteps;
+    float *calmBuffer;
+
+    // Store ranges of the awake chunks in the current substep, as begin and end pairs
+    int *awakeRanges;
+    size_t awakeRangeCount;
+
+    // Incremental CHUNK_BUILDER_LISTS: particle i is entry chunkSlots[i] of particleChunks[i].
+    // With sleeping, CHUNK_BUILDER_SORTED: the ranges still match the store.
+    // Cleared by anything that moves particles or chunks, the next update starts over
+    int *chunkSlots;
+    bool membershipValid;
 
     Config config;
+    Rng rng;
+
+    // Block pair kernel picked for config.kernel
+    ContactBlockKernel contactBlock;
+
+    // Only set up with more than one thread
+    ThreadPool *pool;
+
+    // Set up for the simultaneous contact law, see initSimultaneousContacts: the velocity change
+    // of every particle in the step and the number of its contacts the collision impulses are shared by
+    float *dvx;
+    float *dvy;
+    float *dvz;
+    uint16_t *contactCounts;
+
+    // Set up by placeDomain: the machine and the node every worker, or the thread without a pool, runs on
+    NumaTopology numa;
+    int *workerNodes;
+
+    // One per worker, or one without a pool: the longest move of the step, squared and relative
+    // to the radius, and the deepest overlap relative to the contact distance. recordStep takes them
+    float *workerTravel;
+    float *workerOverlap;
+
+    // Task cuts of Config.pairSchedule and the busy and idle time of every worker in the pair passes
+    PairTasks pairTasks;
+
+    Metrics metrics;
+    MetricsLog metricsLog;
 };
 
 
 void initDomain(Domain* domain, Config config);
+
+// Stops the workers and frees everything initDomain and the steps allocated, closing the metrics log
+void freeDomain(Domain *domain);
+
+/**
+ * Sets the domain up for the simultaneous contact law of the decomposed step.
+ * stepGlobal then gathers the full stencil instead of resolving the pairs in
+ * place, without a pool on the calling thread, which gives the same result as
+ * any number of workers. Neighbour lists become full lists.
+ */
+void initSimultaneousContacts(Domain *domain);
+
+/**
+ * Splits frames into substeps instead of config->supsampling without changing
+ * the motion of a frame. Velocities are moves per substep and shrink with the
+ * step, forces are velocity changes per substep and shrink with its square.
+ * initDomain instead only scales the forces with the step, so a fixed count
+ * changes the physics while this keeps those of the count it started from.
+ * Checkpoints divide by the speed factor and restart into the same forces.
+ * The velocities in the store are left to the caller.
+ */
+void splitFrames(Config *config, int substeps);
+
+// Index into chunks of chunk (x, y, z) of the interior, coordinates exclude the ghost layer. Dense grid only
+static inline int chunkIndex(const Domain *domain, int x, int y, int z) {
+    return ((x + 1) * (domain->chunkCounts[1] + 2) + (y + 1)) * (domain->chunkCounts[2] + 2) + (z + 1);
+}
+
+// Neighbour n of an interior chunk in chunkOffsets order, an empty chunk if there is none
+static inline Chunk *neighbourChunk(const Domain *domain, const Chunk *chunk, int n) {
+    if (domain->sparse != NULL) {
+        return &domain->chunks[domain->sparse->neighbours[26 * (chunk - domain->chunks) + n]];
+    }
+
+    return (Chunk*)chunk + domain->chunkOffsets[n];
+}
@@ -6,8 +6,111 @@
 
 #include "simulation/math/vector3.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+typedef enum {
+    // Per chunk index lists, particles stay where they are
+    CHUNK_BUILDER_LISTS,
+    // Counting sort, particles are reordered so every chunk is a contiguous range
+    CHUNK_BUILDER_SORTED
+} ChunkBuilder;
+
+typedef enum {
+    // Edge from targetChunkCount over the domain volume
+    CHUNK_SIZING_TARGET_COUNT,
+    // Edge from the largest contact reach, retuned from the pair hit ratio and occupancy
+    CHUNK_SIZING_AUTO
+} ChunkSizing;
+
+typedef enum {
+    // Every chunk of the domain exists, plus a ghost layer
+    CHUNK_GRID_DENSE,
+    // Only occupied chunks exist, behind a hash of their coordinates, needs CHUNK_BUILDER_SORTED
+    CHUNK_GRID_SPARSE
+} ChunkGrid;
+
+typedef enum {
+    // Row major, z fastest
+    CHUNK_ORDER_ROWS,
+    // Z-order curve over the chunk coordinates, neighbouring chunks stay closer in the store
+    CHUNK_ORDER_MORTON
+} ChunkOrder;
+
+typedef enum {
+    // Every particle visits its own and all 26 neighbouring chunks
+    PAIR_STENCIL_FULL,
+    // Every unordered pair is visited once, needs CHUNK_BUILDER_SORTED
+    PAIR_STENCIL_HALF
+} PairStencil;
+
+typedef enum {
+    // Widest kernel the CPU supports
+    PAIR_KERNEL_AUTO,
+    PAIR_KERNEL_SCALAR,
+    PAIR_KERNEL_AVX2,
+    PAIR_KERNEL_AVX512
+} PairKernel;
+
+typedef enum {
+    // Fixed blocks of chunks to whichever worker asks next
+    PAIR_SCHEDULE_BLOCKS,
+    // Blocks cut to equal estimated pair work every step and stolen between workers, see pairTasks.h
+    PAIR_SCHEDULE_WEIGHTED
+} PairSchedule;
+
+typedef enum {
+    // Workers run wherever the kernel puts them
+    AFFINITY_NONE,
+    // Worker w on the w-th cpu the process may use, filling one node after the other
+    AFFINITY_COMPACT,
+    // Workers dealt out over the nodes in turn, for the bandwidth of all of them
+    AFFINITY_SPREAD
+} ThreadAffinity;
+
+typedef enum {
+    // Frames back to back, as fast as the hardware steps them
+    SCHEDULE_BATCH,
+    // Frames on a clock of fps, late ones are caught up on within catchUpFrames
+    SCHEDULE_REALTIME,
+    // As SCHEDULE_REALTIME, but at most one frame per clock tick is published
+    SCHEDULE_FRAME_SKIP
+} ScheduleMode;
+
+typedef enum {
+    TRAJECTORY_POSITIONS,
+    TRAJECTORY_POSITIONS_VELOCITIES
+} TrajectoryFields;
+
+typedef enum {
+    // 32 bit floats as simulated
+    TRAJECTORY_RAW,
+    // 16 bits per component, positions over the domain and velocities over the frame maximum
+    TRAJECTORY_QUANTISED,
+    // Quantised positions as varint differences to the previous frame, with periodic keyframes
+    TRAJECTORY_DELTA
+} TrajectoryEncoding;
+
+// Most emitters and sinks a Config holds
+#define MAX_EMITTERS 4
+#define MAX_SINKS 4
+
+// Box new particles appear in, at random places and with one velocity
+typedef struct {
+    V3 lower;
+    V3 upper;
+    // Unscaled like the forces, initDomain turns it into a move per substep
+    V3 velocity;
+    // Particles per frame, fractions carry over to the next substep
+    float rate;
+} Emitter;
+
+// Box that removes every particle whose centre enters it
+typedef struct {
+    V3 lower;
+    V3 upper;
+} Sink;
+
 typedef struct {
     int dim[3];
 
@@ -15,14 +118,103 @@ typedef struct {
     V3 gravity;
     float repulsion;
 
+    // Pairwise gravity between the particles, 0 disables it. A particle weighs (radius / mass)^3,
+    // see selfGravity.h for the opening angle and the softening length
+    float selfGravity;
+    float openingAngle;
+    float softening;
+
     float speed;
     int supsampling;
     int fps;
 
+    // How startSimulation paces frames against the wall clock, every frame is 1 / fps simulated
+    // seconds. runFrames stops it after that many frames, 0 runs until the process ends
+    ScheduleMode schedule;
+    int catchUpFrames;
+    int runFrames;
+
+    // stepFrame picks supsampling anew after every frame, within [minSubsteps, maxSubsteps], so that
+    // no particle moves more than maxStepTravel of its radius per substep and no contact overlaps by
+    // more than maxStepOverlap of its distance. 0 disables the overlap limit, the soft piles of the
+    // scenarios rest at almost full overlap at any step. Only startSimulation and the bench step whole frames
+    bool adaptiveSubsteps;
+    int minSubsteps;
+    int maxSubsteps;
+    float maxStepTravel;
+    float maxStepOverlap;
+
+    // With emitters or sinks this is the capacity of the store, the live particles vary below it
     size_t numParticles;
     float mass;
+    // Spawned radii spread over [mass / radiusRatio, mass] with equal volume per doubling, 1 keeps them all at mass
+    float radiusRatio;
 
     int targetChunkCount;
+    ChunkSizing chunkSizing;
+    // CHUNK_SIZING_AUTO retunes every chunkRetuneInterval chunk rebuilds, 0 keeps the first size
+    int chunkRetuneInterval;
+    // Order of the chunk ranges in the store, for CHUNK_BUILDER_SORTED and reorders
+    ChunkOrder chunkOrder;
+    // CHUNK_BUILDER_LISTS sorts the store by chunk every reorderInterval rebuilds, or once the
+    // locality falls below reorderLocality of its value after the last sort. 0 disables either
+    int reorderInterval;
+    float reorderLocality;
+    ChunkBuilder chunkBuilder;
+    ChunkGrid chunkGrid;
+    // Levels of halving chunk edge below the one of the single grid, every particle is binned into
+    // the finest level its contacts fit into. 1 keeps a single grid, more need CHUNK_GRID_SPARSE
+    int gridLevels;
+    // CHUNK_BUILDER_LISTS only moves the particles that changed chunk, the lists stay in store order
+    bool incrementalChunks;
+    PairStencil stencil;
+    PairKernel kernel;
+
+    // Verlet skin distance, 0 disables the neighbour lists, needs CHUNK_BUILDER_SORTED
+    float neighbourSkin;
+
+    // A chunk falls asleep once each of its particles moved less than sleepTravel of its radius
+    // in each of the last sleepSteps substeps, 0 disables sleeping. Under gravity those substeps
+    // only count in part, so particles falling from rest stay awake. Needs CHUNK_BUILDER_SORTED,
+    // the half stencil, a single grid level, one thread and no neighbour lists
+    int sleepSteps;
+    float sleepTravel;
+
+    // Particles stream in through the emitters and out through the sinks before every substep,
+    // see population.h. Emitters pause while the store is full
+    Emitter emitters[MAX_EMITTERS];
+    int emitterCount;
+    Sink sinks[MAX_SINKS];
+    int sinkCount;
+
+    // Worker threads of the step, 1 keeps the serial path
+    int threads;
+    // How the chunks of the parallel pair phase are handed to the workers
+    PairSchedule pairSchedule;
+
+    // Placement of the workers and their memory, see numa.h. numaFirstTouch has every worker write
+    // its share of the particle arrays and the chunk grid first and keep to that share in the
+    // parallel loops. hugePages backs the particle arrays with transparent huge pages
+    ThreadAffinity affinity;
+    bool numaFirstTouch;
+    bool hugePages;
+
+    // Phase timers and chunk occupancy, the counters are always kept
+    bool metrics;
+    // Optional JSON lines (or CSV for a .csv path) file with one record per interval steps
+    const char *metricsPath;
+    int metricsInterval;
+
+    // startSimulation resumes from restartPath if set, and checkpoints every checkpointInterval frames
+    const char *restartPath;
+    const char *checkpointPath;
+    int checkpointInterval;
+
+    // startSimulation records every trajectoryInterval-th frame to trajectoryPath if set
+    const char *trajectoryPath;
+    int trajectoryInterval;
+    TrajectoryFields trajectoryFields;
+    TrajectoryEncoding trajectoryEncoding;
 
     float __internalSpeedFactor;
 } Config;
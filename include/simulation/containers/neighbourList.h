@@ -0,0 +1,54 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/particleStore.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Domain Domain;
+
+/**
+ * Verlet neighbour lists: for every particle the partners closer than their
+ * contact distance plus a skin, in compressed rows. The lists stay valid until
+ * some particle has moved more than half the skin since they were built.
+ */
+typedef struct {
+    // Only partners after the particle itself, so every pair is stored once
+    bool half;
+    bool valid;
+
+    // Partners of particle i are entries[start[i]..start[i + 1])
+    int *start;
+    int *entries;
+    size_t capacity;
+
+    // Positions at the last build
+    float *buildX;
+    float *buildY;
+    float *buildZ;
+
+    // Number of builds and of substeps that checked the lists
+    size_t builds;
+    size_t checks;
+} NeighbourList;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void initNeighbourList(NeighbourList *list, size_t count, bool half);
+void freeNeighbourList(NeighbourList *list);
+
+// True if the lists have to be rebuilt before the next step
+bool neighbourListExpired(const NeighbourList *list, const ParticleStore *particles, float skin);
+
+// Builds the lists from the chunk ranges, the chunks have to be sorted and current
+void buildNeighbourList(NeighbourList *list, Domain *domain);
+
+#ifdef __cplusplus
+}
+#endif
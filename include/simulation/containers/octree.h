@@ -0,0 +1,79 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/particleStore.h"
+
+#include <stddef.h>
+
+// Most particles a leaf holds, unless it is as deep as OCTREE_MAX_DEPTH
+#define OCTREE_LEAF_SIZE 8
+#define OCTREE_MAX_DEPTH 24
+
+typedef struct {
+    // Centre of mass, total mass and quadrupole about the centre of mass, sum of
+    // m (3 d d^T - |d|^2 I) stored as xx, xy, xz, yy, yz, zz
+    float x, y, z;
+    float mass;
+    float quadrupole[6];
+
+    // Edge of the cube and how far the centre of mass lies from its centre
+    float size;
+    float offset;
+
+    // Children are nodes[firstChild..firstChild + childCount), a leaf has none
+    int firstChild;
+    int childCount;
+
+    // Entries of the leaf order the node covers
+    int begin;
+    int end;
+} OctreeNode;
+
+/**
+ * Octree over the particle positions for the pairwise gravity, rebuilt every
+ * step. Cubes are split into their eight octants until at most
+ * OCTREE_LEAF_SIZE particles are left, and every node keeps the multipole of
+ * its particles. The positions and masses are copied in leaf order, so the
+ * traversal walks leaves contiguously and the store can change underneath.
+ */
+typedef struct {
+    // nodes[0] is the root
+    OctreeNode *nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+
+    // Particles in leaf order, index is their place in the store
+    float *x;
+    float *y;
+    float *z;
+    float *mass;
+    int *index;
+    int *scratch;
+    size_t count;
+
+    // Leaf nodes in leaf order
+    int *leaves;
+    size_t leafCount;
+
+    // Acceleration of every particle by its place in the store, see computeSelfGravity
+    float *pullX;
+    float *pullY;
+    float *pullZ;
+} Octree;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void initOctree(Octree *tree, size_t count);
+void freeOctree(Octree *tree);
+
+// Builds the tree over all particles, one of radius r weighs (r / unitRadius)^3
+void buildOctree(Octree *tree, const ParticleStore *particles, float unitRadius);
+
+#ifdef __cplusplus
+}
+#endif
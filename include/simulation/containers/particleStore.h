@@ -0,0 +1,73 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/particle.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Alignment of every array in the store, one cache line
+#define PARTICLE_ALIGNMENT 64
+
+// Alignment of the arrays of a store reserved with huge pages
+#define HUGE_PAGE_BYTES (2ul << 20)
+
+// Structure of arrays particle storage used by the simulation core
+typedef struct {
+    size_t count;
+
+    // Physical properties
+    float *x;
+    float *y;
+    float *z;
+    float *vx;
+    float *vy;
+    float *vz;
+    float *radius;
+
+    // Visual properties, three bytes per particle
+    uint8_t *col;
+
+    // Spawn index of every particle, follows it through the chunk sort
+    uint32_t *id;
+
+    // Set if the arrays point into a file mapping instead of owning their memory
+    void *mapping;
+    size_t mappedBytes;
+} ParticleStore;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void initParticleStore(ParticleStore *store, size_t count);
+
+// One anonymous mapping for all arrays, nothing is written yet, not even the ids. hugePages
+// aligns every array to a huge page and asks for transparent huge pages. freeParticleStore unmaps it
+void reserveParticleStore(ParticleStore *store, size_t count, bool hugePages);
+void freeParticleStore(ParticleStore *store);
+
+// Points the arrays into a private mapping of bytes at the given offsets, freeParticleStore unmaps it
+void mapParticleStore(ParticleStore *store, size_t count, void *mapping, size_t bytes, const uint64_t offsets[9]);
+
+// Writes the array of structs view used by the visualiser
+void exportParticles(const ParticleStore *store, Particle *out);
+
+// Moves particle i of source to destination[i] in target, both stores need the same count
+void scatterParticles(const ParticleStore *source, ParticleStore *target, const int *destination);
+
+// Copies particle from over particle to of the same store
+void moveParticle(ParticleStore *store, size_t from, size_t to);
+
+void swapParticleStores(ParticleStore *a, ParticleStore *b);
+
+// Copies all particles, both stores need the same count
+void copyParticleStore(const ParticleStore *source, ParticleStore *target);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domainConfig.h"
+#include "simulation/math/random.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Domain Domain;
+
+/**
+ * Particles that appear and disappear while the domain runs. The store keeps
+ * its capacity of Config.numParticles and the live particles are always its
+ * first count entries, so every loop over the store only sees live ones. The
+ * free slots are the tail: a new particle is appended, a removed one is only
+ * marked dead and the last live particle moves into its slot once the step is
+ * over. Compaction therefore moves as many particles as were removed, never
+ * the whole store, and the arrays are never reallocated.
+ *
+ * Every change of the population clears Domain.membershipValid and the
+ * neighbour lists, the next chunk update starts over from the new store.
+ */
+typedef struct {
+    // Cleared for particles removed since the last compaction, capacity entries
+    uint8_t *alive;
+
+    // Slots of those particles, in the order they were removed
+    size_t *removals;
+    size_t removalCount;
+
+    // Next id handed out, ids are never reused
+    uint32_t nextId;
+
+    // Particles every emitter still owes from earlier substeps, below one
+    float owed[MAX_EMITTERS];
+} Population;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ids of new particles continue after the capacity, past every spawned one
+void initPopulation(Population *population, size_t capacity);
+void freePopulation(Population *population);
+
+// Radius of a new particle, Config.mass or drawn from the spread of Config.radiusRatio
+float spawnRadius(const Config *config, Rng *rng);
+
+// Appends a particle and returns its slot, or -1 and counts it as refused if the store is full
+long spawnParticle(Domain *domain, float x, float y, float z, V3 velocity, float radius);
+
+// Marks particle i dead, it stays in the store until compactParticles. Removing it twice does nothing
+void removeParticle(Domain *domain, size_t i);
+
+// Fills the slots of the dead particles from the end of the store
+void compactParticles(Domain *domain);
+
+// Before a substep: removes the particles inside a sink, compacts the store and runs the emitters
+void updatePopulation(Domain *domain);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Chunk Chunk;
+
+// Most levels a grid can have, see SparseGrid.levels
+#define SPARSE_GRID_LEVELS 8
+
+/**
+ * Chunk grid of CHUNK_GRID_SPARSE: only chunks that held particles exist, found
+ * through a hash of their coordinates. Chunks outlive the update that made them
+ * so neighbours only have to be linked once, the owner clears the grid when
+ * too many of them have gone empty. Memory follows the occupied volume instead
+ * of the domain volume.
+ *
+ * A grid can have several levels, the chunks of level l are twice the edge of
+ * those of level l - 1 and every chunk below the top one belongs to the chunk
+ * of the next level that contains it, which is created along with it.
+ */
+typedef struct {
+    // chunks[1..count], chunks[0] stays empty and stands in for missing neighbours
+    Chunk *chunks;
+    size_t count;
+    size_t capacity;
+
+    // Grid the level 0 coordinates have to stay inside of, level l has (chunkCounts + 2^l - 1) >> l
+    int chunkCounts[3];
+    int levels;
+
+    // x, y and z of every chunk, in chunks of its level
+    int *coordinates;
+
+    // Level of every chunk, and the chunk of the next level up that contains it, 0 on the top level
+    int *chunkLevels;
+    int *parents;
+
+    // The 26 neighbours of every chunk as indices into chunks, in Domain.chunkOffsets order
+    int *neighbours;
+
+    // Chunks in the order their ranges take in the store
+    int *order;
+
+    // Chunks by colour (coordinates modulo 3) for the parallel half stencil,
+    // colour k is colourOrder[colourStart[k]..colourStart[k + 1])
+    int *colourOrder;
+    size_t colourStart[28];
+
+    // False once chunks were added after the last orderSparseGrid
+    bool ordered;
+
+    // Open addressing from packed coordinates plus one to chunk indices, 0 marks a free slot
+    uint64_t *keys;
+    int *slots;
+    size_t tableSize;
+} SparseGrid;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SparseGrid *createSparseGrid(void);
+void destroySparseGrid(SparseGrid *grid);
+
+// Forgets every chunk and takes the bounds and levels of a new grid, keeps the memory
+void clearSparseGrid(SparseGrid *grid, const int chunkCounts[3], int levels);
+
+// Empties every chunk, keeps them and their links
+void resetSparseGrid(SparseGrid *grid);
+
+// Index of chunk (x, y, z) of level, created empty and linked to its neighbours and parent if it does not exist yet
+int sparseChunk(SparseGrid *grid, int level, int x, int y, int z);
+
+// Brings store order and colours up to date with the chunks added since the last call
+void orderSparseGrid(SparseGrid *grid, bool morton);
+
+size_t sparseGridBytes(const SparseGrid *grid);
+
+#ifdef __cplusplus
+}
+#endif
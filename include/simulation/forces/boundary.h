@@ -5,8 +5,8 @@
  */
 
 
-#include "simulation/containers/particle.h"
+#include "simulation/containers/particleStore.h"
 #include "simulation/containers/domain.h"
 #include "simulation/containers/domainConfig.h"
 
-void checkBoundaries(Particle* particle, Domain *domain);
+void checkBoundaries(ParticleStore *particles, size_t begin, size_t end, const Domain *domain);
@@ -0,0 +1,95 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+
+#include "simulation/containers/particleStore.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Whether a and b touch, the same test contactResponse resolves
+static inline bool contactTouches(const ParticleStore *particles, int a, int b) {
+    const float difX = particles->x[a] - particles->x[b];
+    const float difY = particles->y[a] - particles->y[b];
+    const float difZ = particles->z[a] - particles->z[b];
+
+    const float distanceSq = difX * difX + difY * difY + difZ * difZ;
+    const float contact = particles->radius[a] + particles->radius[b];
+
+    return distanceSq < contact * contact && distanceSq != 0.0f;
+}
+
+// Share of the collision impulse of a pair under the simultaneous law, one over the larger contact count
+static inline float contactShare(const uint16_t *contacts, int a, int b) {
+    const int most = contacts[a] > contacts[b] ? contacts[a] : contacts[b];
+    return most > 1 ? 1.0f / most : 1.0f;
+}
+
+/**
+ * Velocity change of particle a from its contact with b, added to dv.
+ * For an isolated pair this equals what the serial path applies over both of
+ * its visits: the repulsion twice and the collision impulse once.
+ * overlap is raised to the depth of the contact relative to the contact distance.
+ *
+ * Without contacts this is the sequential law of the serial step, which
+ * scatters in place: dv doubles as the running velocity change of a and the
+ * store holds the running velocities of its partners, so each contact sees the
+ * response to the earlier ones like handleParticleInteraction. That keeps
+ * dense beds stable, but the result depends on the order the pairs are visited.
+ *
+ * With contacts, the number of contacts of every particle in this step, this
+ * is the simultaneous law of the decomposed step: the velocities are those at
+ * the start of the step, so the response does not depend on the order and the
+ * two halves of a pair cancel exactly. Each contact would then take out the
+ * whole approach velocity on its own and k of them overshoot k-fold, so the
+ * collision impulse is shared by the larger contact count of the pair. An
+ * isolated pair still gets the sequential response.
+ */
+static inline bool contactResponse(const ParticleStore *particles, int a, int b, float repulsion, float friction, const uint16_t *contacts, float dv[3], float *overlap) {
+    const float difX = particles->x[a] - particles->x[b];
+    const float difY = particles->y[a] - particles->y[b];
+    const float difZ = particles->z[a] - particles->z[b];
+
+    const float distanceSq = difX * difX + difY * difY + difZ * difZ;
+    const float contact = particles->radius[a] + particles->radius[b];
+
+    if (distanceSq >= contact * contact || distanceSq == 0.0f) return false;
+
+    const float distance = sqrtf(distanceSq);
+
+    *overlap = fmaxf(*overlap, (contact - distance) / contact);
+
+    // Normal vector
+    const float normalX = difX / distance;
+    const float normalY = difY / distance;
+    const float normalZ = difZ / distance;
+
+    const float force = (contact - distance) * repulsion;
+
+    const bool running = contacts == NULL;
+    const float runX = running ? dv[0] : 0.0f;
+    const float runY = running ? dv[1] : 0.0f;
+    const float runZ = running ? dv[2] : 0.0f;
+
+    // Relative normal velocity after the first repulsion push
+    const float vDotN = (particles->vx[a] + runX - particles->vx[b]) * normalX +
+                        (particles->vy[a] + runY - particles->vy[b]) * normalY +
+                        (particles->vz[a] + runZ - particles->vz[b]) * normalZ + 2.0f * force;
+
+    float push = 2.0f * force;
+
+    // Only resolve if particles are moving towards each other
+    if (vDotN <= 0) {
+        push -= vDotN * (friction * (running ? 1.0f : contactShare(contacts, a, b)));
+    }
+
+    dv[0] += normalX * push;
+    dv[1] += normalY * push;
+    dv[2] += normalZ * push;
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+
+#include "simulation/containers/particleStore.h"
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The pair law a block kernel applies, see contactResponse: the sequential one
+ * without contacts, the simultaneous one with the contact count of every
+ * particle. With scatter the block particles take the opposite velocity
+ * change, subtracted from scatter[0..2]. The sequential law scatters into the
+ * store velocities, the simultaneous one into accumulators.
+ */
+typedef struct {
+    float repulsion;
+    float friction;
+    const uint16_t *contacts;
+    float *scatter[3];
+} ContactLaw;
+
+/**
+ * Evaluates contactResponse of particle a against every particle of [begin, end)
+ * under law and adds the velocity change of a to dv. Coincident particles, and
+ * therefore a itself, are skipped. Returns the number of contacts and raises
+ * overlap to the deepest of them, relative to the contact distance. Without dv
+ * the contacts are only counted and neither the velocities nor overlap change.
+ */
+typedef int (*ContactBlockKernel)(const ParticleStore *particles, int a, int begin, int end, const ContactLaw *law, float dv[3], float *overlap);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Resolves PAIR_KERNEL_AUTO and falls back to scalar if the CPU lacks the instructions
+PairKernel resolvePairKernel(PairKernel kernel);
+ContactBlockKernel getContactBlockKernel(PairKernel kernel);
+const char *pairKernelName(PairKernel kernel);
+
+int contactBlockScalar(const ParticleStore *particles, int a, int begin, int end, const ContactLaw *law, float dv[3], float *overlap);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,8 +5,8 @@
  */
 
 
-#include "simulation/containers/particle.h"
+#include "simulation/containers/particleStore.h"
 #include "simulation/containers/domain.h"
 #include "simulation/containers/domainConfig.h"
 
-void applyGravity(Particle* particle, V3 *gravity);
+void applyGravity(ParticleStore *particles, size_t begin, size_t end, const V3 *gravity);
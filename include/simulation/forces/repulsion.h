@@ -5,10 +5,10 @@
  */
 
 
-#include "simulation/containers/particle.h"
+#include "simulation/containers/particleStore.h"
 #include "simulation/containers/domain.h"
 #include "simulation/containers/domainConfig.h"
 
 #include <math.h>
 
-void handleRepulsion(Particle *a, Particle *b, float distance, float repulsion);
+void handleRepulsion(ParticleStore *particles, int a, int b, float distance, float repulsion);
@@ -0,0 +1,44 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/particleStore.h"
+#include "simulation/containers/octree.h"
+#include "simulation/containers/domainConfig.h"
+
+#include <stddef.h>
+
+/**
+ * Pairwise gravity between the particles, Barnes-Hut over an Octree. A node
+ * stands in for its particles once it is further away than its edge over
+ * openingAngle plus the offset of its centre of mass, which keeps a point
+ * inside the node from ever accepting it. Accepted nodes pull through their
+ * monopole and quadrupole, the particles of the leaves that are reached are
+ * summed directly, and openingAngle 0 sums every pair directly. Distances are
+ * softened to sqrt(d^2 + softening^2), the contacts take over up close.
+ *
+ * computeSelfGravity walks the tree once per leaf for all of its particles,
+ * each of which still accepts nodes by its own distance, so they get the pull
+ * of a walk of their own while the nodes near the top are only loaded once.
+ * With the AVX2 or AVX-512 pair kernel the eight particles of a leaf are
+ * walked as the lanes of one vector.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fills the pull of the particles of tree->leaves[begin..end), for unit strength. kernel has to be resolved
+void computeSelfGravity(Octree *tree, size_t begin, size_t end, float openingAngle, float softening, PairKernel kernel);
+
+// Adds strength times the pull to the velocities of particles [begin, end)
+void applySelfGravity(const Octree *tree, ParticleStore *particles, size_t begin, size_t end, float strength);
+
+// Pull at (x, y, z) for unit strength by a walk of its own, a particle sitting there does not pull itself
+void gravityAt(const Octree *tree, float x, float y, float z, float openingAngle, float softening, float out[3]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+
+#include <stdint.h>
+
+// Small deterministic generator so runs can be reproduced from a seed
+typedef struct {
+    uint64_t state;
+} Rng;
+
+void seedRng(Rng *rng, uint64_t seed);
+uint64_t nextRng(Rng *rng);
+float randomFloat(Rng *rng);
@@ -0,0 +1,158 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef struct Domain Domain;
+
+typedef enum {
+    // updateChunks, including neighbour list checks and builds
+    METRIC_PHASE_CHUNKS,
+    // Pair traversal and contact response
+    METRIC_PHASE_PAIRS,
+    // Gravity and boundaries, plus applying gathered contacts on the decomposed path
+    METRIC_PHASE_FORCES,
+    // Position update
+    METRIC_PHASE_INTEGRATION,
+    // Handing a frame to the visualiser
+    METRIC_PHASE_SNAPSHOT,
+    // Migration and halo exchange between the ranks of a decomposed run
+    METRIC_PHASE_EXCHANGE,
+    // Sinks, compaction and emitters, see population.h
+    METRIC_PHASE_POPULATION,
+    METRIC_PHASE_COUNT
+} MetricPhase;
+
+typedef enum {
+    METRICS_FORMAT_JSON_LINES,
+    METRICS_FORMAT_CSV
+} MetricsFormat;
+
+/**
+ * Counters are always kept, they cost an add per chunk or contact. Phase
+ * timers and chunk occupancy only run when timed is set (Config.metrics).
+ */
+typedef struct {
+    bool timed;
+
+    size_t steps;
+    // Live particles summed over the steps
+    size_t particleSteps;
+    double phaseSeconds[METRIC_PHASE_COUNT];
+
+    // Frames advanced by stepFrame and the substeps it picked for the last one
+    size_t frames;
+    int substeps;
+
+    // Longest move relative to the radius of the particle and deepest overlap relative to the
+    // contact distance, of the last step and the largest since the last record
+    float stepTravel;
+    float stepOverlap;
+    float maxTravel;
+    float maxOverlap;
+
+    // Candidate pairs visited and those actually in contact
+    size_t pairTests;
+    size_t pairHits;
+
+    size_t chunkRebuilds;
+    size_t chunkReallocs;
+
+    // Particles that changed chunk, counted by incremental CHUNK_BUILDER_LISTS
+    size_t chunkMovers;
+
+    // Chunk edge in use and how often CHUNK_SIZING_AUTO changed it
+    float chunkSize;
+    size_t chunkRetunes;
+
+    // Share of consecutive particles in the same or touching chunks, CHUNK_BUILDER_LISTS
+    // only, and how often the store was sorted for it
+    double storeLocality;
+    size_t reorders;
+
+    // Chunks asleep in the last step and the particles in them, see Config.sleepSteps
+    size_t sleepingChunks;
+    size_t sleepingParticles;
+
+    // Particles added by the emitters, removed by the sinks or any other caller, and not added
+    // because the store was full. liveParticles is the store count at the last step
+    size_t emittedParticles;
+    size_t removedParticles;
+    size_t refusedParticles;
+    size_t liveParticles;
+
+    // Time the workers spent in pair tasks and waiting for the others during the pair passes,
+    // summed over the workers. Timed only, see pairTasks.h
+    double pairBusySeconds;
+    double pairIdleSeconds;
+
+    // Particles per chunk at the last rebuild, the mean is over occupied chunks
+    int maxOccupancy;
+    double meanOccupancy;
+} Metrics;
+
+// Appends one record per interval steps with the change since the previous record
+typedef struct {
+    FILE *file;
+    MetricsFormat format;
+    int interval;
+
+    // Totals at the previous record
+    Metrics last;
+} MetricsLog;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline double metricsClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Start of a timed phase, free when the metrics are not timed
+static inline double beginPhase(const Metrics *metrics) {
+    return metrics->timed ? metricsClock() : 0.0;
+}
+
+// Adds the time since start to the phase and returns the start of the next one
+static inline double endPhase(Metrics *metrics, MetricPhase phase, double start) {
+    if (!metrics->timed) return 0.0;
+
+    const double now = metricsClock();
+    metrics->phaseSeconds[phase] += now - start;
+
+    return now;
+}
+
+const char *metricPhaseName(MetricPhase phase);
+
+// Sets up the counters and opens Config.metricsPath if set
+void initMetrics(Domain *domain);
+void resetMetrics(Domain *domain);
+
+// Starts a new log and turns the timers on, a .csv path selects CSV over JSON lines
+void openMetricsLog(Domain *domain, const char *path, int interval);
+
+// Counts a finished step, takes its travel and overlap from the workers and appends a record every Config.metricsInterval steps
+void recordStep(Domain *domain);
+
+// Writes the steps since the last record, if any, and closes the log
+void closeMetricsLog(Domain *domain);
+
+// Occupancy of the current chunks, done by updateChunks when timed
+void measureOccupancy(Domain *domain);
+
+void writeMetricsHeader(FILE *file, MetricsFormat format);
+void writeMetricsRecord(FILE *file, MetricsFormat format, const Metrics *window, size_t step);
+
+#ifdef __cplusplus
+}
+#endif
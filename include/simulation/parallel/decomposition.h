@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+#include "simulation/containers/particleStore.h"
+#include "simulation/parallel/transport.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One particle on the wire
+// Chunk layers of ghosts on either side of a slab, and the fewest layers a slab may have
+#define DECOMPOSITION_HALO_LAYERS 2
+
+typedef struct {
+    float x, y, z;
+    float vx, vy, vz;
+    float radius;
+    uint32_t id;
+    uint8_t col[3];
+} PackedParticle;
+
+/**
+ * Splits the chunk grid into slabs of whole chunk layers along its longest
+ * axis, one slab per rank. Every rank has a Domain of the full size but only
+ * holds the particles of its slab. Each substep it also receives copies of the
+ * DECOMPOSITION_HALO_LAYERS layers next to its slab on either side (the
+ * ghosts). The full stencil reaches one layer, the second one completes the
+ * contact counts of the first that the simultaneous law shares impulses by.
+ * The pair phase is the full stencil gather of gatherContacts over owned
+ * particles and ghosts alike, the ghosts only act as partners and are dropped
+ * again before integrating.
+ */
+typedef struct {
+    Transport *transport;
+    int rank;
+    int ranks;
+
+    int axis;
+    // Rank r owns the chunk layers [starts[r], starts[r + 1]) along axis
+    int *starts;
+
+    // Particles on their way to the lower neighbour, to the upper one, and passing through
+    PackedParticle *queues[3];
+    size_t queueCounts[3];
+    size_t queueCapacities[3];
+
+    // Totals since creation: ghosts received, particles handed to a neighbour, bytes sent
+    size_t ghosts;
+    size_t migrants;
+    size_t bytes;
+} Decomposition;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Needs the sorted builder, the full stencil, no neighbour lists and a chunk size that stays put
+Decomposition *createDecomposition(Domain *domain, Transport *transport);
+void destroyDecomposition(Decomposition *decomposition);
+
+// Keeps the particles of the rank's slab, every rank starts from the same full domain
+void distributeParticles(Decomposition *decomposition, Domain *domain);
+
+// One substep of the rank: migration, halo exchange, chunks, contacts, then forces and positions
+void stepDecomposed(Decomposition *decomposition, Domain *domain);
+
+// Rank 0 receives the particles of every rank into global, one rank after another. The others send theirs
+void collectParticles(Decomposition *decomposition, const Domain *domain, ParticleStore *global);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Nodes the placement report covers, memory on higher ones is not counted
+#define NUMA_MAX_NODES 64
+
+typedef struct Domain Domain;
+
+/**
+ * NUMA nodes and the cpus this process may run on, read from sysfs. Without
+ * NUMA there is a single node holding every cpu.
+ */
+typedef struct {
+    int nodeCount;
+
+    // Allowed cpus sorted by node, then by number, and the node of each
+    int cpuCount;
+    int *cpus;
+    int *cpuNodes;
+} NumaTopology;
+
+// Where the memory of a domain lives, see measurePlacement
+typedef struct {
+    // Bytes of the particle arrays, the sort buffer and the dense chunk grid on every node
+    size_t bytes[NUMA_MAX_NODES];
+
+    // Share of every worker's particles that lies on the node it runs on
+    double local;
+} NumaPlacement;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void readNumaTopology(NumaTopology *topology);
+void freeNumaTopology(NumaTopology *topology);
+
+// Cpu of worker under affinity, -1 for AFFINITY_NONE
+int workerCpu(const NumaTopology *topology, ThreadAffinity affinity, int worker);
+
+// Node of the cpu the calling thread runs on
+int currentNode(void);
+
+/**
+ * Pins every worker of the domain per Config.affinity and notes its node.
+ * With Config.numaFirstTouch every worker then writes its share of the
+ * particle arrays, the sort buffer, the velocity accumulators, the calm steps
+ * and the dense chunk grid before anyone else does, so the kernel backs those
+ * pages on its node, and the pool keeps handing it the same shares. The
+ * arrays have to be fresh mappings for that, which reserveParticleStore,
+ * calloc and malloc of blocks this large give. Called by initDomain.
+ */
+void placeDomain(Domain *domain);
+
+// Asks the kernel where the pages of the domain are, pages never touched count nowhere
+NumaPlacement measurePlacement(const Domain *domain);
+
+#ifdef __cplusplus
+}
+#endif
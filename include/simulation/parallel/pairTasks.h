@@ -0,0 +1,75 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/parallel/threadPool.h"
+
+#include <stddef.h>
+
+// Entries per block of the cost pass, the cut only looks at single entries within the block it falls into
+#define PAIR_COST_GRAIN 256
+
+// Tasks cut per worker, whatever the estimate gets wrong is left to stealing
+#define PAIR_TASKS_PER_WORKER 8
+
+typedef struct Domain Domain;
+typedef struct Chunk Chunk;
+
+// Chunk of entry of a pair pass, context is what the pass hands to runPairTasks
+typedef const Chunk *(*PairEntryChunk)(const void *context, size_t entry);
+
+/**
+ * The parallel pair phase over chunks as tasks of equal estimated work. Under
+ * gravity nearly all particles lie in the bed on the floor, so equal numbers
+ * of chunks are anything but equal work: a chunk of n particles visits about
+ * n * (n + its neighbours' particles) pairs, and an empty one none. With
+ * PAIR_SCHEDULE_WEIGHTED every pass first estimates that for each of its
+ * entries, in parallel, and cuts the entries into PAIR_TASKS_PER_WORKER tasks
+ * per worker of equal estimated work, which parallelForTasks runs with
+ * stealing. The estimate is taken from the chunks of the current substep, so
+ * it follows the particles as the bed settles or a jet moves.
+ *
+ * Every pass is timed per worker while the metrics are timed: busy is the
+ * time in the pair tasks, idle the rest of the pass, spent waiting for the
+ * slowest worker.
+ */
+typedef struct {
+    // Estimated work of every entry and of every block of PAIR_COST_GRAIN entries
+    size_t *costs;
+    size_t *blockCosts;
+    size_t capacity;
+
+    // Task t covers entries [bounds[t], bounds[t + 1])
+    size_t *bounds;
+    size_t taskCount;
+
+    // Per worker, since the last resetMetrics
+    double *busySeconds;
+    double *idleSeconds;
+} PairTasks;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void initPairTasks(PairTasks *tasks, int workers);
+void freePairTasks(PairTasks *tasks);
+
+// Clears the busy and idle times of the workers
+void resetPairTasks(PairTasks *tasks, int workers);
+
+// Pair work a chunk is estimated at, its particles times those in it and around it
+size_t estimatePairWork(const Domain *domain, const Chunk *chunk);
+
+/**
+ * Runs task over entries [0, count) of a pair pass, in blocks of grain with
+ * PAIR_SCHEDULE_BLOCKS and in weighted tasks with PAIR_SCHEDULE_WEIGHTED, on
+ * the pool of the domain or at once without one.
+ */
+void runPairTasks(Domain *domain, size_t count, size_t grain, PairEntryChunk entryChunk, const void *entries, ParallelTask task, void *context);
+
+#ifdef __cplusplus
+}
+#endif
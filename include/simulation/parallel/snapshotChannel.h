@@ -0,0 +1,56 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domainConfig.h"
+#include "simulation/containers/particle.h"
+#include "simulation/containers/particleStore.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One published frame, only ever read by the consumer that acquired it
+typedef struct {
+    Particle *particles;
+    size_t count;
+    Config config;
+
+    // Number of the publish that filled it, starting at 1
+    uint64_t frame;
+} Snapshot;
+
+/**
+ * Triple buffered handoff from the simulation to a single consumer. The
+ * producer fills its back buffer and swaps it with the shared middle one, the
+ * consumer swaps its front buffer with the middle one when that is newer.
+ * Neither side ever waits on the other and a frame is never read while written.
+ */
+typedef struct SnapshotChannel SnapshotChannel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every frame holds up to count particles, as many as the store had when it was published
+SnapshotChannel *createSnapshotChannel(size_t count);
+void destroySnapshotChannel(SnapshotChannel *channel);
+
+// Most particles a frame can hold, the count the channel was created with
+size_t snapshotCapacity(const SnapshotChannel *channel);
+
+// Producer side, copies the store into the back buffer and makes it the newest frame
+void publishSnapshot(SnapshotChannel *channel, const ParticleStore *particles, const Config *config);
+
+// Consumer side, the newest frame if one arrived since the last call, otherwise NULL
+const Snapshot *acquireSnapshot(SnapshotChannel *channel);
+
+// Frames published, and frames overwritten before the consumer acquired them
+uint64_t snapshotsPublished(const SnapshotChannel *channel);
+uint64_t snapshotsDropped(const SnapshotChannel *channel);
+
+#ifdef __cplusplus
+}
+#endif
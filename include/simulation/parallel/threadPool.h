@@ -0,0 +1,50 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Processes items [begin, end) on the given worker, workers are numbered from 0
+typedef void (*ParallelTask)(void *context, size_t begin, size_t end, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The calling thread takes part as worker 0, so threads - 1 threads are started
+ThreadPool *createThreadPool(int threads);
+void destroyThreadPool(ThreadPool *pool);
+
+int threadPoolSize(const ThreadPool *pool);
+
+// Runs task over [0, count) in blocks of grain items and returns once all are done
+void parallelFor(ThreadPool *pool, size_t count, size_t grain, ParallelTask task, void *context);
+
+/**
+ * Runs task over [bounds[t], bounds[t + 1]) for every task t below tasks, meant
+ * to be of about equal cost. Every worker gets a contiguous share of the tasks
+ * and works through it from the front, and a worker that is done steals tasks
+ * from the back of the others' shares, neighbouring tasks in one call.
+ */
+void parallelForTasks(ThreadPool *pool, const size_t *bounds, size_t tasks, ParallelTask task, void *context);
+
+// Runs task once on every worker, as [worker, worker + 1)
+void runOnWorkers(ThreadPool *pool, ParallelTask task, void *context);
+
+/**
+ * With sharing, parallelFor splits [0, count) into one contiguous share per
+ * worker, and every worker works through its own share before it steals from
+ * the back of the others. So the same worker touches the same items every
+ * time, which keeps them on its NUMA node. Without, blocks go to whoever asks
+ * next.
+ */
+void setThreadPoolShares(ThreadPool *pool, bool sharing);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stddef.h>
+
+typedef enum {
+    // A ring buffer per direction in memory shared by the forked ranks
+    TRANSPORT_SHARED_MEMORY,
+    // A Unix stream socket between every pair of ranks
+    TRANSPORT_SOCKETS
+} TransportKind;
+
+/**
+ * Messages between the ranks of a decomposed run. Every rank reaches every
+ * other one, messages from one peer arrive whole and in the order they were
+ * sent. A send blocks once the stream to the peer is full, so of two ranks
+ * talking to each other one has to receive first, which exchangeMessage does.
+ *
+ * Backends only move bytes, see TransportOps in transport.c, so a network
+ * backend only has to provide another set of them.
+ */
+typedef struct Transport Transport;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sets up the streams between ranks processes, once in the process that forks them
+Transport *createTransport(TransportKind kind, int ranks);
+
+// In every rank after the fork, keeps the ends of rank and drops the others
+void attachTransport(Transport *transport, int rank);
+
+void destroyTransport(Transport *transport);
+
+int transportRank(const Transport *transport);
+int transportRanks(const Transport *transport);
+const char *transportName(TransportKind kind);
+
+void sendMessage(Transport *transport, int peer, const void *data, size_t bytes);
+
+// Next message from peer, valid until the next receive
+const void *receiveMessage(Transport *transport, int peer, size_t *bytes);
+
+// Sends to peer and receives its message in turn, the lower rank sends first
+const void *exchangeMessage(Transport *transport, int peer, const void *data, size_t bytes, size_t *received);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    // Block of particles in one corner collapsing under gravity
+    SCENARIO_DAM_BREAK,
+    // Densely packed bed resting on the floor
+    SCENARIO_SETTLED_COLUMN,
+    // Sparse particles spread over the whole domain without gravity
+    SCENARIO_DILUTE_GAS,
+    // Ball of particles in the middle of the domain, held together by their own gravity only
+    SCENARIO_CLOUD,
+    // Empty domain filled from a hopper at the top, drained through outlets at both ends of the floor.
+    // numParticles is the capacity
+    SCENARIO_HOPPER
+} Scenario;
+
+bool parseScenario(const char *name, Scenario *scenario);
+const char *scenarioName(Scenario scenario);
+
+Config scenarioConfig(Scenario scenario, size_t numParticles);
+
+// Seeds the domain rng and places all particles
+void spawnScenario(Domain *domain, Scenario scenario, uint64_t seed);
+
+#ifdef __cplusplus
+}
+#endif
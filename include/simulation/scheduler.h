@@ -0,0 +1,64 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * Paces whole frames against the wall clock, apart from the simulated time
+ * they cover: every frame advances the simulation by 1 / fps seconds, whatever
+ * its substeps, and the modes only differ in when frames run and which of them
+ * reach the viewer.
+ *
+ * SCHEDULE_BATCH steps frames back to back. SCHEDULE_REALTIME starts frame n
+ * at n / fps seconds; a frame that runs late is followed by the overdue ones
+ * back to back, but slots more than catchUpFrames behind are dropped and the
+ * simulated time falls behind for good. SCHEDULE_FRAME_SKIP catches up the
+ * same way but publishes at most one frame per slot, so a viewer gets the
+ * latest state rather than a burst of stale ones.
+ */
+typedef struct {
+    ScheduleMode mode;
+    double frameSeconds;
+    int catchUpFrames;
+
+    struct timespec start;
+    // Wall seconds after start at which the next frame is due, and the last one was published
+    double due;
+    double published;
+
+    size_t frames;
+    // Frames that started after their slot, slots given up, frames left unpublished
+    size_t lateFrames;
+    size_t droppedFrames;
+    size_t skippedFrames;
+} FrameScheduler;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool parseSchedule(const char *name, ScheduleMode *mode);
+const char *scheduleName(ScheduleMode mode);
+
+// Starts the clock, the first frame is due at once
+void initScheduler(FrameScheduler *scheduler, const Config *config);
+
+// Sleeps until the next frame is due, returns at once in SCHEDULE_BATCH or when behind
+void awaitFrame(FrameScheduler *scheduler);
+
+// Books a stepped frame and returns whether to publish it
+bool completeFrame(FrameScheduler *scheduler);
+
+double simulatedSeconds(const FrameScheduler *scheduler);
+double wallSeconds(const FrameScheduler *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,10 +7,14 @@
 #include "simulation/containers/domain.h"
 #include "simulation/containers/particle.h"
 
-#include "simulation/forces/boundary.h"
-#include "simulation/forces/gravity.h"
-#include "simulation/forces/collision.h"
-#include "simulation/forces/repulsion.h"
+#include "simulation/parallel/snapshotChannel.h"
+
+#include "simulation/step.h"
+#include "simulation/scheduler.h"
+
+#include "simulation/scenarios.h"
+#include "simulation/checkpoint.h"
+#include "simulation/trajectory.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,7 +27,7 @@
 extern "C" {
 #endif
 
-void startSimulation(Domain* domain, Config config);
+void startSimulation(SnapshotChannel* channel, Config config);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+#include "simulation/containers/particleStore.h"
+
+#include "simulation/forces/boundary.h"
+#include "simulation/forces/gravity.h"
+#include "simulation/forces/selfGravity.h"
+#include "simulation/forces/collision.h"
+#include "simulation/forces/repulsion.h"
+#include "simulation/forces/contact.h"
+#include "simulation/forces/contactBlock.h"
+
+#include "simulation/parallel/threadPool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void handleParticleInteraction(int a, int b, Domain *domain);
+
+// Advances the domain by one substep, the chunks must be up to date
+void stepGlobal(Domain *domain);
+
+// Advances the domain by one frame of config.supsampling substeps, updating the population and the chunks before each.
+// With config.adaptiveSubsteps the substeps of the next frame follow from the travel and overlap of this one
+void stepFrame(Domain *domain);
+
+// The two halves of the step under the simultaneous law, see initSimultaneousContacts.
+// gatherContacts only reads the store and leaves the velocity change of every particle under the
+// simultaneous law in dvx, dvy and dvz, applyGathered adds them and moves on with forces and positions
+void gatherContacts(Domain *domain);
+void applyGathered(Domain *domain);
+
+#ifdef __cplusplus
+}
+#endif
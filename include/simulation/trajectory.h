@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+#include "simulation/containers/domainConfig.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRAJECTORY_VERSION 1
+
+// Frames between two absolute frames of TRAJECTORY_DELTA
+#define TRAJECTORY_KEYFRAME_INTERVAL 32
+
+/**
+ * A trajectory file is a header followed by self describing frames, each with
+ * its step, flags and payload size, so readers can skip frames. Particles are
+ * stored in id order, whatever order the store had them in.
+ */
+typedef struct TrajectoryWriter TrajectoryWriter;
+typedef struct TrajectoryReader TrajectoryReader;
+
+// One decoded frame, velocities are only set if the file has them
+typedef struct {
+    uint64_t step;
+    size_t count;
+    bool velocities;
+
+    float *x;
+    float *y;
+    float *z;
+    float *vx;
+    float *vy;
+    float *vz;
+} TrajectoryFrame;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames are encoded and written by a background thread, depth frames can wait for it
+TrajectoryWriter *createTrajectoryWriter(const char *path, size_t count, const Config *config, int depth);
+
+// Writes all queued frames and closes the file
+void destroyTrajectoryWriter(TrajectoryWriter *writer);
+
+// Waits until the queued frames are written
+void flushTrajectoryWriter(TrajectoryWriter *writer);
+
+/**
+ * Copies every Config.trajectoryInterval-th frame into the queue. Never waits
+ * for the disk, a frame that finds the queue full is dropped and counted.
+ * Returns true if the frame was queued.
+ */
+bool submitTrajectoryFrame(TrajectoryWriter *writer, const Domain *domain);
+
+uint64_t trajectoryFramesWritten(const TrajectoryWriter *writer);
+uint64_t trajectoryFramesDropped(const TrajectoryWriter *writer);
+
+// Bytes in the file, and what the same frames take as raw floats
+uint64_t trajectoryBytesWritten(const TrajectoryWriter *writer);
+uint64_t trajectoryRawBytes(const TrajectoryWriter *writer);
+
+TrajectoryReader *openTrajectory(const char *path);
+void closeTrajectory(TrajectoryReader *reader);
+
+// The next frame, valid until the next call. Returns NULL at the end of the file
+const TrajectoryFrame *readTrajectoryFrame(TrajectoryReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
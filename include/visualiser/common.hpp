@@ -11,4 +11,4 @@
 
 using std::thread;
 
-Domain* getSimulationHandle(Config config);
+SnapshotChannel* getSimulationHandle(Config config);
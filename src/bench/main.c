@@ -0,0 +1,1604 @@
+#include "simulation/start.h"
+#include "simulation/scenarios.h"
+#include "simulation/parallel/decomposition.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+typedef struct {
+    Scenario scenario;
+    size_t numParticles;
+    long steps;
+    long warmup;
+    int substeps;
+    bool adaptive;
+    int minSubsteps;
+    int maxSubsteps;
+    float maxTravel;
+    float maxOverlap;
+    bool scheduled;
+    ScheduleMode schedule;
+    int catchUpFrames;
+    uint64_t seed;
+    ChunkBuilder builder;
+    bool incremental;
+    ChunkGrid grid;
+    int gridLevels;
+    float radiusRatio;
+    int dim[3];
+    PairStencil stencil;
+    PairKernel kernel;
+    int threads;
+    PairSchedule pairSchedule;
+    ThreadAffinity affinity;
+    bool firstTouch;
+    bool hugePages;
+    int ranks;
+    TransportKind transport;
+    float skin;
+    float selfGravity;
+    float openingAngle;
+    float softening;
+    int sleepSteps;
+    float sleepTravel;
+    int targetChunkCount;
+    ChunkSizing chunkSizing;
+    int chunkRetuneInterval;
+    ChunkOrder chunkOrder;
+    int reorderInterval;
+    float reorderLocality;
+    bool verify;
+    bool checkKernels;
+    bool snapshots;
+    bool metrics;
+    const char *metricsPath;
+    int metricsInterval;
+    const char *restartPath;
+    const char *checkpointPath;
+    const char *trajectoryPath;
+    int trajectoryInterval;
+    TrajectoryFields trajectoryFields;
+    TrajectoryEncoding trajectoryEncoding;
+} BenchOptions;
+
+static void printUsage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --scenario NAME   dam_break, settled_column, dilute_gas, cloud or hopper (default dam_break)\n"
+        "  --particles N     number of particles, the capacity for hopper (default 20000)\n"
+        "  --steps N         measured steps (default 200)\n"
+        "  --warmup N        unmeasured steps before measuring (default 10)\n"
+        "  --substeps N      step whole frames of N substeps, --steps and --warmup then count frames (default 0, off)\n"
+        "  --adaptive MIN,MAX  step whole frames and pick their substeps from MIN to MAX, starting from --substeps\n"
+        "  --max-travel X    adaptive, most of its radius a particle may move per substep (default 0.1)\n"
+        "  --max-overlap X   adaptive, most of the contact distance a contact may overlap (default 0, no limit)\n"
+        "  --schedule NAME   step frames of 1/60 s paced batch, realtime or skip, see FrameScheduler\n"
+        "  --catch-up N      realtime and skip, most late frames caught up on (default 4)\n"
+        "  --seed N          rng seed (default 1)\n"
+        "  --builder NAME    chunk builder, lists or sorted (default sorted)\n"
+        "  --grid NAME       chunk grid, dense or sparse, sparse needs the sorted builder (default dense)\n"
+        "  --domain X,Y,Z    domain size (default 75,50,10)\n"
+        "  --radius-ratio X  spawn radii from mass / X up to mass (default 1)\n"
+        "  --levels N        sparse grid levels of halving chunk edge, one thread and the half stencil only (default 1)\n"
+        "  --incremental     lists builder, only move the particles that changed chunk\n"
+        "  --stencil NAME    pair stencil, full or half (default half)\n"
+        "  --threads N       worker threads of the step (default 1)\n"
+        "  --pair-schedule NAME  hand the pair chunks to the workers in blocks or in weighted tasks (default blocks)\n"
+        "  --affinity NAME   pin the workers none, compact or spread over the NUMA nodes (default none)\n"
+        "  --first-touch     every worker places its share of the particles and chunks on its node\n"
+        "  --huge-pages      with --first-touch, back the particle arrays with transparent huge pages\n"
+        "  --ranks N         split the domain into slabs over N processes, full stencil only (default 0, off)\n"
+        "  --transport NAME  how the ranks talk, shm or sockets (default shm)\n"
+        "  --kernel NAME     pair kernel, auto, scalar, avx2 or avx512 (default auto)\n"
+        "  --skin X          neighbour list skin distance, 0 disables the lists (default 0)\n"
+        "  --self-gravity G  strength of the gravity between the particles, 0 disables (default from the scenario)\n"
+        "  --opening-angle X  Barnes-Hut opening angle, 0 sums every pair directly (default 0.5)\n"
+        "  --softening X     gravity softening length (default 0.5)\n"
+        "  --sleep N         put chunks to sleep after N calm steps, sorted builder, half stencil and one thread only (default 0, off)\n"
+        "  --sleep-travel X  most of its radius a calm particle moves per step (default 0.1)\n"
+        "  --chunks N        size chunks for N of them over the domain instead of the contact reach\n"
+        "  --auto-chunks     size chunks from the contact reach (default)\n"
+        "  --chunk-retune N  with --auto-chunks, retune the size every N chunk rebuilds (default 0, never)\n"
+        "  --chunk-order NAME  order of the chunks in the store, rows or morton (default rows)\n"
+        "  --reorder N       lists builder, sort the store by chunk every N rebuilds (default 0, never)\n"
+        "  --reorder-locality X  lists builder, sort once the locality falls below X of its sorted value\n"
+        "  --metrics         time the phases and report them with the chunk occupancy\n"
+        "  --metrics-file F  write metrics records to F, JSON lines or CSV for a .csv name\n"
+        "  --metrics-interval N  steps per metrics record (default 10)\n"
+        "  --restart F       start from checkpoint F instead of spawning the scenario\n"
+        "  --checkpoint F    save a checkpoint to F after the measured steps\n"
+        "  --trajectory F    stream the measured steps to trajectory F and read it back\n"
+        "  --trajectory-interval N  steps per trajectory frame (default 1)\n"
+        "  --trajectory-fields NAME  positions or velocities, the latter with positions (default positions)\n"
+        "  --trajectory-encoding NAME  raw, quantised or delta (default delta)\n"
+        "  --snapshots       publish every measured step to a consumer thread\n"
+        "  --verify          compare one step from the final state against the serial path, exit 1 above the tolerance\n"
+        "  --check-kernels   check the pair kernels against handleParticleInteraction and exit\n",
+        program);
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions *options) {
+    static const struct option longOptions[] = {
+        {"scenario", required_argument, NULL, 's'},
+        {"particles", required_argument, NULL, 'n'},
+        {"steps", required_argument, NULL, 't'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"substeps", required_argument, NULL, 'u'},
+        {"adaptive", required_argument, NULL, 'a'},
+        {"max-travel", required_argument, NULL, 'x'},
+        {"max-overlap", required_argument, NULL, 'y'},
+        {"schedule", required_argument, NULL, 'H'},
+        {"catch-up", required_argument, NULL, 'K'},
+        {"seed", required_argument, NULL, 'r'},
+        {"builder", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 'j'},
+        {"pair-schedule", required_argument, NULL, 'q'},
+        {"affinity", required_argument, NULL, 'Y'},
+        {"first-touch", no_argument, NULL, 'M'},
+        {"huge-pages", no_argument, NULL, 'Z'},
+        {"ranks", required_argument, NULL, 'P'},
+        {"transport", required_argument, NULL, 'X'},
+        {"incremental", no_argument, NULL, 'N'},
+        {"grid", required_argument, NULL, 'g'},
+        {"domain", required_argument, NULL, 'D'},
+        {"radius-ratio", required_argument, NULL, 'z'},
+        {"levels", required_argument, NULL, 'e'},
+        {"stencil", required_argument, NULL, 'p'},
+        {"kernel", required_argument, NULL, 'k'},
+        {"skin", required_argument, NULL, 'l'},
+        {"self-gravity", required_argument, NULL, 'B'},
+        {"opening-angle", required_argument, NULL, 'J'},
+        {"softening", required_argument, NULL, 'W'},
+        {"sleep", required_argument, NULL, 'S'},
+        {"sleep-travel", required_argument, NULL, 'V'},
+        {"chunks", required_argument, NULL, 'G'},
+        {"auto-chunks", no_argument, NULL, 'A'},
+        {"chunk-retune", required_argument, NULL, 'U'},
+        {"chunk-order", required_argument, NULL, 'O'},
+        {"reorder", required_argument, NULL, 'Q'},
+        {"reorder-locality", required_argument, NULL, 'L'},
+        {"snapshots", no_argument, NULL, 'o'},
+        {"restart", required_argument, NULL, 'R'},
+        {"checkpoint", required_argument, NULL, 'C'},
+        {"trajectory", required_argument, NULL, 'T'},
+        {"trajectory-interval", required_argument, NULL, 'I'},
+        {"trajectory-fields", required_argument, NULL, 'F'},
+        {"trajectory-encoding", required_argument, NULL, 'E'},
+        {"metrics", no_argument, NULL, 'm'},
+        {"metrics-file", required_argument, NULL, 'f'},
+        {"metrics-interval", required_argument, NULL, 'i'},
+        {"verify", no_argument, NULL, 'v'},
+        {"check-kernels", no_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "s:n:t:w:u:a:x:y:H:K:r:b:Ng:D:z:e:j:q:Y:MZP:X:p:k:l:B:J:W:S:V:G:AU:O:Q:L:omf:i:R:C:T:I:F:E:vch", longOptions, NULL)) != -1) {
+        switch (option) {
+            case 's':
+                if (!parseScenario(optarg, &options->scenario)) {
+                    fprintf(stderr, "Unknown scenario: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'n':
+                options->numParticles = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                options->steps = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                options->warmup = strtol(optarg, NULL, 10);
+                break;
+            case 'H':
+                if (!parseSchedule(optarg, &options->schedule)) {
+                    fprintf(stderr, "Unknown schedule: %s\n", optarg);
+                    return false;
+                }
+                options->scheduled = true;
+                break;
+            case 'K':
+                options->catchUpFrames = strtol(optarg, NULL, 10);
+                break;
+            case 'r':
+                options->seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                if (strcmp(optarg, "lists") == 0) {
+                    options->builder = CHUNK_BUILDER_LISTS;
+                } else if (strcmp(optarg, "sorted") == 0) {
+                    options->builder = CHUNK_BUILDER_SORTED;
+                } else {
+                    fprintf(stderr, "Unknown chunk builder: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'N':
+                options->incremental = true;
+                break;
+            case 'P':
+                options->ranks = strtol(optarg, NULL, 10);
+                break;
+            case 'X':
+                if (strcmp(optarg, "shm") == 0) {
+                    options->transport = TRANSPORT_SHARED_MEMORY;
+                } else if (strcmp(optarg, "sockets") == 0) {
+                    options->transport = TRANSPORT_SOCKETS;
+                } else {
+                    fprintf(stderr, "Unknown transport: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'g':
+                if (strcmp(optarg, "dense") == 0) {
+                    options->grid = CHUNK_GRID_DENSE;
+                } else if (strcmp(optarg, "sparse") == 0) {
+                    options->grid = CHUNK_GRID_SPARSE;
+                } else {
+                    fprintf(stderr, "Unknown chunk grid: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'D':
+                if (sscanf(optarg, "%d,%d,%d", &options->dim[0], &options->dim[1], &options->dim[2]) != 3) {
+                    fprintf(stderr, "Domain size must be X,Y,Z: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'u':
+                options->substeps = strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                if (sscanf(optarg, "%d,%d", &options->minSubsteps, &options->maxSubsteps) != 2) {
+                    fprintf(stderr, "Adaptive substeps must be MIN,MAX: %s\n", optarg);
+                    return false;
+                }
+                options->adaptive = true;
+                break;
+            case 'x':
+                options->maxTravel = strtof(optarg, NULL);
+                break;
+            case 'y':
+                options->maxOverlap = strtof(optarg, NULL);
+                break;
+            case 'z':
+                options->radiusRatio = strtof(optarg, NULL);
+                break;
+            case 'e':
+                options->gridLevels = strtol(optarg, NULL, 10);
+                break;
+            case 'p':
+                if (strcmp(optarg, "full") == 0) {
+                    options->stencil = PAIR_STENCIL_FULL;
+                } else if (strcmp(optarg, "half") == 0) {
+                    options->stencil = PAIR_STENCIL_HALF;
+                } else {
+                    fprintf(stderr, "Unknown pair stencil: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'j':
+                options->threads = strtol(optarg, NULL, 10);
+                break;
+            case 'q':
+                if (strcmp(optarg, "blocks") == 0) {
+                    options->pairSchedule = PAIR_SCHEDULE_BLOCKS;
+                } else if (strcmp(optarg, "weighted") == 0) {
+                    options->pairSchedule = PAIR_SCHEDULE_WEIGHTED;
+                } else {
+                    fprintf(stderr, "Unknown pair schedule: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'Y':
+                if (strcmp(optarg, "none") == 0) {
+                    options->affinity = AFFINITY_NONE;
+                } else if (strcmp(optarg, "compact") == 0) {
+                    options->affinity = AFFINITY_COMPACT;
+                } else if (strcmp(optarg, "spread") == 0) {
+                    options->affinity = AFFINITY_SPREAD;
+                } else {
+                    fprintf(stderr, "Unknown thread affinity: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'M':
+                options->firstTouch = true;
+                break;
+            case 'Z':
+                options->hugePages = true;
+                break;
+            case 'k': {
+                bool found = false;
+                for (int kernel = PAIR_KERNEL_AUTO; kernel <= PAIR_KERNEL_AVX512; ++kernel) {
+                    if (strcmp(optarg, pairKernelName((PairKernel)kernel)) == 0) {
+                        options->kernel = (PairKernel)kernel;
+                        found = true;
+                    }
+                }
+                if (!found) {
+                    fprintf(stderr, "Unknown pair kernel: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'l':
+                options->skin = strtof(optarg, NULL);
+                break;
+            case 'B':
+                options->selfGravity = strtof(optarg, NULL);
+                break;
+            case 'J':
+                options->openingAngle = strtof(optarg, NULL);
+                break;
+            case 'W':
+                options->softening = strtof(optarg, NULL);
+                break;
+            case 'S':
+                options->sleepSteps = strtol(optarg, NULL, 10);
+                break;
+            case 'V':
+                options->sleepTravel = strtof(optarg, NULL);
+                break;
+            case 'G':
+                options->targetChunkCount = strtol(optarg, NULL, 10);
+                options->chunkSizing = CHUNK_SIZING_TARGET_COUNT;
+                break;
+            case 'A':
+                options->chunkSizing = CHUNK_SIZING_AUTO;
+                break;
+            case 'U':
+                options->chunkRetuneInterval = strtol(optarg, NULL, 10);
+                break;
+            case 'O':
+                if (strcmp(optarg, "rows") == 0) {
+                    options->chunkOrder = CHUNK_ORDER_ROWS;
+                } else if (strcmp(optarg, "morton") == 0) {
+                    options->chunkOrder = CHUNK_ORDER_MORTON;
+                } else {
+                    fprintf(stderr, "Unknown chunk order: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'Q':
+                options->reorderInterval = strtol(optarg, NULL, 10);
+                break;
+            case 'L':
+                options->reorderLocality = strtof(optarg, NULL);
+                break;
+            case 'o':
+                options->snapshots = true;
+                break;
+            case 'm':
+                options->metrics = true;
+                break;
+            case 'R':
+                options->restartPath = optarg;
+                break;
+            case 'C':
+                options->checkpointPath = optarg;
+                break;
+            case 'T':
+                options->trajectoryPath = optarg;
+                break;
+            case 'I':
+                options->trajectoryInterval = strtol(optarg, NULL, 10);
+                break;
+            case 'F':
+                if (strcmp(optarg, "positions") == 0) {
+                    options->trajectoryFields = TRAJECTORY_POSITIONS;
+                } else if (strcmp(optarg, "velocities") == 0) {
+                    options->trajectoryFields = TRAJECTORY_POSITIONS_VELOCITIES;
+                } else {
+                    fprintf(stderr, "Unknown trajectory fields: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'E':
+                if (strcmp(optarg, "raw") == 0) {
+                    options->trajectoryEncoding = TRAJECTORY_RAW;
+                } else if (strcmp(optarg, "quantised") == 0) {
+                    options->trajectoryEncoding = TRAJECTORY_QUANTISED;
+                } else if (strcmp(optarg, "delta") == 0) {
+                    options->trajectoryEncoding = TRAJECTORY_DELTA;
+                } else {
+                    fprintf(stderr, "Unknown trajectory encoding: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'f':
+                options->metricsPath = optarg;
+                break;
+            case 'i':
+                options->metricsInterval = strtol(optarg, NULL, 10);
+                break;
+            case 'v':
+                options->verify = true;
+                break;
+            case 'c':
+                options->checkKernels = true;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return options->numParticles > 0 && options->steps > 0 && options->warmup >= 0 && options->threads > 0 && options->ranks >= 0
+        && options->substeps >= 0 && (!options->adaptive || (options->minSubsteps >= 1 && options->maxSubsteps >= options->minSubsteps))
+        && options->maxTravel > 0 && options->maxOverlap >= 0 && options->catchUpFrames >= 0
+        && options->sleepSteps >= 0 && options->sleepTravel > 0
+        && options->openingAngle >= 0 && options->openingAngle <= 1 && options->softening >= 0
+        && options->radiusRatio >= 1 && options->gridLevels >= 1 && options->skin >= 0 && options->trajectoryInterval > 0
+        && options->targetChunkCount > 0 && options->chunkRetuneInterval >= 0
+        && options->reorderInterval >= 0 && options->reorderLocality >= 0 && options->reorderLocality < 1;
+}
+
+static double secondsBetween(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Pull of the tree against the direct sum, for particles spread over the store
+typedef struct {
+    size_t nodes;
+    double buildSeconds;
+    double treeSeconds;
+    double directSeconds;
+    double rmsError;
+    double maxError;
+} GravityAccuracy;
+
+/**
+ * Builds the gravity tree over the final state and pulls every particle
+ * through it as a step does, then compares with the direct sum for up to 2000
+ * of them. Errors are relative to the size of the direct pull, the direct
+ * time is extrapolated from those to all particles.
+ */
+static GravityAccuracy measureGravity(Domain *domain) {
+    const Config *config = &domain->config;
+    const ParticleStore *store = &domain->particles;
+    Octree *tree = &domain->gravityTree;
+
+    GravityAccuracy accuracy = {0};
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    buildOctree(tree, store, config->mass);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    accuracy.nodes = tree->nodeCount;
+    accuracy.buildSeconds = secondsBetween(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    computeSelfGravity(tree, 0, tree->leafCount, config->openingAngle, config->softening, config->kernel);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    accuracy.treeSeconds = secondsBetween(&start, &end);
+
+    const size_t samples = store->count < 2000 ? store->count : 2000;
+    if (samples == 0) return accuracy;
+
+    const size_t stride = store->count / samples;
+    double sumSq = 0.0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t s = 0; s < samples; ++s) {
+        const size_t i = s * stride;
+
+        float direct[3];
+        gravityAt(tree, store->x[i], store->y[i], store->z[i], 0.0f, config->softening, direct);
+
+        const double dx = (double)tree->pullX[i] - direct[0];
+        const double dy = (double)tree->pullY[i] - direct[1];
+        const double dz = (double)tree->pullZ[i] - direct[2];
+        const double sizeSq = (double)direct[0] * direct[0] + (double)direct[1] * direct[1] + (double)direct[2] * direct[2];
+
+        const double error = sizeSq > 0 ? sqrt((dx * dx + dy * dy + dz * dz) / sizeSq) : 0.0;
+        sumSq += error * error;
+        accuracy.maxError = fmax(accuracy.maxError, error);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    accuracy.directSeconds = secondsBetween(&start, &end) / samples * store->count;
+
+    accuracy.rmsError = sqrt(sumSq / samples);
+
+    return accuracy;
+}
+
+// Largest verify_relative_error --verify passes, the references take the same law so only rounding differs
+#define VERIFY_TOLERANCE 1e-4
+
+// The same with sleeping, where it is relative to the travel limit that wakes a particle
+#define SLEEP_VERIFY_TOLERANCE 0.25
+
+/**
+ * Steps a serial copy of the domain and the domain itself once and returns the
+ * RMS velocity difference relative to the RMS speed of the serial result.
+ * With threads the reference is the serial step, which visits the chunks in
+ * the same colours, so anything beyond rounding is a race.
+ * Grid levels are checked against a single grid of the top level edge, which
+ * has to find the same contacts, hits holds the contacts of both steps.
+ * With sleeping the reference stays awake but starts with the sleepers held
+ * still as well. Sleepers that meet skip their pairs, which reaches the awake
+ * particles through the collisions, so only those are compared and the error
+ * is relative to Config.sleepTravel of their radius.
+ */
+static double verifyAgainstSerial(Domain *domain, size_t hits[2]) {
+    Config config = domain->config;
+    config.threads = 1;
+    config.gridLevels = 1;
+    config.sleepSteps = 0;
+
+    // initDomain scales the forces again, so start from the unscaled values
+    const float speedFactor = config.__internalSpeedFactor;
+    config.repulsion /= speedFactor;
+    config.selfGravity /= speedFactor;
+    config.gravity = mul3(&config.gravity, 1.0f / speedFactor);
+
+    Domain reference;
+    initDomain(&reference, config);
+    copyParticleStore(&domain->particles, &reference.particles);
+    reference.particles.count = domain->particles.count;
+
+    // A retuned grid visits pairs in another order
+    const float chunkSize = ldexpf(domain->chunkSize, domain->config.gridLevels - 1);
+    if (reference.chunkSize != chunkSize) {
+        resizeChunks(&reference, chunkSize);
+    }
+
+    // Sparse chunks keep the order they were first seen in, start both from the same store
+    if (domain->sparse != NULL) {
+        resizeChunks(domain, domain->chunkSize);
+    }
+
+    hits[0] = domain->metrics.pairHits;
+
+    updateChunks(domain);
+    stepGlobal(domain);
+
+    hits[0] = domain->metrics.pairHits - hits[0];
+
+    const ParticleStore *a = &domain->particles;
+    ParticleStore *b = &reference.particles;
+
+    // Levels sort the store another way, so particles are matched by id. Emitted ones start at the capacity
+    size_t *where = (size_t*)malloc(domain->population.nextId * sizeof(size_t));
+    for (size_t i = 0; i < a->count; ++i) {
+        where[a->id[i]] = i;
+    }
+
+    // Particles of sleeping chunks went into the step held still
+    bool *awake = (bool*)malloc(a->count * sizeof(bool));
+    for (size_t i = 0; i < a->count; ++i) {
+        awake[i] = true;
+    }
+
+    if (domain->calmSteps != NULL) {
+        for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+            const Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+            for (int i = chunk->begin; i < chunk->end; ++i) {
+                awake[i] = !chunk->asleep;
+            }
+        }
+
+        for (size_t i = 0; i < b->count; ++i) {
+            if (awake[where[b->id[i]]]) continue;
+
+            b->vx[i] = 0.0f;
+            b->vy[i] = 0.0f;
+            b->vz[i] = 0.0f;
+        }
+    }
+
+    updateChunks(&reference);
+    stepGlobal(&reference);
+
+    hits[1] = reference.metrics.pairHits;
+
+    double error = 0.0;
+    double speed = 0.0;
+    size_t compared = 0;
+
+    for (size_t i = 0; i < b->count; ++i) {
+        const size_t j = where[b->id[i]];
+        if (!awake[j]) continue;
+
+        const double dx = a->vx[j] - b->vx[i];
+        const double dy = a->vy[j] - b->vy[i];
+        const double dz = a->vz[j] - b->vz[i];
+
+        if (domain->calmSteps != NULL) {
+            const double limit = (double)domain->config.sleepTravel * b->radius[i];
+            error += (dx * dx + dy * dy + dz * dz) / (limit * limit);
+            compared++;
+            continue;
+        }
+
+        error += dx * dx + dy * dy + dz * dz;
+        speed += (double)b->vx[i] * b->vx[i] + (double)b->vy[i] * b->vy[i] + (double)b->vz[i] * b->vz[i];
+    }
+
+    free(awake);
+    free(where);
+    freeDomain(&reference);
+
+    if (domain->calmSteps != NULL) {
+        return compared > 0 ? sqrt(error / compared) : 0.0;
+    }
+
+    return speed > 0.0 ? sqrt(error / speed) : sqrt(error);
+}
+
+/**
+ * Stands in for the renderer: acquires frames as fast as it can and touches
+ * every particle of them. Frames must arrive in publish order.
+ */
+typedef struct {
+    SnapshotChannel *channel;
+    atomic_bool stop;
+    uint64_t consumed;
+    uint64_t outOfOrder;
+    double checksum;
+} SnapshotConsumer;
+
+static void *consumeSnapshots(void *argument) {
+    SnapshotConsumer *consumer = (SnapshotConsumer*)argument;
+    uint64_t lastFrame = 0;
+
+    while (!atomic_load(&consumer->stop)) {
+        const Snapshot *snapshot = acquireSnapshot(consumer->channel);
+        if (snapshot == NULL) {
+            sched_yield();
+            continue;
+        }
+
+        if (snapshot->frame <= lastFrame) consumer->outOfOrder++;
+        lastFrame = snapshot->frame;
+
+        for (size_t i = 0; i < snapshot->count; ++i) {
+            consumer->checksum += snapshot->particles[i].pos.y;
+        }
+
+        consumer->consumed++;
+    }
+
+    return NULL;
+}
+
+// Particles of one kernel check block, not a multiple of any vector width
+#define CHECK_BLOCK 37
+
+/**
+ * Places particle 0 and a block of partners around it, some overlapping and
+ * some not, and returns the largest relative error of the kernel against
+ * handleParticleInteraction applied in both directions to each pair in order,
+ * carrying the velocity of particle 0 from one pair to the next. The deepest
+ * overlap the kernel reports is checked the same way. The simultaneous law is
+ * checked against contactResponse from both sides of each pair on its own,
+ * with made up contact counts, and the count of contacts against its hits.
+ */
+static double checkKernel(Domain *domain, PairKernel kernel, uint64_t seed) {
+    seedRng(&domain->rng, seed);
+
+    ParticleStore *store = &domain->particles;
+    const float scale = 0.01f;
+
+    float start[CHECK_BLOCK + 1][3];
+    uint16_t contacts[CHECK_BLOCK + 1];
+
+    for (int i = 0; i <= CHECK_BLOCK; ++i) {
+        store->x[i] = 4.0f + (i > 0) * (randomFloat(&domain->rng) * 2.4f - 1.2f);
+        store->y[i] = 4.0f + (i > 0) * (randomFloat(&domain->rng) * 2.4f - 1.2f);
+        store->z[i] = 4.0f + (i > 0) * (randomFloat(&domain->rng) * 2.4f - 1.2f);
+        store->vx[i] = (randomFloat(&domain->rng) - 0.5f) * scale;
+        store->vy[i] = (randomFloat(&domain->rng) - 0.5f) * scale;
+        store->vz[i] = (randomFloat(&domain->rng) - 0.5f) * scale;
+        store->radius[i] = 0.3f + randomFloat(&domain->rng) * 0.4f;
+
+        start[i][0] = store->vx[i];
+        start[i][1] = store->vy[i];
+        start[i][2] = store->vz[i];
+        contacts[i] = 1 + (uint16_t)(randomFloat(&domain->rng) * 4.0f);
+    }
+
+    // Reference, the partners one after another and each on its own
+    float expectedA[3];
+    float expectedB[CHECK_BLOCK + 1][3];
+
+    domain->workerOverlap[0] = 0.0f;
+
+    for (int b = 1; b <= CHECK_BLOCK; ++b) {
+        handleParticleInteraction(0, b, domain);
+        handleParticleInteraction(b, 0, domain);
+
+        expectedB[b][0] = store->vx[b];
+        expectedB[b][1] = store->vy[b];
+        expectedB[b][2] = store->vz[b];
+
+        store->vx[b] = start[b][0];
+        store->vy[b] = start[b][1];
+        store->vz[b] = start[b][2];
+    }
+
+    expectedA[0] = store->vx[0] - start[0][0];
+    expectedA[1] = store->vy[0] - start[0][1];
+    expectedA[2] = store->vz[0] - start[0][2];
+
+    store->vx[0] = start[0][0];
+    store->vy[0] = start[0][1];
+    store->vz[0] = start[0][2];
+
+    const ContactBlockKernel contactBlock = getContactBlockKernel(kernel);
+    const float repulsion = domain->config.repulsion;
+    const float friction = domain->config.friction;
+
+    const ContactLaw sequential = {repulsion, friction, NULL, {store->vx, store->vy, store->vz}};
+
+    float dv[3] = {0.0f, 0.0f, 0.0f};
+    float overlap = 0.0f;
+    contactBlock(store, 0, 1, CHECK_BLOCK + 1, &sequential, dv, &overlap);
+
+    double maxError = fabs(overlap - domain->workerOverlap[0]);
+
+    for (int d = 0; d < 3; ++d) {
+        maxError = fmax(maxError, fabs(dv[d] - expectedA[d]) / scale);
+    }
+
+    for (int b = 1; b <= CHECK_BLOCK; ++b) {
+        maxError = fmax(maxError, fabs(store->vx[b] - expectedB[b][0]) / scale);
+        maxError = fmax(maxError, fabs(store->vy[b] - expectedB[b][1]) / scale);
+        maxError = fmax(maxError, fabs(store->vz[b] - expectedB[b][2]) / scale);
+
+        store->vx[b] = start[b][0];
+        store->vy[b] = start[b][1];
+        store->vz[b] = start[b][2];
+    }
+
+    // Simultaneous law, into accumulators from the start velocities
+    float scatterX[CHECK_BLOCK + 1] = {0.0f}, scatterY[CHECK_BLOCK + 1] = {0.0f}, scatterZ[CHECK_BLOCK + 1] = {0.0f};
+    const ContactLaw simultaneous = {repulsion, friction, contacts, {scatterX, scatterY, scatterZ}};
+
+    float simultaneousA[3] = {0.0f, 0.0f, 0.0f};
+    const int hits = contactBlock(store, 0, 1, CHECK_BLOCK + 1, &simultaneous, simultaneousA, &overlap);
+
+    float responseA[3] = {0.0f, 0.0f, 0.0f};
+    int expectedHits = 0;
+
+    for (int b = 1; b <= CHECK_BLOCK; ++b) {
+        float responseB[3] = {0.0f, 0.0f, 0.0f};
+
+        expectedHits += contactResponse(store, 0, b, repulsion, friction, contacts, responseA, &overlap);
+        contactResponse(store, b, 0, repulsion, friction, contacts, responseB, &overlap);
+
+        maxError = fmax(maxError, fabs(scatterX[b] - responseB[0]) / scale);
+        maxError = fmax(maxError, fabs(scatterY[b] - responseB[1]) / scale);
+        maxError = fmax(maxError, fabs(scatterZ[b] - responseB[2]) / scale);
+    }
+
+    for (int d = 0; d < 3; ++d) {
+        maxError = fmax(maxError, fabs(simultaneousA[d] - responseA[d]) / scale);
+    }
+
+    // A miscount is as wrong as it gets
+    const int counted = contactBlock(store, 0, 1, CHECK_BLOCK + 1, &simultaneous, NULL, NULL);
+    if (hits != expectedHits || counted != expectedHits) {
+        maxError = fmax(maxError, 1.0);
+    }
+
+    return maxError;
+}
+
+// Prints the result as JSON and returns the exit status
+static int checkKernels(uint64_t seed, int resultFd) {
+    const double tolerance = 1e-4;
+    double errors[PAIR_KERNEL_AVX512 + 1];
+
+    Config config = scenarioConfig(SCENARIO_DILUTE_GAS, CHECK_BLOCK + 1);
+    config.dim[0] = config.dim[1] = config.dim[2] = 8;
+    config.targetChunkCount = 1;
+    config.threads = 1;
+
+    Domain domain;
+    initDomain(&domain, config);
+
+    for (int kernel = PAIR_KERNEL_SCALAR; kernel <= PAIR_KERNEL_AVX512; ++kernel) {
+        errors[kernel] = 0.0;
+
+        for (int round = 0; round < 100; ++round) {
+            errors[kernel] = fmax(errors[kernel], checkKernel(&domain, (PairKernel)kernel, seed + round));
+        }
+    }
+
+    freeDomain(&domain);
+
+    fflush(stdout);
+    dup2(resultFd, STDOUT_FILENO);
+    close(resultFd);
+
+    bool passed = true;
+
+    printf("{\"kernels\": {");
+
+    for (int kernel = PAIR_KERNEL_SCALAR; kernel <= PAIR_KERNEL_AVX512; ++kernel) {
+        // Kernels the CPU lacks would only repeat the scalar one
+        if (resolvePairKernel((PairKernel)kernel) != kernel) continue;
+
+        passed = passed && errors[kernel] < tolerance;
+        printf("%s\"%s\": %.3e", kernel == PAIR_KERNEL_SCALAR ? "" : ", ", pairKernelName((PairKernel)kernel), errors[kernel]);
+    }
+
+    printf("}, \"tolerance\": %.1e, \"passed\": %s}\n", tolerance, passed ? "true" : "false");
+
+    return passed ? 0 : 1;
+}
+
+// FNV-1a over positions and velocities in store order
+static uint64_t hashState(const ParticleStore *store) {
+    uint64_t hash = 1469598103934665603ull;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        const float values[] = {store->x[i], store->y[i], store->z[i], store->vx[i], store->vy[i], store->vz[i]};
+        uint32_t bits[6];
+        memcpy(bits, values, sizeof(bits));
+
+        for (int k = 0; k < 6; ++k) {
+            hash = (hash ^ bits[k]) * 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+// What every rank reports to rank 0 at the end of a decomposed run
+typedef struct {
+    Metrics metrics;
+    size_t particles;
+    size_t ghosts;
+    size_t migrants;
+    size_t bytes;
+} RankReport;
+
+/**
+ * Runs the scenario on options->ranks forked processes, each stepping its slab
+ * with stepDecomposed. Rank 0 collects the particles and prints the result.
+ * With --verify the collected state is also stepped once by stepGlobal on a
+ * single domain set up for the same gather, and compared against one more
+ * decomposed step.
+ */
+static int runDecomposed(const BenchOptions *options, Config config, int resultFd) {
+    if (options->restartPath != NULL || options->checkpointPath != NULL || options->trajectoryPath != NULL
+        || options->snapshots || options->metricsPath != NULL || options->substeps > 0 || options->adaptive || options->scheduled) {
+        fprintf(stderr, "--ranks does not combine with restarts, checkpoints, trajectories, snapshots, metrics files or frames\n");
+        return 1;
+    }
+
+    const int ranks = options->ranks;
+
+    // Ranks are the parallelism here, each one steps serially
+    config.threads = 1;
+
+    Transport *transport = createTransport(options->transport, ranks);
+
+    pid_t *children = (pid_t*)malloc(ranks * sizeof(pid_t));
+    int rank = 0;
+
+    for (int r = 1; r < ranks; ++r) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Failed to start rank %d\n", r);
+            exit(1);
+        }
+
+        if (pid == 0) {
+            rank = r;
+            break;
+        }
+
+        children[r] = pid;
+    }
+
+    attachTransport(transport, rank);
+
+    // Every rank spawns the same scenario and keeps its slab of it
+    Domain domain;
+    initDomain(&domain, config);
+    spawnScenario(&domain, options->scenario, options->seed);
+
+    Decomposition *decomposition = createDecomposition(&domain, transport);
+    distributeParticles(decomposition, &domain);
+
+    for (long i = 0; i < options->warmup; ++i) {
+        stepDecomposed(decomposition, &domain);
+    }
+
+    resetMetrics(&domain);
+    decomposition->ghosts = 0;
+    decomposition->migrants = 0;
+    decomposition->bytes = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < options->steps; ++i) {
+        stepDecomposed(decomposition, &domain);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const RankReport own = {domain.metrics, domain.particles.count, decomposition->ghosts, decomposition->migrants, decomposition->bytes};
+
+    ParticleStore global;
+    ParticleStore stepped;
+
+    if (rank == 0) {
+        initParticleStore(&global, config.numParticles);
+        initParticleStore(&stepped, config.numParticles);
+    }
+
+    collectParticles(decomposition, &domain, &global);
+
+    if (options->verify) {
+        stepDecomposed(decomposition, &domain);
+        collectParticles(decomposition, &domain, &stepped);
+    }
+
+    if (rank != 0) {
+        sendMessage(transport, 0, &own, sizeof(own));
+
+        destroyDecomposition(decomposition);
+        destroyTransport(transport);
+        freeDomain(&domain);
+        exit(0);
+    }
+
+    RankReport total = own;
+    size_t maxParticles = own.particles;
+    double phaseSeconds[METRIC_PHASE_COUNT];
+
+    for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+        phaseSeconds[phase] = own.metrics.phaseSeconds[phase];
+    }
+
+    for (int r = 1; r < ranks; ++r) {
+        size_t bytes;
+        const RankReport *report = (const RankReport*)receiveMessage(transport, r, &bytes);
+
+        total.metrics.pairTests += report->metrics.pairTests;
+        total.metrics.pairHits += report->metrics.pairHits;
+        total.particles += report->particles;
+        total.ghosts += report->ghosts;
+        total.migrants += report->migrants;
+        total.bytes += report->bytes;
+
+        if (report->particles > maxParticles) maxParticles = report->particles;
+
+        for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+            phaseSeconds[phase] += report->metrics.phaseSeconds[phase];
+        }
+    }
+
+    bool failed = false;
+
+    for (int r = 1; r < ranks; ++r) {
+        int status;
+        waitpid(children[r], &status, 0);
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Rank %d failed\n", r);
+            failed = true;
+        }
+    }
+
+    free(children);
+
+    if (failed || global.count != config.numParticles) {
+        fprintf(stderr, "Collected %zu of %zu particles\n", global.count, config.numParticles);
+        return 1;
+    }
+
+    double verifyError = 0.0;
+
+    if (options->verify) {
+        Domain reference;
+        initDomain(&reference, config);
+        copyParticleStore(&global, &reference.particles);
+
+        // The ranks gather under the simultaneous law, so does the reference
+        initSimultaneousContacts(&reference);
+
+        updateChunks(&reference);
+        stepGlobal(&reference);
+
+        const ParticleStore *b = &reference.particles;
+        double error = 0.0;
+        double speed = 0.0;
+
+        // Index of every id in the decomposed result
+        size_t *where = (size_t*)malloc(stepped.count * sizeof(size_t));
+        for (size_t i = 0; i < stepped.count; ++i) {
+            where[stepped.id[i]] = i;
+        }
+
+        for (size_t i = 0; i < b->count; ++i) {
+            const size_t j = where[b->id[i]];
+            const double dx = stepped.vx[j] - b->vx[i];
+            const double dy = stepped.vy[j] - b->vy[i];
+            const double dz = stepped.vz[j] - b->vz[i];
+
+            error += dx * dx + dy * dy + dz * dz;
+            speed += (double)b->vx[i] * b->vx[i] + (double)b->vy[i] * b->vy[i] + (double)b->vz[i] * b->vz[i];
+        }
+
+        free(where);
+        freeDomain(&reference);
+        verifyError = speed > 0.0 ? sqrt(error / speed) : sqrt(error);
+    }
+
+    const double elapsed = secondsBetween(&start, &end);
+    const double steps = options->steps;
+
+    fflush(stdout);
+    dup2(resultFd, STDOUT_FILENO);
+    close(resultFd);
+
+    printf("{\"scenario\": \"%s\"", scenarioName(options->scenario));
+    printf(", \"ranks\": %d", ranks);
+    printf(", \"transport\": \"%s\"", transportName(options->transport));
+    printf(", \"slab_axis\": %d", decomposition->axis);
+    printf(", \"kernel\": \"%s\"", pairKernelName(domain.config.kernel));
+    printf(", \"particles\": %zu", global.count);
+    printf(", \"steps\": %ld", options->steps);
+    printf(", \"seed\": %" PRIu64, options->seed);
+    printf(", \"seconds\": %.6f", elapsed);
+    printf(", \"steps_per_sec\": %.3f", steps / elapsed);
+    printf(", \"ns_per_particle_step\": %.3f", elapsed * 1e9 / (steps * global.count));
+    printf(", \"pair_tests\": %zu", total.metrics.pairTests);
+    printf(", \"pair_hits\": %zu", total.metrics.pairHits);
+    printf(", \"chunk_size\": %.4f", domain.chunkSize);
+    printf(", \"rank_imbalance\": %.3f", (double)maxParticles * ranks / total.particles);
+    printf(", \"ghosts_per_step\": %.1f", total.ghosts / steps);
+    printf(", \"migrants_per_step\": %.1f", total.migrants / steps);
+    printf(", \"exchange_kb_per_step\": %.2f", total.bytes / steps / 1e3);
+
+    if (options->metrics) {
+        for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+            printf(", \"%s_ms_per_step\": %.4f", metricPhaseName((MetricPhase)phase), phaseSeconds[phase] * 1e3 / ranks / steps);
+        }
+    }
+
+    // Over the ranks' stores one after another, see collectParticles
+    printf(", \"state_hash\": \"%016" PRIx64 "\"", hashState(&global));
+
+    const bool verifyPassed = verifyError <= VERIFY_TOLERANCE;
+
+    if (options->verify) {
+        printf(", \"verify_relative_error\": %.3e", verifyError);
+        printf(", \"verify_tolerance\": %.1e", VERIFY_TOLERANCE);
+        printf(", \"verify_passed\": %s", verifyPassed ? "true" : "false");
+    }
+
+    printf("}\n");
+
+    destroyDecomposition(decomposition);
+    destroyTransport(transport);
+    freeDomain(&domain);
+    freeParticleStore(&global);
+    freeParticleStore(&stepped);
+
+    return options->verify && !verifyPassed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = {
+        .scenario = SCENARIO_DAM_BREAK,
+        .numParticles = 20000,
+        .steps = 200,
+        .warmup = 10,
+        .substeps = 0,
+        .adaptive = false,
+        .minSubsteps = 1,
+        .maxSubsteps = 1,
+        .maxTravel = 0.1f,
+        .maxOverlap = 0.0f,
+        .scheduled = false,
+        .schedule = SCHEDULE_BATCH,
+        .catchUpFrames = 4,
+        .seed = 1,
+        .builder = CHUNK_BUILDER_SORTED,
+        .incremental = false,
+        .grid = CHUNK_GRID_DENSE,
+        .gridLevels = 1,
+        .radiusRatio = 1.0f,
+        .dim = {0, 0, 0},
+        .stencil = PAIR_STENCIL_HALF,
+        .kernel = PAIR_KERNEL_AUTO,
+        .threads = 1,
+        .pairSchedule = PAIR_SCHEDULE_BLOCKS,
+        .affinity = AFFINITY_NONE,
+        .firstTouch = false,
+        .hugePages = false,
+        .ranks = 0,
+        .transport = TRANSPORT_SHARED_MEMORY,
+        .skin = 0.0f,
+        .selfGravity = -1.0f,
+        .openingAngle = 0.5f,
+        .softening = 0.5f,
+        .sleepSteps = 0,
+        .sleepTravel = 0.1f,
+        .targetChunkCount = 262144,
+        .chunkSizing = CHUNK_SIZING_AUTO,
+        .chunkRetuneInterval = 0,
+        .chunkOrder = CHUNK_ORDER_ROWS,
+        .reorderInterval = 0,
+        .reorderLocality = 0.0f,
+        .verify = false,
+        .checkKernels = false,
+        .snapshots = false,
+        .metrics = false,
+        .metricsPath = NULL,
+        .metricsInterval = 10,
+        .restartPath = NULL,
+        .checkpointPath = NULL,
+        .trajectoryPath = NULL,
+        .trajectoryInterval = 1,
+        .trajectoryFields = TRAJECTORY_POSITIONS,
+        .trajectoryEncoding = TRAJECTORY_DELTA
+    };
+
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Keep stdout clean for the JSON result, diagnostics of the core go to stderr
+    fflush(stdout);
+    const int resultFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    if (options.checkKernels) {
+        return checkKernels(options.seed, resultFd);
+    }
+
+    Config config = scenarioConfig(options.scenario, options.numParticles);
+    config.chunkBuilder = options.builder;
+    config.incrementalChunks = options.incremental;
+    config.chunkGrid = options.grid;
+    config.gridLevels = options.gridLevels;
+    config.radiusRatio = options.radiusRatio;
+
+    // Frames keep their simulated time, more substeps make each of them shorter
+    const bool frames = options.substeps > 0 || options.adaptive || options.scheduled;
+    if (options.substeps > 0) {
+        config.supsampling = options.substeps;
+    }
+
+    config.schedule = options.schedule;
+    config.catchUpFrames = options.catchUpFrames;
+
+    config.adaptiveSubsteps = options.adaptive;
+    config.minSubsteps = options.minSubsteps;
+    config.maxSubsteps = options.maxSubsteps;
+    config.maxStepTravel = options.maxTravel;
+    config.maxStepOverlap = options.maxOverlap;
+
+    if (options.dim[0] > 0) {
+        for (int d = 0; d < 3; ++d) {
+            config.dim[d] = options.dim[d];
+        }
+    }
+    config.stencil = options.stencil;
+    config.kernel = options.kernel;
+    config.neighbourSkin = options.skin;
+    if (options.selfGravity >= 0) {
+        config.selfGravity = options.selfGravity;
+    }
+    config.openingAngle = options.openingAngle;
+    config.softening = options.softening;
+    config.sleepSteps = options.sleepSteps;
+    config.sleepTravel = options.sleepTravel;
+    config.targetChunkCount = options.targetChunkCount;
+    config.chunkSizing = options.chunkSizing;
+    config.chunkRetuneInterval = options.chunkRetuneInterval;
+    config.chunkOrder = options.chunkOrder;
+    config.reorderInterval = options.reorderInterval;
+    config.reorderLocality = options.reorderLocality;
+    config.threads = options.threads;
+    config.pairSchedule = options.pairSchedule;
+    config.affinity = options.affinity;
+    config.numaFirstTouch = options.firstTouch;
+    config.hugePages = options.hugePages;
+    config.metrics = options.metrics;
+    config.trajectoryPath = options.trajectoryPath;
+    config.trajectoryInterval = options.trajectoryInterval;
+    config.trajectoryFields = options.trajectoryFields;
+    config.trajectoryEncoding = options.trajectoryEncoding;
+
+    if (options.ranks > 0) {
+        return runDecomposed(&options, config, resultFd);
+    }
+
+    Domain domain;
+    double restartSeconds = 0.0;
+
+    if (options.restartPath != NULL) {
+        struct timespec loadStart, loadEnd;
+        clock_gettime(CLOCK_MONOTONIC, &loadStart);
+
+        loadCheckpoint(&domain, options.restartPath, config);
+
+        clock_gettime(CLOCK_MONOTONIC, &loadEnd);
+        restartSeconds = secondsBetween(&loadStart, &loadEnd);
+    } else {
+        initDomain(&domain, config);
+        spawnScenario(&domain, options.scenario, options.seed);
+    }
+
+    for (long i = 0; i < options.warmup; ++i) {
+        if (frames) {
+            stepFrame(&domain);
+            continue;
+        }
+
+        updatePopulation(&domain);
+        updateChunks(&domain);
+        stepGlobal(&domain);
+    }
+
+    // Warmup steps stay out of the metrics
+    resetMetrics(&domain);
+
+    if (options.metricsPath != NULL) {
+        openMetricsLog(&domain, options.metricsPath, options.metricsInterval);
+    }
+    domain.neighbours.builds = 0;
+    domain.neighbours.checks = 0;
+
+    SnapshotConsumer consumer = {0};
+    pthread_t consumerThread;
+
+    if (options.snapshots) {
+        consumer.channel = createSnapshotChannel(domain.config.numParticles);
+        atomic_init(&consumer.stop, false);
+        pthread_create(&consumerThread, NULL, consumeSnapshots, &consumer);
+    }
+
+    TrajectoryWriter *trajectory = NULL;
+
+    if (options.trajectoryPath != NULL) {
+        trajectory = createTrajectoryWriter(options.trajectoryPath, domain.particles.count, &config, 4);
+    }
+
+    int fewestSubsteps = domain.config.supsampling;
+    int mostSubsteps = domain.config.supsampling;
+
+    FrameScheduler scheduler;
+    bool publish = true;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    initScheduler(&scheduler, &domain.config);
+
+    for (long i = 0; i < options.steps; ++i) {
+        if (frames) {
+            if (options.scheduled) {
+                awaitFrame(&scheduler);
+            }
+
+            stepFrame(&domain);
+
+            if (options.scheduled) {
+                publish = completeFrame(&scheduler);
+            }
+
+            fewestSubsteps = domain.metrics.substeps < fewestSubsteps ? domain.metrics.substeps : fewestSubsteps;
+            mostSubsteps = domain.metrics.substeps > mostSubsteps ? domain.metrics.substeps : mostSubsteps;
+        } else {
+            updatePopulation(&domain);
+            updateChunks(&domain);
+            stepGlobal(&domain);
+        }
+
+        if (options.snapshots && publish) {
+            const double publishStart = beginPhase(&domain.metrics);
+            publishSnapshot(consumer.channel, &domain.particles, &domain.config);
+            endPhase(&domain.metrics, METRIC_PHASE_SNAPSHOT, publishStart);
+        }
+
+        if (trajectory != NULL) {
+            const double submitStart = beginPhase(&domain.metrics);
+            submitTrajectoryFrame(trajectory, &domain);
+            endPhase(&domain.metrics, METRIC_PHASE_SNAPSHOT, submitStart);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (options.snapshots) {
+        atomic_store(&consumer.stop, true);
+        pthread_join(consumerThread, NULL);
+    }
+
+    const double elapsed = secondsBetween(&start, &end);
+    const Metrics metrics = domain.metrics;
+    const double particleSteps = (double)metrics.particleSteps;
+    const size_t pairTests = metrics.pairTests;
+    const size_t neighbourBuilds = domain.neighbours.builds;
+    const size_t neighbourEntries = options.skin > 0 ? (size_t)domain.neighbours.start[domain.particles.count] : 0;
+
+    closeMetricsLog(&domain);
+
+    uint64_t trajectoryWritten = 0, trajectoryDropped = 0, trajectoryBytes = 0, trajectoryRaw = 0;
+    uint64_t trajectoryRead = 0;
+    double trajectoryError = -1.0;
+
+    if (trajectory != NULL) {
+        flushTrajectoryWriter(trajectory);
+
+        trajectoryWritten = trajectoryFramesWritten(trajectory);
+        trajectoryDropped = trajectoryFramesDropped(trajectory);
+        trajectoryBytes = trajectoryBytesWritten(trajectory);
+        trajectoryRaw = trajectoryRawBytes(trajectory);
+
+        destroyTrajectoryWriter(trajectory);
+    }
+
+    if (options.trajectoryPath != NULL) {
+        TrajectoryReader *reader = openTrajectory(options.trajectoryPath);
+        const TrajectoryFrame *frame;
+
+        while ((frame = readTrajectoryFrame(reader)) != NULL) {
+            trajectoryRead++;
+
+            // The last step is only in the file if the interval hit it
+            if (frame->step != domain.metrics.steps) continue;
+
+            const ParticleStore *store = &domain.particles;
+            trajectoryError = 0.0;
+
+            for (size_t i = 0; i < store->count; ++i) {
+                const uint32_t id = store->id[i];
+
+                trajectoryError = fmax(trajectoryError, fabs(frame->x[id] - store->x[i]));
+                trajectoryError = fmax(trajectoryError, fabs(frame->y[id] - store->y[i]));
+                trajectoryError = fmax(trajectoryError, fabs(frame->z[id] - store->z[i]));
+            }
+        }
+
+        closeTrajectory(reader);
+    }
+
+    double checkpointSeconds = 0.0;
+
+    if (options.checkpointPath != NULL) {
+        struct timespec saveStart, saveEnd;
+        clock_gettime(CLOCK_MONOTONIC, &saveStart);
+
+        saveCheckpoint(&domain, options.checkpointPath);
+
+        clock_gettime(CLOCK_MONOTONIC, &saveEnd);
+        checkpointSeconds = secondsBetween(&saveStart, &saveEnd);
+    }
+
+    // Identifies the final state, equal for a run and its continuation from a checkpoint
+    const uint64_t stateHash = hashState(&domain.particles);
+
+    size_t occupiedChunks = 0;
+    for (size_t c = 0; c < domain.chunkOrderCount; ++c) {
+        occupiedChunks += domain.chunks[domain.chunkOrder[c]].numParticles > 0;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    size_t verifyHits[2] = {0, 0};
+    const double verifyError = options.verify ? verifyAgainstSerial(&domain, verifyHits) : 0.0;
+
+    // Sleeping costs accuracy on purpose and has its own tolerance, and levels visit the pairs in another order, so they only have to find the same contacts
+    const double verifyTolerance = domain.config.sleepSteps > 0 ? SLEEP_VERIFY_TOLERANCE : VERIFY_TOLERANCE;
+    bool verifyPassed = verifyError <= verifyTolerance;
+    if (domain.config.gridLevels > 1) {
+        verifyPassed = verifyHits[0] == verifyHits[1];
+    }
+
+    const bool placed = options.affinity != AFFINITY_NONE || options.firstTouch;
+    NumaPlacement placement = {{0}, 0.0};
+    if (placed) {
+        placement = measurePlacement(&domain);
+    }
+
+    GravityAccuracy gravity = {0};
+    if (domain.config.selfGravity > 0) {
+        gravity = measureGravity(&domain);
+    }
+
+    fflush(stdout);
+    dup2(resultFd, STDOUT_FILENO);
+    close(resultFd);
+
+    printf("{\"scenario\": \"%s\"", scenarioName(options.scenario));
+    printf(", \"builder\": \"%s\"", options.builder == CHUNK_BUILDER_SORTED ? "sorted" : "lists");
+    printf(", \"stencil\": \"%s\"", options.stencil == PAIR_STENCIL_HALF ? "half" : "full");
+    printf(", \"chunk_order\": \"%s\"", options.chunkOrder == CHUNK_ORDER_MORTON ? "morton" : "rows");
+    printf(", \"kernel\": \"%s\"", pairKernelName(domain.config.kernel));
+    printf(", \"threads\": %d", options.threads);
+    printf(", \"particles\": %zu", domain.particles.count);
+    printf(", \"steps\": %ld", options.steps);
+    printf(", \"seed\": %" PRIu64, options.seed);
+    printf(", \"seconds\": %.6f", elapsed);
+    printf(", \"steps_per_sec\": %.3f", metrics.steps / elapsed);
+    printf(", \"ns_per_particle_step\": %.3f", elapsed * 1e9 / particleSteps);
+    printf(", \"pair_tests\": %zu", pairTests);
+    printf(", \"pair_tests_per_sec\": %.1f", pairTests / elapsed);
+    printf(", \"pair_hits\": %zu", metrics.pairHits);
+    printf(", \"chunk_size\": %.4f", domain.chunkSize);
+    printf(", \"chunk_retunes\": %zu", metrics.chunkRetunes);
+    printf(", \"chunk_grid\": \"%s\"", options.grid == CHUNK_GRID_SPARSE ? "sparse" : "dense");
+    printf(", \"chunk_grid_mb\": %.3f", chunkGridBytes(&domain) / 1e6);
+    printf(", \"occupied_chunks\": %zu", occupiedChunks);
+    printf(", \"grid_levels\": %d", options.gridLevels);
+    printf(", \"radius_ratio\": %.2f", options.radiusRatio);
+    printf(", \"max_rss_mb\": %.1f", usage.ru_maxrss / 1e3);
+    printf(", \"max_travel\": %.4f", metrics.maxTravel);
+    printf(", \"max_overlap\": %.4f", metrics.maxOverlap);
+
+    if (options.sleepSteps > 0) {
+        printf(", \"sleeping_chunks\": %zu", metrics.sleepingChunks);
+        printf(", \"sleeping_particles\": %zu", metrics.sleepingParticles);
+        printf(", \"awake_particles\": %zu", domain.particles.count - metrics.sleepingParticles);
+        printf(", \"chunk_sorts\": %zu", metrics.chunkRebuilds);
+    }
+
+    if (domain.config.emitterCount > 0 || domain.config.sinkCount > 0) {
+        printf(", \"capacity\": %zu", domain.config.numParticles);
+        printf(", \"mean_particles\": %.1f", (double)metrics.particleSteps / metrics.steps);
+        printf(", \"emitted\": %zu", metrics.emittedParticles);
+        printf(", \"removed\": %zu", metrics.removedParticles);
+        printf(", \"refused\": %zu", metrics.refusedParticles);
+    }
+
+    if (placed) {
+        static const char *affinityNames[] = {"none", "compact", "spread"};
+        const int workers = options.threads > 1 ? options.threads : 1;
+        const int nodes = domain.numa.nodeCount < NUMA_MAX_NODES ? domain.numa.nodeCount : NUMA_MAX_NODES;
+
+        printf(", \"affinity\": \"%s\"", affinityNames[options.affinity]);
+        printf(", \"first_touch\": %s", options.firstTouch ? "true" : "false");
+        printf(", \"huge_pages\": %s", options.hugePages ? "true" : "false");
+        printf(", \"numa_nodes\": %d", domain.numa.nodeCount);
+
+        printf(", \"worker_nodes\": [");
+        for (int w = 0; w < workers; ++w) {
+            printf("%s%d", w > 0 ? ", " : "", domain.workerNodes[w]);
+        }
+
+        printf("], \"placement_mb\": [");
+        for (int node = 0; node < nodes; ++node) {
+            printf("%s%.3f", node > 0 ? ", " : "", placement.bytes[node] / 1e6);
+        }
+
+        printf("], \"local_placement\": %.3f", placement.local);
+    }
+
+    if (frames) {
+        printf(", \"frames\": %zu", metrics.frames);
+        printf(", \"frames_per_sec\": %.3f", metrics.frames / elapsed);
+        printf(", \"substeps\": %zu", metrics.steps);
+        printf(", \"mean_substeps\": %.2f", (double)metrics.steps / metrics.frames);
+        printf(", \"min_substeps\": %d", fewestSubsteps);
+        printf(", \"max_substeps\": %d", mostSubsteps);
+    }
+
+    if (options.scheduled) {
+        printf(", \"schedule\": \"%s\"", scheduleName(options.schedule));
+        printf(", \"simulated_seconds\": %.3f", simulatedSeconds(&scheduler));
+        printf(", \"simulated_seconds_per_sec\": %.3f", simulatedSeconds(&scheduler) / elapsed);
+        printf(", \"late_frames\": %zu", scheduler.lateFrames);
+        printf(", \"dropped_frames\": %zu", scheduler.droppedFrames);
+        printf(", \"skipped_frames\": %zu", scheduler.skippedFrames);
+    }
+
+    if (options.builder == CHUNK_BUILDER_LISTS) {
+        printf(", \"store_locality\": %.3f", metrics.storeLocality);
+        printf(", \"reorders\": %zu", metrics.reorders);
+        printf(", \"chunk_movers_per_step\": %.1f", (double)metrics.chunkMovers / metrics.steps);
+    }
+
+    if (options.metrics) {
+        for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+            printf(", \"%s_ms_per_step\": %.4f", metricPhaseName((MetricPhase)phase), metrics.phaseSeconds[phase] * 1e3 / metrics.steps);
+        }
+
+        if (options.threads > 1) {
+            const double pairSeconds = metrics.pairBusySeconds + metrics.pairIdleSeconds;
+
+            printf(", \"pair_schedule\": \"%s\"", options.pairSchedule == PAIR_SCHEDULE_WEIGHTED ? "weighted" : "blocks");
+            printf(", \"worker_busy_ms\": [");
+            for (int w = 0; w < options.threads; ++w) {
+                printf("%s%.3f", w > 0 ? ", " : "", domain.pairTasks.busySeconds[w] * 1e3);
+            }
+
+            printf("], \"worker_idle_ms\": [");
+            for (int w = 0; w < options.threads; ++w) {
+                printf("%s%.3f", w > 0 ? ", " : "", domain.pairTasks.idleSeconds[w] * 1e3);
+            }
+
+            printf("], \"pair_idle\": %.4f", pairSeconds > 0 ? metrics.pairIdleSeconds / pairSeconds : 0.0);
+        }
+
+        printf(", \"chunk_rebuilds\": %zu", metrics.chunkRebuilds);
+        printf(", \"chunk_reallocs\": %zu", metrics.chunkReallocs);
+        printf(", \"max_occupancy\": %d", metrics.maxOccupancy);
+        printf(", \"mean_occupancy\": %.2f", metrics.meanOccupancy);
+    }
+
+    if (options.skin > 0) {
+        printf(", \"skin\": %.4f", options.skin);
+        printf(", \"neighbour_builds\": %zu", neighbourBuilds);
+        printf(", \"steps_per_neighbour_build\": %.2f", neighbourBuilds > 0 ? (double)metrics.steps / neighbourBuilds : (double)metrics.steps);
+        printf(", \"mean_neighbour_list_length\": %.2f", (double)neighbourEntries / domain.particles.count);
+    }
+
+    printf(", \"state_hash\": \"%016" PRIx64 "\"", stateHash);
+
+    if (options.restartPath != NULL) {
+        printf(", \"restart_load_ms\": %.3f", restartSeconds * 1e3);
+    }
+
+    if (options.checkpointPath != NULL) {
+        printf(", \"checkpoint_write_ms\": %.3f", checkpointSeconds * 1e3);
+    }
+
+    if (options.trajectoryPath != NULL) {
+        printf(", \"trajectory_frames_written\": %" PRIu64, trajectoryWritten);
+        printf(", \"trajectory_frames_dropped\": %" PRIu64, trajectoryDropped);
+        printf(", \"trajectory_frames_read\": %" PRIu64, trajectoryRead);
+        printf(", \"trajectory_bytes\": %" PRIu64, trajectoryBytes);
+        printf(", \"trajectory_compression\": %.2f", trajectoryBytes > 0 ? (double)trajectoryRaw / trajectoryBytes : 0.0);
+        printf(", \"trajectory_bytes_per_particle_frame\": %.3f", trajectoryWritten > 0 ? (double)trajectoryBytes / (trajectoryWritten * domain.particles.count) : 0.0);
+
+        if (trajectoryError >= 0.0) {
+            printf(", \"trajectory_max_position_error\": %.3e", trajectoryError);
+        }
+    }
+
+    if (options.snapshots) {
+        printf(", \"snapshots_published\": %" PRIu64, snapshotsPublished(consumer.channel));
+        printf(", \"snapshots_dropped\": %" PRIu64, snapshotsDropped(consumer.channel));
+        printf(", \"snapshots_consumed\": %" PRIu64, consumer.consumed);
+        printf(", \"snapshots_out_of_order\": %" PRIu64, consumer.outOfOrder);
+        destroySnapshotChannel(consumer.channel);
+    }
+
+    if (options.verify) {
+        printf(", \"verify_relative_error\": %.3e", verifyError);
+        printf(", \"verify_pair_hits\": %zu", verifyHits[0]);
+        printf(", \"verify_reference_pair_hits\": %zu", verifyHits[1]);
+        printf(", \"verify_tolerance\": %.1e", verifyTolerance);
+        printf(", \"verify_passed\": %s", verifyPassed ? "true" : "false");
+    }
+
+    if (domain.config.selfGravity > 0) {
+        printf(", \"opening_angle\": %.3f", domain.config.openingAngle);
+        printf(", \"gravity_tree_nodes\": %zu", gravity.nodes);
+        printf(", \"gravity_build_ms\": %.4f", gravity.buildSeconds * 1e3);
+        printf(", \"gravity_tree_ms\": %.4f", gravity.treeSeconds * 1e3);
+        printf(", \"gravity_direct_ms\": %.4f", gravity.directSeconds * 1e3);
+        printf(", \"gravity_rms_error\": %.3e", gravity.rmsError);
+        printf(", \"gravity_max_error\": %.3e", gravity.maxError);
+    }
+
+    printf("}\n");
+
+    freeDomain(&domain);
+
+    return options.verify && !verifyPassed ? 1 : 0;
+}
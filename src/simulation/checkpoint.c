@@ -0,0 +1,409 @@
+#include "simulation/checkpoint.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "PSIMCKPT"
+#define CHECKPOINT_ENDIANNESS 0x01020304u
+
+// Particle arrays in file order: x, y, z, vx, vy, vz, radius, col, id
+#define CHECKPOINT_ARRAYS 9
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianness;
+    uint64_t headerBytes;
+    uint64_t fileBytes;
+
+    uint64_t count;
+    uint64_t step;
+    uint64_t rngState;
+
+    // Config, forces before the timestep scaling of initDomain
+    int32_t dim[3];
+    float friction;
+    float gravity[3];
+    float repulsion;
+    float speed;
+    int32_t supsampling;
+    int32_t fps;
+    float mass;
+    int32_t targetChunkCount;
+    int32_t chunkBuilder;
+    int32_t stencil;
+    int32_t kernel;
+    float neighbourSkin;
+    int32_t threads;
+    float selfGravity;
+    float openingAngle;
+    float softening;
+
+    // Grid edge in use, a retuned grid visits pairs in its own order
+    float chunkSize;
+
+    // What the emitters still owe and the next id, so a changing population continues as it would have
+    float owed[MAX_EMITTERS];
+    uint32_t nextId;
+
+    // Byte offsets from the start of the file
+    uint64_t offsets[CHECKPOINT_ARRAYS];
+} CheckpointHeader;
+
+// Everything a checkpoint holds, detached from the domain for the background writer
+typedef struct {
+    Config config;
+    Rng rng;
+    size_t step;
+    float chunkSize;
+    float owed[MAX_EMITTERS];
+    uint32_t nextId;
+    const ParticleStore *particles;
+} CheckpointState;
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + PARTICLE_ALIGNMENT - 1) / PARTICLE_ALIGNMENT * PARTICLE_ALIGNMENT;
+}
+
+static const void *arrayData(const ParticleStore *particles, int array, size_t *bytes) {
+    const float *floats[] = {particles->x, particles->y, particles->z, particles->vx, particles->vy, particles->vz, particles->radius};
+
+    if (array < 7) {
+        *bytes = particles->count * sizeof(float);
+        return floats[array];
+    }
+
+    if (array == 7) {
+        *bytes = particles->count * 3 * sizeof(uint8_t);
+        return particles->col;
+    }
+
+    *bytes = particles->count * sizeof(uint32_t);
+    return particles->id;
+}
+
+static void fillHeader(CheckpointHeader *header, const CheckpointState *state) {
+    const Config *config = &state->config;
+    const float speedFactor = config->__internalSpeedFactor;
+
+    memset(header, 0, sizeof(CheckpointHeader));
+    memcpy(header->magic, CHECKPOINT_MAGIC, 8);
+    header->version = CHECKPOINT_VERSION;
+    header->endianness = CHECKPOINT_ENDIANNESS;
+    header->headerBytes = sizeof(CheckpointHeader);
+
+    header->count = state->particles->count;
+    header->step = state->step;
+    header->rngState = state->rng.state;
+
+    for (int d = 0; d < 3; ++d) {
+        header->dim[d] = config->dim[d];
+    }
+
+    header->friction = config->friction;
+    header->gravity[0] = config->gravity.x / speedFactor;
+    header->gravity[1] = config->gravity.y / speedFactor;
+    header->gravity[2] = config->gravity.z / speedFactor;
+    header->repulsion = config->repulsion / speedFactor;
+    header->speed = config->speed;
+    header->supsampling = config->supsampling;
+    header->fps = config->fps;
+    header->mass = config->mass;
+    header->targetChunkCount = config->targetChunkCount;
+    header->chunkBuilder = config->chunkBuilder;
+    header->stencil = config->stencil;
+    header->kernel = resolvePairKernel(config->kernel);
+    header->neighbourSkin = config->neighbourSkin;
+    header->threads = config->threads;
+    header->selfGravity = config->selfGravity / speedFactor;
+    header->openingAngle = config->openingAngle;
+    header->softening = config->softening;
+    header->chunkSize = state->chunkSize;
+    memcpy(header->owed, state->owed, sizeof(header->owed));
+    header->nextId = state->nextId;
+
+    uint64_t offset = alignOffset(sizeof(CheckpointHeader));
+    for (int array = 0; array < CHECKPOINT_ARRAYS; ++array) {
+        size_t bytes;
+        arrayData(state->particles, array, &bytes);
+
+        header->offsets[array] = offset;
+        offset = alignOffset(offset + bytes);
+    }
+
+    header->fileBytes = offset;
+}
+
+static void writeState(const CheckpointState *state, const char *path) {
+    CheckpointHeader header;
+    fillHeader(&header, state);
+
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp.%d", path, (int)getpid());
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to create checkpoint %s\n", temporary);
+        exit(1);
+    }
+
+    static const char padding[PARTICLE_ALIGNMENT] = {0};
+    bool written = fwrite(&header, sizeof(CheckpointHeader), 1, file) == 1;
+    uint64_t position = sizeof(CheckpointHeader);
+
+    for (int array = 0; array < CHECKPOINT_ARRAYS && written; ++array) {
+        written = fwrite(padding, 1, header.offsets[array] - position, file) == header.offsets[array] - position;
+
+        size_t bytes;
+        const void *data = arrayData(state->particles, array, &bytes);
+
+        written = written && fwrite(data, 1, bytes, file) == bytes;
+        position = header.offsets[array] + bytes;
+    }
+
+    written = written && fwrite(padding, 1, header.fileBytes - position, file) == header.fileBytes - position;
+
+    // Contents must be on disk before the rename makes them visible
+    written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+    if (fclose(file) != 0 || !written) {
+        fprintf(stderr, "Failed to write checkpoint %s\n", temporary);
+        unlink(temporary);
+        exit(1);
+    }
+
+    if (rename(temporary, path) != 0) {
+        fprintf(stderr, "Failed to move checkpoint %s to %s\n", temporary, path);
+        unlink(temporary);
+        exit(1);
+    }
+}
+
+static CheckpointState captureState(const Domain *domain, const ParticleStore *particles) {
+    CheckpointState state = {domain->config, domain->rng, domain->metrics.steps, domain->chunkSize, {0}, domain->population.nextId, particles};
+    memcpy(state.owed, domain->population.owed, sizeof(state.owed));
+
+    return state;
+}
+
+void saveCheckpoint(const Domain *domain, const char *path) {
+    const CheckpointState state = captureState(domain, &domain->particles);
+
+    writeState(&state, path);
+}
+
+// The run continues either way, but no longer as the one that wrote the checkpoint would have
+static void warnRunDiffers(const char *path, const char *setting) {
+    fprintf(stderr, "Warning: checkpoint %s was written with another %s, the restart will not follow the original run\n", path, setting);
+}
+
+// How to run matters too: the builder, stencil and kernel order and round the contacts differently,
+// the skin picks the pairs and more than one thread takes the simultaneous contact law
+static void checkRunSettings(const CheckpointHeader *header, const char *path, const Config *runtime) {
+    if (header->chunkBuilder != (int32_t)runtime->chunkBuilder) warnRunDiffers(path, "chunk builder");
+    if (header->stencil != (int32_t)runtime->stencil) warnRunDiffers(path, "pair stencil");
+    if (header->kernel != (int32_t)resolvePairKernel(runtime->kernel)) warnRunDiffers(path, "pair kernel");
+    if (header->neighbourSkin != runtime->neighbourSkin) warnRunDiffers(path, "neighbour skin");
+    if ((header->threads > 1) != (runtime->threads > 1)) warnRunDiffers(path, "thread count");
+}
+
+void loadCheckpoint(Domain *domain, const char *path, Config runtime) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open checkpoint %s\n", path);
+        exit(1);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader)) {
+        fprintf(stderr, "Checkpoint %s is too short\n", path);
+        exit(1);
+    }
+
+    // Private, so the simulation can write the arrays without touching the file
+    void *mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map checkpoint %s\n", path);
+        exit(1);
+    }
+
+    const CheckpointHeader *header = (const CheckpointHeader*)mapping;
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, 8) != 0 || header->endianness != CHECKPOINT_ENDIANNESS) {
+        fprintf(stderr, "%s is not a checkpoint of this platform\n", path);
+        exit(1);
+    }
+
+    if (header->version != CHECKPOINT_VERSION || header->headerBytes != sizeof(CheckpointHeader)) {
+        fprintf(stderr, "Checkpoint %s has version %u, expected %d\n", path, header->version, CHECKPOINT_VERSION);
+        exit(1);
+    }
+
+    if (header->fileBytes != (uint64_t)info.st_size) {
+        fprintf(stderr, "Checkpoint %s is truncated\n", path);
+        exit(1);
+    }
+
+    checkRunSettings(header, path, &runtime);
+
+    Config config = runtime;
+
+    for (int d = 0; d < 3; ++d) {
+        config.dim[d] = header->dim[d];
+    }
+
+    config.friction = header->friction;
+    config.gravity = (V3) {header->gravity[0], header->gravity[1], header->gravity[2]};
+    config.repulsion = header->repulsion;
+    config.selfGravity = header->selfGravity;
+    config.openingAngle = header->openingAngle;
+    config.softening = header->softening;
+    config.speed = header->speed;
+    config.supsampling = header->supsampling;
+    config.fps = header->fps;
+    config.mass = header->mass;
+
+    // A changing population keeps the capacity of runtime
+    const bool fixed = runtime.emitterCount == 0 && runtime.sinkCount == 0;
+    if (fixed || runtime.numParticles < header->count) {
+        config.numParticles = header->count;
+    }
+    config.targetChunkCount = header->targetChunkCount;
+
+    initDomain(domain, config);
+
+    // The arrays were laid out for exactly this, drop the fresh ones and use the file
+    const size_t count = header->count;
+    const uint64_t step = header->step;
+    const uint64_t rngState = header->rngState;
+    const float chunkSize = header->chunkSize;
+    const uint32_t nextId = header->nextId;
+    float owed[MAX_EMITTERS];
+    memcpy(owed, header->owed, sizeof(owed));
+    uint64_t offsets[CHECKPOINT_ARRAYS];
+    memcpy(offsets, header->offsets, sizeof(offsets));
+
+    ParticleStore loaded;
+    mapParticleStore(&loaded, count, mapping, info.st_size, offsets);
+
+    // Room to grow needs arrays of the capacity, so those are copied instead
+    if (fixed) {
+        freeParticleStore(&domain->particles);
+        domain->particles = loaded;
+    } else {
+        copyParticleStore(&loaded, &domain->particles);
+        domain->particles.count = count;
+        freeParticleStore(&loaded);
+    }
+
+    memcpy(domain->population.owed, owed, sizeof(owed));
+    if (nextId > domain->population.nextId) {
+        domain->population.nextId = nextId;
+    }
+
+    domain->rng.state = rngState;
+
+    // Continue on the grid the run had retuned to
+    if (config.chunkSizing == CHUNK_SIZING_AUTO && chunkSize > 0 && chunkSize != domain->chunkSize) {
+        resizeChunks(domain, chunkSize);
+    }
+    domain->metrics.steps = step;
+    domain->metricsLog.last.steps = step;
+}
+
+struct CheckpointWriter {
+    pthread_t thread;
+    bool started;
+    atomic_bool busy;
+
+    CheckpointState state;
+    ParticleStore particles;
+    size_t capacity;
+    char *path;
+};
+
+static void *writerMain(void *argument) {
+    CheckpointWriter *writer = (CheckpointWriter*)argument;
+
+    writeState(&writer->state, writer->path);
+    atomic_store_explicit(&writer->busy, false, memory_order_release);
+
+    return NULL;
+}
+
+CheckpointWriter *createCheckpointWriter(size_t count) {
+    CheckpointWriter *writer = (CheckpointWriter*)malloc(sizeof(CheckpointWriter));
+    if (writer == NULL) {
+        fprintf(stderr, "Memory allocation failed for checkpoint writer\n");
+        exit(1);
+    }
+
+    writer->started = false;
+    atomic_init(&writer->busy, false);
+    writer->path = NULL;
+
+    initParticleStore(&writer->particles, count);
+    writer->capacity = count;
+
+    return writer;
+}
+
+static void joinWriter(CheckpointWriter *writer) {
+    if (!writer->started) return;
+
+    pthread_join(writer->thread, NULL);
+    writer->started = false;
+}
+
+void destroyCheckpointWriter(CheckpointWriter *writer) {
+    joinWriter(writer);
+
+    freeParticleStore(&writer->particles);
+    free(writer->path);
+    free(writer);
+}
+
+bool requestCheckpoint(CheckpointWriter *writer, const Domain *domain, const char *path) {
+    if (atomic_load_explicit(&writer->busy, memory_order_acquire)) return false;
+
+    joinWriter(writer);
+
+    if (domain->particles.count > writer->capacity) {
+        fprintf(stderr, "Checkpoint writer holds %zu particles, the domain %zu\n", writer->capacity, domain->particles.count);
+        exit(1);
+    }
+
+    // The copy is all the step loop pays for
+    copyParticleStore(&domain->particles, &writer->particles);
+    writer->particles.count = domain->particles.count;
+
+    writer->state = captureState(domain, &writer->particles);
+
+    free(writer->path);
+    writer->path = strdup(path);
+    if (writer->path == NULL) {
+        fprintf(stderr, "Memory allocation failed for checkpoint path\n");
+        exit(1);
+    }
+
+    atomic_store_explicit(&writer->busy, true, memory_order_relaxed);
+
+    if (pthread_create(&writer->thread, NULL, writerMain, writer) != 0) {
+        fprintf(stderr, "Failed to start checkpoint writer\n");
+        exit(1);
+    }
+
+    writer->started = true;
+
+    return true;
+}
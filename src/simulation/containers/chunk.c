@@ -5,19 +5,96 @@
  */
 
 
-void initChunks(Domain *domain) {
-    Config config = domain->config;
+// Cost of visiting one occupied chunk and its half stencil, in pair tests. Measured with
+// the vector kernels, where a test is a fraction of a nanosecond
+#define CHUNK_VISIT_COST 1000.0
+
+// Retunes smaller than this relative change are not worth a new grid
+#define CHUNK_RETUNE_HYSTERESIS 0.1
 
-    // Compute chunks
-    const int targetChunkCount = config.targetChunkCount;
+float contactReach(const Domain *domain) {
+    const ParticleStore *particles = &domain->particles;
 
-    float totalVolume = config.dim[0] * config.dim[1] * config.dim[2];
+    // Radii are only set once particles are spawned or loaded, until then mass is the radius
+    float maxRadius = domain->config.mass;
 
-    // Calculate the ideal volume of each chunk
-    float idealChunkVolume = totalVolume / targetChunkCount;
+    if (domain->chunks != NULL) {
+        for (size_t i = 0; i < particles->count; ++i) {
+            maxRadius = fmaxf(maxRadius, particles->radius[i]);
+        }
+    }
 
-    // Calculate the chunk size based on the ideal volume
-    domain->chunkSize = cbrt(idealChunkVolume);
+    return 2.0f * maxRadius + domain->config.neighbourSkin;
+}
+
+// Spreads the low 21 bits of value to every third bit
+static uint64_t spreadBits(uint64_t value) {
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffull;
+    value = (value | value << 16) & 0x1f0000ff0000ffull;
+    value = (value | value << 8) & 0x100f00f00f00f00full;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+    value = (value | value << 2) & 0x1249249249249249ull;
+
+    return value;
+}
+
+static uint64_t mortonCode(int x, int y, int z) {
+    return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
+
+typedef struct {
+    uint64_t code;
+    int chunk;
+} MortonEntry;
+
+static int compareMorton(const void *a, const void *b) {
+    const uint64_t codeA = ((const MortonEntry*)a)->code;
+    const uint64_t codeB = ((const MortonEntry*)b)->code;
+
+    return (codeA > codeB) - (codeA < codeB);
+}
+
+static void buildChunkOrder(Domain *domain) {
+    const size_t interior = (size_t)domain->chunkCounts[0] * domain->chunkCounts[1] * domain->chunkCounts[2];
+
+    domain->chunkOrder = (int*)malloc(interior * sizeof(int));
+    MortonEntry *entries = (MortonEntry*)malloc(interior * sizeof(MortonEntry));
+    if (domain->chunkOrder == NULL || entries == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk order\n");
+        exit(1);
+    }
+
+    size_t c = 0;
+    for (int x = 0; x < domain->chunkCounts[0]; ++x) {
+        for (int y = 0; y < domain->chunkCounts[1]; ++y) {
+            for (int z = 0; z < domain->chunkCounts[2]; ++z) {
+                entries[c].code = domain->config.chunkOrder == CHUNK_ORDER_MORTON ? mortonCode(x, y, z) : c;
+                entries[c].chunk = chunkIndex(domain, x, y, z);
+                c++;
+            }
+        }
+    }
+
+    // Rows are already in order
+    if (domain->config.chunkOrder == CHUNK_ORDER_MORTON) {
+        qsort(entries, interior, sizeof(MortonEntry), compareMorton);
+    }
+
+    for (c = 0; c < interior; ++c) {
+        domain->chunkOrder[c] = entries[c].chunk;
+    }
+
+    domain->chunkOrderCount = interior;
+
+    free(entries);
+}
+
+static void allocateChunkGrid(Domain *domain, float chunkSize) {
+    const Config config = domain->config;
+
+    domain->chunkSize = chunkSize;
+    domain->metrics.chunkSize = chunkSize;
 
     // How many chunks do we need in each dimension?
     int chunksX = ceil(config.dim[0] / domain->chunkSize);
@@ -34,82 +111,258 @@ void initChunks(Domain *domain) {
 
     printf("Chunks: %d %d %d\n", chunksX, chunksY, chunksZ);
 
-    // Allocate memory for the chunks
-    domain->chunks = (Chunk***)malloc(chunksX * sizeof(Chunk**));
+    // Sparse chunks only come into being with their particles
+    if (config.chunkGrid == CHUNK_GRID_SPARSE) {
+        if (domain->sparse == NULL) {
+            domain->sparse = createSparseGrid();
+        }
+
+        clearSparseGrid(domain->sparse, domain->chunkCounts, config.gridLevels);
+        orderSparseGrid(domain->sparse, config.chunkOrder == CHUNK_ORDER_MORTON);
+
+        domain->chunks = domain->sparse->chunks;
+        domain->chunkOrder = domain->sparse->order;
+        domain->chunkOrderCount = 0;
+        return;
+    }
+
+    // Allocate memory for the chunks, with one layer of ghosts around them
+    const size_t totalChunks = (size_t)(chunksX + 2) * (chunksY + 2) * (chunksZ + 2);
+
+    // Zeroed chunks are empty ones, and calloc leaves the pages to whoever writes them first
+    domain->chunks = (Chunk*)calloc(totalChunks, sizeof(Chunk));
     if (domain->chunks == NULL) {
         fprintf(stderr, "Memory allocation failed for chunks\n");
         exit(1);
     }
-    for (int i = 0; i < chunksX; ++i) {
-        domain->chunks[i] = (Chunk**)malloc(chunksY * sizeof(Chunk*));
-        if (domain->chunks[i] == NULL) {
-            fprintf(stderr, "Memory allocation failed for chunks[%d]\n", i);
-            exit(1);
-        }
-        for (int j = 0; j < chunksY; ++j) {
-            domain->chunks[i][j] = (Chunk*)malloc(chunksZ * sizeof(Chunk));
-            if (domain->chunks[i][j] == NULL) {
-                fprintf(stderr, "Memory allocation failed for chunks[%d][%d]\n", i, j);
-                exit(1);
-            }
-            for (int k = 0; k < chunksZ; ++k) {
-                domain->chunks[i][j][k].numParticles = 0;
-                domain->chunks[i][j][k].size = defaultChunkStorage;
-                domain->chunks[i][j][k].particles = (Particle**)malloc(defaultChunkStorage * sizeof(Particle*));
-                if (domain->chunks[i][j][k].particles == NULL) {
-                    fprintf(stderr, "Memory allocation failed for chunks[%d][%d][%d].particles\n", i, j, k);
-                    exit(1);
-                }
-                for (int l = 0; l < 26; ++l) {
-                    domain->chunks[i][j][k].adj[l] = NULL;
+
+    if (config.chunkBuilder == CHUNK_BUILDER_LISTS) {
+        for (int i = 0; i < chunksX; ++i) {
+            for (int j = 0; j < chunksY; ++j) {
+                for (int k = 0; k < chunksZ; ++k) {
+                    Chunk *chunk = &domain->chunks[chunkIndex(domain, i, j, k)];
+
+                    chunk->size = defaultChunkStorage;
+                    chunk->particles = (int*)malloc(defaultChunkStorage * sizeof(int));
+                    if (chunk->particles == NULL) {
+                        fprintf(stderr, "Memory allocation failed for chunks[%d][%d][%d].particles\n", i, j, k);
+                        exit(1);
+                    }
                 }
             }
         }
     }
 
-    // Configure adjacency
-    for (int i = 0; i < chunksX; ++i) {
-        for (int j = 0; j < chunksY; ++j) {
-            for (int k = 0; k < chunksZ; ++k) {
-                Chunk *chunk = &domain->chunks[i][j][k];
-
-                // Iterate over neighboring indices
-                for (int ni = -1; ni <= 1; ++ni) {
-                    for (int nj = -1; nj <= 1; ++nj) {
-                        for (int nk = -1; nk <= 1; ++nk) {
-                            // Skip the current chunk itself
-                            if (ni == 0 && nj == 0 && nk == 0)
-                                continue;
-
-                            // Calculate neighbor indices
-                            int ni_index = i + ni;
-                            int nj_index = j + nj;
-                            int nk_index = k + nk;
-
-                            // Check if neighbor indices are within bounds
-                            if (ni_index >= 0 && ni_index < chunksX &&
-                                nj_index >= 0 && nj_index < chunksY &&
-                                nk_index >= 0 && nk_index < chunksZ) {
-                                // Access neighbor chunk
-                                Chunk *neighbor = &domain->chunks[ni_index][nj_index][nk_index];
-
-                                // Add neighbor to adjacency list
-                                chunk->adj[3 * (ni + 1) + (nj + 1) * 3 + (nk + 1)] = neighbor;
-                            }
-                        }
-                    }
-                }
+    // Configure adjacency, the same offsets hold for every chunk of the interior
+    const int strideY = chunksZ + 2;
+    const int strideX = (chunksY + 2) * strideY;
+
+    int slot = 0;
+    for (int ni = -1; ni <= 1; ++ni) {
+        for (int nj = -1; nj <= 1; ++nj) {
+            for (int nk = -1; nk <= 1; ++nk) {
+                // Skip the current chunk itself
+                if (ni == 0 && nj == 0 && nk == 0)
+                    continue;
+
+                domain->chunkOffsets[slot++] = ni * strideX + nj * strideY + nk;
             }
         }
     }
+
+    buildChunkOrder(domain);
+}
+
+static size_t totalChunks(const Domain *domain) {
+    return (size_t)(domain->chunkCounts[0] + 2) * (domain->chunkCounts[1] + 2) * (domain->chunkCounts[2] + 2);
+}
+
+static void freeChunkGrid(Domain *domain) {
+    // The sparse grid keeps its memory for the next one
+    if (domain->sparse != NULL) {
+        clearSparseGrid(domain->sparse, domain->chunkCounts, domain->config.gridLevels);
+        domain->chunkOrderCount = 0;
+        return;
+    }
+
+    const size_t chunks = totalChunks(domain);
+
+    for (size_t c = 0; c < chunks; ++c) {
+        free(domain->chunks[c].particles);
+    }
+
+    free(domain->chunks);
+    free(domain->chunkOrder);
+    domain->chunks = NULL;
+    domain->chunkOrder = NULL;
+}
+
+size_t chunkGridBytes(const Domain *domain) {
+    if (domain->sparse != NULL) {
+        return sparseGridBytes(domain->sparse);
+    }
+
+    return totalChunks(domain) * sizeof(Chunk) + domain->chunkOrderCount * sizeof(int);
+}
+
+void resizeChunks(Domain *domain, float chunkSize) {
+    freeChunkGrid(domain);
+    allocateChunkGrid(domain, chunkSize);
+
+    domain->membershipValid = false;
 }
 
-void resizeParticleChunk(Chunk *chunk) {
+void initChunks(Domain *domain) {
+    Config config = domain->config;
+
+    domain->chunks = NULL;
+    domain->sparse = NULL;
+    domain->chunkTuner.rebuilds = 0;
+    domain->chunkTuner.steps = 0;
+    domain->reorder.rebuilds = 0;
+    domain->reorder.locality = 0.0;
+    domain->membershipValid = false;
+    domain->chunkSlots = NULL;
+    domain->particleChunks = NULL;
+    domain->sortDestination = NULL;
+    domain->sortBuffer = (ParticleStore){0};
+    domain->chunkTuner.pairTests = 0;
+    domain->chunkTuner.pairHits = 0;
+
+    const float reach = contactReach(domain);
+    float chunkSize;
+
+    if (config.chunkSizing == CHUNK_SIZING_AUTO) {
+        chunkSize = reach;
+    } else {
+        // Compute chunks
+        const int targetChunkCount = config.targetChunkCount;
+
+        float totalVolume = config.dim[0] * config.dim[1] * config.dim[2];
+
+        // Calculate the ideal volume of each chunk
+        float idealChunkVolume = totalVolume / targetChunkCount;
+
+        // Calculate the chunk size based on the ideal volume
+        chunkSize = cbrt(idealChunkVolume);
+
+        if (chunkSize < reach) {
+            fprintf(stderr, "Warning: chunk size %f is below the contact reach %f, contacts between chunks further apart are missed\n", chunkSize, reach);
+        }
+    }
+
+    // The top level takes the edge of a single grid, every level below halves it
+    if (config.gridLevels > 1) {
+        chunkSize = ldexpf(chunkSize, 1 - config.gridLevels);
+    }
+
+    allocateChunkGrid(domain, chunkSize);
+
+    const bool reorders = config.reorderInterval > 0 || config.reorderLocality > 0;
+
+    const bool incremental = config.chunkBuilder == CHUNK_BUILDER_LISTS && config.incrementalChunks;
+
+    if (incremental) {
+        domain->chunkSlots = (int*)malloc(config.numParticles * sizeof(int));
+        domain->particleChunks = (Chunk**)malloc(config.numParticles * sizeof(Chunk*));
+        if (domain->chunkSlots == NULL || domain->particleChunks == NULL) {
+            fprintf(stderr, "Memory allocation failed for chunk membership\n");
+            exit(1);
+        }
+    }
+
+    if (config.chunkBuilder == CHUNK_BUILDER_SORTED || reorders) {
+        if (config.numaFirstTouch) {
+            reserveParticleStore(&domain->sortBuffer, config.numParticles, config.hugePages);
+        } else {
+            initParticleStore(&domain->sortBuffer, config.numParticles);
+        }
+
+        if (!incremental) {
+            domain->particleChunks = (Chunk**)malloc(config.numParticles * sizeof(Chunk*));
+        }
+
+        domain->sortDestination = (int*)malloc(config.numParticles * sizeof(int));
+        if (domain->particleChunks == NULL || domain->sortDestination == NULL) {
+            fprintf(stderr, "Memory allocation failed for chunk sort buffers\n");
+            exit(1);
+        }
+    }
+}
+
+void freeChunks(Domain *domain) {
+    if (domain->sparse != NULL) {
+        destroySparseGrid(domain->sparse);
+        domain->sparse = NULL;
+        domain->chunks = NULL;
+        domain->chunkOrder = NULL;
+    } else {
+        freeChunkGrid(domain);
+    }
+
+    freeParticleStore(&domain->sortBuffer);
+    free(domain->particleChunks);
+    free(domain->sortDestination);
+    free(domain->chunkSlots);
+}
+
+/**
+ * Picks the edge that balances pair tests against chunk visits. Hits are set
+ * by the physics, the tests per hit grow with the chunk volume and occupied
+ * chunks shrink with it, so from edge s the cost of edge s' is
+ * hits * ratio * (s' / s)^3 + visits * (s / s')^3, lowest where both terms
+ * are equal. Never goes below the contact reach.
+ */
+static void retuneChunks(Domain *domain) {
+    ChunkTuner *tuner = &domain->chunkTuner;
+    Metrics *metrics = &domain->metrics;
+
+    // resetMetrics moves the counters back under us
+    if (metrics->steps < tuner->steps || metrics->pairTests < tuner->pairTests || metrics->pairHits < tuner->pairHits) {
+        tuner->steps = metrics->steps;
+        tuner->pairTests = metrics->pairTests;
+        tuner->pairHits = metrics->pairHits;
+    }
+
+    if (++tuner->rebuilds % domain->config.chunkRetuneInterval != 0) return;
+
+    const double steps = metrics->steps - tuner->steps;
+    const double tests = metrics->pairTests - tuner->pairTests;
+    const double hits = metrics->pairHits - tuner->pairHits;
+
+    tuner->steps = metrics->steps;
+    tuner->pairTests = metrics->pairTests;
+    tuner->pairHits = metrics->pairHits;
+
+    if (steps <= 0.0 || hits <= 0.0) return;
+
+    measureOccupancy(domain);
+    if (metrics->meanOccupancy <= 0.0) return;
+
+    const double ratio = tests / hits;
+    const double visits = CHUNK_VISIT_COST * steps * domain->particles.count / metrics->meanOccupancy;
+
+    const float reach = contactReach(domain);
+    float chunkSize = domain->chunkSize * pow(visits / (hits * ratio), 1.0 / 6.0);
+
+    // Halve or double at most per retune, the estimate assumes a uniform density
+    chunkSize = fminf(fmaxf(chunkSize, 0.5f * domain->chunkSize), 2.0f * domain->chunkSize);
+    chunkSize = fmaxf(chunkSize, reach);
+
+    if (fabsf(chunkSize - domain->chunkSize) < CHUNK_RETUNE_HYSTERESIS * domain->chunkSize) return;
+
+    resizeChunks(domain, chunkSize);
+
+    metrics->chunkRetunes++;
+}
+
+// Returns true if the index array had to grow
+bool resizeParticleChunk(Chunk *chunk) {
     if (chunk->numParticles >= chunk->size) {
-        Particle **newParticles = NULL;
+        int *newParticles = NULL;
         int newSize = chunk->size * 2;
 
-        newParticles = (Particle**)realloc(chunk->particles, newSize * sizeof(Particle*));
+        newParticles = (int*)realloc(chunk->particles, newSize * sizeof(int));
 
         if (newParticles == NULL) {
             fprintf(stderr, "Memory allocation failed for chunk resize %d\n", newSize);
@@ -118,60 +371,434 @@ void resizeParticleChunk(Chunk *chunk) {
 
         chunk->particles = newParticles;
         chunk->size = newSize;
+
+        return true;
     }
+
+    return false;
 }
 
 
-void updateChunks(Domain* domain) {
+// Chunk coordinates of particle i, exits if the particle left the domain
+static void chunkCoordinates(const Domain *domain, int i, int coordinates[3]) {
     const int DIM_X = domain->config.dim[0];
     const int DIM_Y = domain->config.dim[1];
     const int DIM_Z = domain->config.dim[2];
 
     const float chunkSize = domain->chunkSize;
 
-    // TODO: Optimize this
+    const float x = domain->particles.x[i];
+    const float y = domain->particles.y[i];
+    const float z = domain->particles.z[i];
 
-    // Clear all chunks
-    for (int i = 0; i < domain->chunkCounts[0]; ++i) {
-        for (int j = 0; j < domain->chunkCounts[1]; ++j) {
-            for (int k = 0; k < domain->chunkCounts[2]; ++k) {
-                domain->chunks[i][j][k].numParticles = 0;
+    // Check if particle positions are within domain boundaries
+    if (x < 0 || x >= DIM_X ||
+        y < 0 || y >= DIM_Y ||
+        z < 0 || z >= DIM_Z) {
+        fprintf(stderr, "Particle %d position out of bounds: (%f, %f, %f)\n", i, x, y, z);
+        exit(1);
+    }
+
+    const int chunkX = x / chunkSize;
+    const int chunkY = y / chunkSize;
+    const int chunkZ = z / chunkSize;
+
+    // Double-check that chunk indices are within bounds
+    if (chunkX < 0 || chunkX >= domain->chunkCounts[0] ||
+        chunkY < 0 || chunkY >= domain->chunkCounts[1] ||
+        chunkZ < 0 || chunkZ >= domain->chunkCounts[2]) {
+        fprintf(stderr, "Calculated chunk index out of bounds for particle %d: (%d, %d, %d)\n", i, chunkX, chunkY, chunkZ);
+        exit(1);
+    }
+
+    coordinates[0] = chunkX;
+    coordinates[1] = chunkY;
+    coordinates[2] = chunkZ;
+}
+
+// Chunk of particle i in the dense grid
+static Chunk *findChunk(Domain *domain, int i) {
+    int coordinates[3];
+    chunkCoordinates(domain, i, coordinates);
+
+    return &domain->chunks[chunkIndex(domain, coordinates[0], coordinates[1], coordinates[2])];
+}
+
+static void clearChunks(Domain *domain) {
+    const size_t chunks = totalChunks(domain);
+
+    for (size_t c = 0; c < chunks; ++c) {
+        domain->chunks[c].numParticles = 0;
+    }
+}
+
+// Finest level whose chunks still hold every contact of particle i
+static int particleLevel(const Domain *domain, int i) {
+    const float contact = 2.0f * domain->particles.radius[i];
+    float chunkSize = domain->chunkSize;
+    int level = 0;
+
+    while (level + 1 < domain->config.gridLevels && contact > chunkSize) {
+        chunkSize *= 2.0f;
+        level++;
+    }
+
+    return level;
+}
+
+// Histogram of the sparse grid, creates the chunks particles moved into
+static void binSparseChunks(Domain *domain) {
+    SparseGrid *grid = domain->sparse;
+    const int count = domain->particles.count;
+    int *destination = domain->sortDestination;
+
+    resetSparseGrid(grid);
+
+    // Sorted neighbours mostly share a chunk, so skip the lookup for them
+    int previous[4] = {-1, -1, -1, -1};
+    int chunk = 0;
+
+    for (int i = 0; i < count; ++i) {
+        int coordinates[3];
+        chunkCoordinates(domain, i, coordinates);
+
+        // Level 0 coordinates, the chunk of a coarser level contains 2^level of them per axis
+        const int level = particleLevel(domain, i);
+        const int key[4] = {level, coordinates[0] >> level, coordinates[1] >> level, coordinates[2] >> level};
+
+        if (memcmp(key, previous, sizeof(key)) != 0) {
+            chunk = sparseChunk(grid, key[0], key[1], key[2], key[3]);
+            memcpy(previous, key, sizeof(previous));
+        }
+
+        destination[i] = chunk;
+        grid->chunks[chunk].numParticles++;
+    }
+}
+
+// Calm steps follow their particles to destination
+static void scatterCalm(Domain *domain, const int *destination) {
+    if (domain->calmSteps == NULL) return;
+
+    for (int i = 0; i < domain->particles.count; ++i) {
+        domain->calmBuffer[destination[i]] = domain->calmSteps[i];
+    }
+
+    float *calm = domain->calmSteps;
+    domain->calmSteps = domain->calmBuffer;
+    domain->calmBuffer = calm;
+}
+
+/**
+ * sortByChunk for the sparse grid. Chunk indices go through sortDestination
+ * since new chunks can move the chunk array.
+ */
+static void sortBySparseChunk(Domain *domain) {
+    SparseGrid *grid = domain->sparse;
+    const int count = domain->particles.count;
+    int *destination = domain->sortDestination;
+
+    binSparseChunks(domain);
+
+    // Empty chunks are still visited, start over once they are the majority
+    size_t empty = 0;
+    for (size_t c = 1; c <= grid->count; ++c) {
+        empty += grid->chunks[c].numParticles == 0;
+    }
+
+    if (2 * empty > grid->count) {
+        clearSparseGrid(grid, domain->chunkCounts, domain->config.gridLevels);
+        binSparseChunks(domain);
+    }
+
+    orderSparseGrid(grid, domain->config.chunkOrder == CHUNK_ORDER_MORTON);
+
+    domain->chunks = grid->chunks;
+    domain->chunkOrder = grid->order;
+    domain->chunkOrderCount = grid->count;
+
+    // Prefix sum in store order, end doubles as the scatter cursor
+    int offset = 0;
+    for (size_t c = 0; c < grid->count; ++c) {
+        Chunk *target = &domain->chunks[domain->chunkOrder[c]];
+
+        target->begin = offset;
+        target->end = offset;
+        offset += target->numParticles;
+    }
+
+    // Scatter, stable within each chunk
+    for (int i = 0; i < count; ++i) {
+        destination[i] = domain->chunks[destination[i]].end++;
+    }
+
+    // The count changes under a decomposed run, which moves particles between ranks
+    domain->sortBuffer.count = count;
+    scatterParticles(&domain->particles, &domain->sortBuffer, destination);
+    swapParticleStores(&domain->particles, &domain->sortBuffer);
+    scatterCalm(domain, destination);
+}
+
+/**
+ * Counting sort of the store by chunk, with the ranges laid out in
+ * Domain.chunkOrder. Leaves begin and end of every chunk set to its range.
+ */
+static void sortByChunk(Domain *domain) {
+    const int count = domain->particles.count;
+
+    if (domain->sparse != NULL) {
+        sortBySparseChunk(domain);
+        return;
+    }
+
+    // Histogram
+    clearChunks(domain);
+
+    for (int i = 0; i < count; ++i) {
+        Chunk *chunk = findChunk(domain, i);
+
+        domain->particleChunks[i] = chunk;
+        chunk->numParticles++;
+    }
+
+    // Prefix sum in store order, end doubles as the scatter cursor. Ghosts stay empty ranges
+    int offset = 0;
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+        chunk->begin = offset;
+        chunk->end = offset;
+        offset += chunk->numParticles;
+    }
+
+    // Scatter, stable within each chunk
+    for (int i = 0; i < count; ++i) {
+        domain->sortDestination[i] = domain->particleChunks[i]->end++;
+    }
+
+    domain->sortBuffer.count = count;
+    scatterParticles(&domain->particles, &domain->sortBuffer, domain->sortDestination);
+    swapParticleStores(&domain->particles, &domain->sortBuffer);
+    scatterCalm(domain, domain->sortDestination);
+}
+
+/**
+ * Only awake chunks move their particles. As long as none of those left its
+ * chunk every range still holds, and a mostly sleeping domain skips the sort.
+ */
+static bool awakeChunksHold(Domain *domain) {
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        const int index = domain->chunkOrder[c];
+        const Chunk *chunk = &domain->chunks[index];
+
+        if (chunk->asleep) continue;
+
+        for (int i = chunk->begin; i < chunk->end; ++i) {
+            int coordinates[3];
+            chunkCoordinates(domain, i, coordinates);
+
+            if (domain->sparse != NULL) {
+                if (memcmp(coordinates, &domain->sparse->coordinates[3 * index], sizeof(coordinates)) != 0) return false;
+            } else if (chunkIndex(domain, coordinates[0], coordinates[1], coordinates[2]) != index) {
+                return false;
             }
         }
     }
 
-    // Update chunks
-    for (int i = 0; i < domain->config.numParticles; ++i) {
-        Particle *particle = &domain->particles[i];
+    return true;
+}
+
+// Sorting moves every particle, so it only pays once the order has decayed enough
+static bool reorderDue(Domain *domain) {
+    StoreReorder *reorder = &domain->reorder;
+    const Config *config = &domain->config;
 
-        // Check if particle positions are within domain boundaries
-        if (particle->pos.x < 0 || particle->pos.x >= DIM_X ||
-            particle->pos.y < 0 || particle->pos.y >= DIM_Y ||
-            particle->pos.z < 0 || particle->pos.z >= DIM_Z) {
-            fprintf(stderr, "Particle %d position out of bounds: (%f, %f, %f)\n", i, particle->pos.x, particle->pos.y, particle->pos.z);
-            exit(1);
+    reorder->rebuilds++;
+
+    if (config->reorderInterval > 0 && reorder->rebuilds >= (size_t)config->reorderInterval) return true;
+
+    return config->reorderLocality > 0 && domain->metrics.storeLocality < config->reorderLocality * reorder->locality;
+}
+
+// True if the chunks are the same or touch, both interior chunks of domain
+static bool chunksTouch(const Domain *domain, const Chunk *a, const Chunk *b) {
+    const int strideY = domain->chunkCounts[2] + 2;
+    const int strideX = (domain->chunkCounts[1] + 2) * strideY;
+
+    const int indexA = a - domain->chunks;
+    const int indexB = b - domain->chunks;
+
+    return abs(indexA / strideX - indexB / strideX) <= 1
+        && abs(indexA % strideX / strideY - indexB % strideX / strideY) <= 1
+        && abs(indexA % strideY - indexB % strideY) <= 1;
+}
+
+static void appendToChunk(Domain *domain, Chunk *chunk, int i) {
+    // Resize the chunk if necessary
+    if (resizeParticleChunk(chunk)) {
+        domain->metrics.chunkReallocs++;
+    }
+
+    chunk->particles[chunk->numParticles] = i;
+    chunk->numParticles++;
+}
+
+// Clears and refills every chunk, and records the membership for incremental updates
+static void rebuildChunksLists(Domain *domain) {
+    const bool incremental = domain->config.incrementalChunks;
+
+    // Clear all chunks
+    clearChunks(domain);
+
+    // Update chunks, counting consecutive particles in the same or touching chunks
+    Chunk *previous = NULL;
+    size_t local = 0;
+
+    for (int i = 0; i < domain->particles.count; ++i) {
+        Chunk *chunk = findChunk(domain, i);
+
+        local += previous != NULL && chunksTouch(domain, chunk, previous);
+        previous = chunk;
+
+        if (incremental) {
+            domain->particleChunks[i] = chunk;
+            domain->chunkSlots[i] = chunk->numParticles;
         }
 
-        const V3 temp = div3(&particle->pos, chunkSize);
+        appendToChunk(domain, chunk, i);
+    }
 
-        const int chunkX = temp.x;
-        const int chunkY = temp.y;
-        const int chunkZ = temp.z;
+    domain->metrics.storeLocality = domain->particles.count > 1 ? (double)local / (domain->particles.count - 1) : 1.0;
+    domain->membershipValid = incremental;
+}
 
-        // Double-check that chunk indices are within bounds
-        if (chunkX < 0 || chunkX >= domain->chunkCounts[0] ||
-            chunkY < 0 || chunkY >= domain->chunkCounts[1] ||
-            chunkZ < 0 || chunkZ >= domain->chunkCounts[2]) {
-            fprintf(stderr, "Calculated chunk index out of bounds for particle %d: (%d, %d, %d)\n", i, chunkX, chunkY, chunkZ);
-            exit(1);
+/**
+ * Moves only the particles whose chunk changed, out of the old list and into
+ * the new one at their place in store order, so every list stays as a rebuild
+ * would leave it and the pairs are visited in the same order. Still looks at
+ * every particle to find the movers, but writes nothing for the others and
+ * never touches the empty chunks.
+ */
+static void moveChunkMembers(Domain *domain) {
+    const bool measureLocality = domain->config.reorderLocality > 0;
+
+    Chunk **particleChunks = domain->particleChunks;
+    int *chunkSlots = domain->chunkSlots;
+
+    Chunk *previous = NULL;
+    size_t local = 0;
+    size_t movers = 0;
+
+    for (int i = 0; i < domain->particles.count; ++i) {
+        Chunk *chunk = findChunk(domain, i);
+        Chunk *old = particleChunks[i];
+
+        if (measureLocality) {
+            local += previous != NULL && chunksTouch(domain, chunk, previous);
+            previous = chunk;
         }
 
-        Chunk *chunk = &domain->chunks[chunkX][chunkY][chunkZ];
+        if (chunk == old) continue;
 
-        // Resize the chunk if necessary
-        resizeParticleChunk(chunk);
+        // The later entries of the old chunk close the gap
+        old->numParticles--;
+        for (int s = chunkSlots[i]; s < old->numParticles; ++s) {
+            const int later = old->particles[s + 1];
 
-        chunk->particles[chunk->numParticles] = particle;
-        chunk->numParticles++;
+            old->particles[s] = later;
+            chunkSlots[later] = s;
+        }
+
+        // And those of the new one make room
+        appendToChunk(domain, chunk, i);
+
+        int slot = chunk->numParticles - 1;
+        for (; slot > 0 && chunk->particles[slot - 1] > i; --slot) {
+            const int later = chunk->particles[slot - 1];
+
+            chunk->particles[slot] = later;
+            chunkSlots[later] = slot;
+        }
+
+        chunk->particles[slot] = i;
+        chunkSlots[i] = slot;
+        particleChunks[i] = chunk;
+
+        movers++;
+    }
+
+    domain->metrics.chunkMovers += movers;
+
+    if (measureLocality) {
+        domain->metrics.storeLocality = domain->particles.count > 1 ? (double)local / (domain->particles.count - 1) : 1.0;
+    }
+}
+
+static void updateChunksLists(Domain *domain) {
+    const bool sorted = (domain->config.reorderInterval > 0 || domain->config.reorderLocality > 0) && reorderDue(domain);
+
+    if (sorted) {
+        sortByChunk(domain);
+
+        domain->reorder.rebuilds = 0;
+        domain->membershipValid = false;
+        domain->metrics.reorders++;
+    }
+
+    if (domain->membershipValid) {
+        moveChunkMembers(domain);
+    } else {
+        rebuildChunksLists(domain);
+    }
+
+    if (sorted || domain->reorder.locality == 0.0) {
+        domain->reorder.locality = domain->metrics.storeLocality;
+    }
+}
+
+void updateChunks(Domain* domain) {
+    const float skin = domain->config.neighbourSkin;
+    const double start = beginPhase(&domain->metrics);
+
+    // The neighbour lists index the store, so the order stays put until they expire
+    if (skin > 0) {
+        domain->neighbours.checks++;
+
+        if (!neighbourListExpired(&domain->neighbours, &domain->particles, skin)) {
+            endPhase(&domain->metrics, METRIC_PHASE_CHUNKS, start);
+            return;
+        }
+    }
+
+    // Only between rebuilds, nothing may point into the old grid
+    if (domain->config.chunkSizing == CHUNK_SIZING_AUTO && domain->config.chunkRetuneInterval > 0) {
+        retuneChunks(domain);
+    }
+
+    switch (domain->config.chunkBuilder) {
+        case CHUNK_BUILDER_LISTS:
+            updateChunksLists(domain);
+            break;
+        case CHUNK_BUILDER_SORTED:
+            if (domain->calmSteps != NULL && domain->membershipValid && awakeChunksHold(domain)) {
+                endPhase(&domain->metrics, METRIC_PHASE_CHUNKS, start);
+                return;
+            }
+
+            sortByChunk(domain);
+            domain->membershipValid = domain->calmSteps != NULL;
+            break;
+    }
+
+    if (skin > 0) {
+        buildNeighbourList(&domain->neighbours, domain);
     }
+
+    domain->metrics.chunkRebuilds++;
+
+    if (domain->metrics.timed) {
+        measureOccupancy(domain);
+    }
+
+    endPhase(&domain->metrics, METRIC_PHASE_CHUNKS, start);
 }
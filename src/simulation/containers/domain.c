@@ -4,12 +4,227 @@
  * Copyright (c) Alexander Kurtz 2024
  */
 
+void splitFrames(Config *config, int substeps) {
+    const float scale = (float)config->supsampling / substeps;
+
+    config->supsampling = substeps;
+    config->__internalSpeedFactor *= scale;
+    config->repulsion *= scale * scale;
+    config->selfGravity *= scale * scale;
+    config->gravity = mul3(&config->gravity, scale * scale);
+
+    for (int e = 0; e < config->emitterCount; ++e) {
+        config->emitters[e].velocity = mul3(&config->emitters[e].velocity, scale);
+    }
+}
+
 void initDomain(Domain* domain, Config config) {
     config.__internalSpeedFactor = (float) config.speed * ((float) config.fps) / ((float) config.supsampling);
+
+    // Scale the per step forces to the timestep
+    config.repulsion *= config.__internalSpeedFactor;
+    config.selfGravity *= config.__internalSpeedFactor;
+    config.gravity = mul3(&config.gravity, config.__internalSpeedFactor);
+
+    // Velocities are moves per substep
+    for (int e = 0; e < config.emitterCount; ++e) {
+        config.emitters[e].velocity = mul3(&config.emitters[e].velocity, config.__internalSpeedFactor);
+    }
+
+    if (config.adaptiveSubsteps) {
+        if (config.minSubsteps < 1 || config.maxSubsteps < config.minSubsteps || config.maxStepTravel <= 0 || config.maxStepOverlap < 0) {
+            fprintf(stderr, "Adaptive substeps need 1 <= min <= max substeps, a positive travel limit and no negative overlap limit\n");
+            exit(1);
+        }
+
+        // The physics stay those of the fixed count, split as finely as the bounds allow
+        int substeps = config.supsampling < config.minSubsteps ? config.minSubsteps : config.supsampling;
+        substeps = substeps > config.maxSubsteps ? config.maxSubsteps : substeps;
+
+        splitFrames(&config, substeps);
+    }
+
+    if (config.stencil == PAIR_STENCIL_HALF && config.chunkBuilder != CHUNK_BUILDER_SORTED) {
+        fprintf(stderr, "The half pair stencil needs the sorted chunk builder\n");
+        exit(1);
+    }
+
+    if (config.chunkGrid == CHUNK_GRID_SPARSE && config.chunkBuilder != CHUNK_BUILDER_SORTED) {
+        fprintf(stderr, "The sparse chunk grid needs the sorted chunk builder\n");
+        exit(1);
+    }
+
+    // Pairs across levels are scattered from the finer particle, which only the serial half stencil does
+    if (config.gridLevels > 1 && (config.chunkGrid != CHUNK_GRID_SPARSE || config.stencil != PAIR_STENCIL_HALF
+        || config.threads > 1 || config.neighbourSkin > 0 || config.chunkRetuneInterval > 0)) {
+        fprintf(stderr, "Grid levels need the sparse chunk grid, the half pair stencil, one thread, no neighbour lists and no chunk retunes\n");
+        exit(1);
+    }
+
+    // Sleeping chunks skip their pairs, which only the serial half stencil over single chunks can do
+    if (config.sleepSteps > 0 && (config.chunkBuilder != CHUNK_BUILDER_SORTED || config.stencil != PAIR_STENCIL_HALF
+        || config.gridLevels > 1 || config.threads > 1 || config.neighbourSkin > 0)) {
+        fprintf(stderr, "Sleeping needs the sorted chunk builder, the half pair stencil, one grid level, one thread and no neighbour lists\n");
+        exit(1);
+    }
+
+    if (config.sleepSteps > 0 && config.sleepTravel <= 0) {
+        fprintf(stderr, "Sleeping needs a positive travel\n");
+        exit(1);
+    }
+
+    if (config.selfGravity < 0 || config.openingAngle < 0 || config.openingAngle > 1 || config.softening < 0) {
+        fprintf(stderr, "Self gravity needs no negative strength or softening and an opening angle within [0, 1]\n");
+        exit(1);
+    }
+
+    if (config.emitterCount < 0 || config.emitterCount > MAX_EMITTERS || config.sinkCount < 0 || config.sinkCount > MAX_SINKS) {
+        fprintf(stderr, "At most %d emitters and %d sinks\n", MAX_EMITTERS, MAX_SINKS);
+        exit(1);
+    }
+
+    for (int e = 0; e < config.emitterCount; ++e) {
+        if (config.emitters[e].rate < 0) {
+            fprintf(stderr, "Emitter %d has a negative rate\n", e);
+            exit(1);
+        }
+    }
+
+    if (config.hugePages && !config.numaFirstTouch) {
+        fprintf(stderr, "Huge pages need NUMA first touch, which reserves the particle arrays\n");
+        exit(1);
+    }
+
+    if (config.affinity < AFFINITY_NONE || config.affinity > AFFINITY_SPREAD) {
+        fprintf(stderr, "Unknown thread affinity %d\n", config.affinity);
+        exit(1);
+    }
+
+    if (config.neighbourSkin > 0 && config.chunkBuilder != CHUNK_BUILDER_SORTED) {
+        fprintf(stderr, "Neighbour lists need the sorted chunk builder\n");
+        exit(1);
+    }
+
+    // Only keep instructions the CPU actually has
+    config.kernel = resolvePairKernel(config.kernel);
+
     domain->config = config;
+    domain->contactBlock = getContactBlockKernel(config.kernel);
+    seedRng(&domain->rng, 0);
 
     // Allocate memory for the particles
-    domain->particles = (Particle*)malloc(config.numParticles * sizeof(Particle));
+    // First touch leaves the pages to the workers, see placeDomain
+    if (config.numaFirstTouch) {
+        reserveParticleStore(&domain->particles, config.numParticles, config.hugePages);
+    } else {
+        initParticleStore(&domain->particles, config.numParticles);
+    }
+    initPopulation(&domain->population, config.numParticles);
 
+    domain->pool = NULL;
+    domain->dvx = NULL;
+    domain->dvy = NULL;
+    domain->dvz = NULL;
+    domain->contactCounts = NULL;
+
+    if (config.threads > 1) {
+        domain->pool = createThreadPool(config.threads);
+    }
+
+    const int workers = config.threads > 1 ? config.threads : 1;
+    domain->workerTravel = (float*)calloc(workers, sizeof(float));
+    domain->workerOverlap = (float*)calloc(workers, sizeof(float));
+    if (domain->workerTravel == NULL || domain->workerOverlap == NULL) {
+        fprintf(stderr, "Memory allocation failed for the step limits of %d workers\n", workers);
+        exit(1);
+    }
+
+    initPairTasks(&domain->pairTasks, workers);
+
+    // Half lists are scattered into, which only the sequential law may do, see initSimultaneousContacts
+    if (config.neighbourSkin > 0) {
+        initNeighbourList(&domain->neighbours, config.numParticles, config.stencil == PAIR_STENCIL_HALF);
+    }
+
+    if (config.selfGravity > 0) {
+        initOctree(&domain->gravityTree, config.numParticles);
+    }
+
+    domain->calmSteps = NULL;
+    domain->calmBuffer = NULL;
+    domain->awakeRanges = NULL;
+    domain->awakeRangeCount = 0;
+
+    // Every particle starts awake
+    if (config.sleepSteps > 0) {
+        domain->calmSteps = (float*)calloc(config.numParticles, sizeof(float));
+        domain->calmBuffer = (float*)malloc(config.numParticles * sizeof(float));
+        domain->awakeRanges = (int*)malloc(2 * config.numParticles * sizeof(int));
+        if (domain->calmSteps == NULL || domain->calmBuffer == NULL || domain->awakeRanges == NULL) {
+            fprintf(stderr, "Memory allocation failed for calm steps\n");
+            exit(1);
+        }
+    }
+
+    initMetrics(domain);
     initChunks(domain);
+    placeDomain(domain);
+}
+
+void freeDomain(Domain *domain) {
+    // Workers first, they may still be parked on the domain
+    if (domain->pool != NULL) {
+        destroyThreadPool(domain->pool);
+        domain->pool = NULL;
+    }
+
+    closeMetricsLog(domain);
+
+    freeChunks(domain);
+    freeParticleStore(&domain->particles);
+    freePopulation(&domain->population);
+    freePairTasks(&domain->pairTasks);
+    freeNumaTopology(&domain->numa);
+
+    if (domain->config.neighbourSkin > 0) {
+        freeNeighbourList(&domain->neighbours);
+    }
+
+    if (domain->config.selfGravity > 0) {
+        freeOctree(&domain->gravityTree);
+    }
+
+    free(domain->calmSteps);
+    free(domain->calmBuffer);
+    free(domain->awakeRanges);
+
+    free(domain->dvx);
+    free(domain->dvy);
+    free(domain->dvz);
+    free(domain->contactCounts);
+
+    free(domain->workerNodes);
+    free(domain->workerTravel);
+    free(domain->workerOverlap);
+}
+
+void initSimultaneousContacts(Domain *domain) {
+    const size_t capacity = domain->config.numParticles;
+
+    if (domain->dvx == NULL) {
+        domain->dvx = (float*)malloc(capacity * sizeof(float));
+        domain->dvy = (float*)malloc(capacity * sizeof(float));
+        domain->dvz = (float*)malloc(capacity * sizeof(float));
+        domain->contactCounts = (uint16_t*)malloc(capacity * sizeof(uint16_t));
+        if (domain->dvx == NULL || domain->dvy == NULL || domain->dvz == NULL || domain->contactCounts == NULL) {
+            fprintf(stderr, "Memory allocation failed for velocity accumulators\n");
+            exit(1);
+        }
+    }
+
+    // Every particle gathers from all of its partners
+    if (domain->config.neighbourSkin > 0 && domain->neighbours.half) {
+        domain->neighbours.half = false;
+        domain->neighbours.valid = false;
+    }
 }
@@ -0,0 +1,120 @@
+#include "simulation/containers/neighbourList.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+
+void initNeighbourList(NeighbourList *list, size_t count, bool half) {
+    list->half = half;
+    list->valid = false;
+
+    // Start with room for a dozen partners per particle
+    list->capacity = count * 12 + 1;
+
+    list->start = (int*)malloc((count + 1) * sizeof(int));
+    list->entries = (int*)malloc(list->capacity * sizeof(int));
+    list->buildX = (float*)malloc(count * sizeof(float));
+    list->buildY = (float*)malloc(count * sizeof(float));
+    list->buildZ = (float*)malloc(count * sizeof(float));
+    if (list->start == NULL || list->entries == NULL ||
+        list->buildX == NULL || list->buildY == NULL || list->buildZ == NULL) {
+        fprintf(stderr, "Memory allocation failed for neighbour lists\n");
+        exit(1);
+    }
+
+    list->builds = 0;
+    list->checks = 0;
+}
+
+void freeNeighbourList(NeighbourList *list) {
+    free(list->start);
+    free(list->entries);
+    free(list->buildX);
+    free(list->buildY);
+    free(list->buildZ);
+}
+
+bool neighbourListExpired(const NeighbourList *list, const ParticleStore *particles, float skin) {
+    if (!list->valid) return true;
+
+    const float limitSq = 0.25f * skin * skin;
+
+    for (size_t i = 0; i < particles->count; ++i) {
+        const float dx = particles->x[i] - list->buildX[i];
+        const float dy = particles->y[i] - list->buildY[i];
+        const float dz = particles->z[i] - list->buildZ[i];
+
+        if (dx * dx + dy * dy + dz * dz > limitSq) return true;
+    }
+
+    return false;
+}
+
+static void appendNeighbour(NeighbourList *list, size_t *size, int particle) {
+    if (*size >= list->capacity) {
+        size_t newCapacity = list->capacity * 2;
+
+        int *newEntries = (int*)realloc(list->entries, newCapacity * sizeof(int));
+        if (newEntries == NULL) {
+            fprintf(stderr, "Memory allocation failed for neighbour list resize %zu\n", newCapacity);
+            exit(1);
+        }
+
+        list->entries = newEntries;
+        list->capacity = newCapacity;
+    }
+
+    list->entries[(*size)++] = particle;
+}
+
+static void appendRange(NeighbourList *list, size_t *size, const ParticleStore *particles, int i, int begin, int end, float skin) {
+    for (int j = begin; j < end; ++j) {
+        if (j == i) continue;
+
+        const float dx = particles->x[i] - particles->x[j];
+        const float dy = particles->y[i] - particles->y[j];
+        const float dz = particles->z[i] - particles->z[j];
+        const float reach = particles->radius[i] + particles->radius[j] + skin;
+
+        if (dx * dx + dy * dy + dz * dz < reach * reach) {
+            appendNeighbour(list, size, j);
+        }
+    }
+}
+
+void buildNeighbourList(NeighbourList *list, Domain *domain) {
+    const ParticleStore *particles = &domain->particles;
+    const float skin = domain->config.neighbourSkin;
+
+    size_t size = 0;
+
+    const size_t chunks = domain->chunkOrderCount;
+
+    // Sorted chunks hold consecutive particles in chunkOrder, so chunk order is particle order
+    for (size_t c = 0; c < chunks; ++c) {
+        const Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+        for (int i = chunk->begin; i < chunk->end; ++i) {
+            list->start[i] = size;
+
+            appendRange(list, &size, particles, i, list->half ? i + 1 : chunk->begin, chunk->end, skin);
+
+            for (int j = list->half ? HALF_STENCIL_BEGIN : 0; j < 26; ++j) {
+                const Chunk *adj = neighbourChunk(domain, chunk, j);
+
+                appendRange(list, &size, particles, i, adj->begin, adj->end, skin);
+            }
+        }
+    }
+
+    list->start[particles->count] = size;
+
+    memcpy(list->buildX, particles->x, particles->count * sizeof(float));
+    memcpy(list->buildY, particles->y, particles->count * sizeof(float));
+    memcpy(list->buildZ, particles->z, particles->count * sizeof(float));
+
+    list->valid = true;
+    list->builds++;
+}
@@ -0,0 +1,251 @@
+#include "simulation/containers/octree.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+void initOctree(Octree *tree, size_t count) {
+    tree->count = count;
+
+    // Leaves are at least a few particles deep on average, the rest grows on demand
+    tree->nodeCapacity = count / 2 + 1;
+    tree->nodeCount = 0;
+    tree->nodes = (OctreeNode*)malloc(tree->nodeCapacity * sizeof(OctreeNode));
+
+    tree->x = (float*)malloc(count * sizeof(float));
+    tree->y = (float*)malloc(count * sizeof(float));
+    tree->z = (float*)malloc(count * sizeof(float));
+    tree->mass = (float*)malloc(count * sizeof(float));
+    tree->index = (int*)malloc(count * sizeof(int));
+    tree->scratch = (int*)malloc(count * sizeof(int));
+    tree->leaves = (int*)malloc(count * sizeof(int));
+    tree->leafCount = 0;
+    tree->pullX = (float*)calloc(count, sizeof(float));
+    tree->pullY = (float*)calloc(count, sizeof(float));
+    tree->pullZ = (float*)calloc(count, sizeof(float));
+
+    if (tree->nodes == NULL || (count > 0 && (tree->x == NULL || tree->y == NULL || tree->z == NULL
+        || tree->mass == NULL || tree->index == NULL || tree->scratch == NULL || tree->leaves == NULL
+        || tree->pullX == NULL || tree->pullY == NULL || tree->pullZ == NULL))) {
+        fprintf(stderr, "Memory allocation failed for an octree of %zu particles\n", count);
+        exit(1);
+    }
+}
+
+void freeOctree(Octree *tree) {
+    free(tree->nodes);
+    free(tree->x);
+    free(tree->y);
+    free(tree->z);
+    free(tree->mass);
+    free(tree->index);
+    free(tree->scratch);
+    free(tree->leaves);
+    free(tree->pullX);
+    free(tree->pullY);
+    free(tree->pullZ);
+}
+
+static int addNodes(Octree *tree, int count) {
+    if (tree->nodeCount + count > tree->nodeCapacity) {
+        tree->nodeCapacity = 2 * (tree->nodeCount + count);
+        tree->nodes = (OctreeNode*)realloc(tree->nodes, tree->nodeCapacity * sizeof(OctreeNode));
+        if (tree->nodes == NULL) {
+            fprintf(stderr, "Memory allocation failed for %zu octree nodes\n", tree->nodeCapacity);
+            exit(1);
+        }
+    }
+
+    const int first = (int)tree->nodeCount;
+    tree->nodeCount += count;
+    return first;
+}
+
+// Adds m (3 d d^T - |d|^2 I) to quadrupole
+static void addQuadrupole(float quadrupole[6], float m, float dx, float dy, float dz) {
+    const float dSq = dx * dx + dy * dy + dz * dz;
+
+    quadrupole[0] += m * (3.0f * dx * dx - dSq);
+    quadrupole[1] += m * 3.0f * dx * dy;
+    quadrupole[2] += m * 3.0f * dx * dz;
+    quadrupole[3] += m * (3.0f * dy * dy - dSq);
+    quadrupole[4] += m * 3.0f * dy * dz;
+    quadrupole[5] += m * (3.0f * dz * dz - dSq);
+}
+
+// Multipole of a leaf from its particles
+static void leafMoments(Octree *tree, OctreeNode *node) {
+    float mass = 0.0f, x = 0.0f, y = 0.0f, z = 0.0f;
+
+    for (int i = node->begin; i < node->end; ++i) {
+        mass += tree->mass[i];
+        x += tree->mass[i] * tree->x[i];
+        y += tree->mass[i] * tree->y[i];
+        z += tree->mass[i] * tree->z[i];
+    }
+
+    node->mass = mass;
+    node->x = x / mass;
+    node->y = y / mass;
+    node->z = z / mass;
+
+    memset(node->quadrupole, 0, sizeof(node->quadrupole));
+    for (int i = node->begin; i < node->end; ++i) {
+        addQuadrupole(node->quadrupole, tree->mass[i], tree->x[i] - node->x, tree->y[i] - node->y, tree->z[i] - node->z);
+    }
+}
+
+// Multipole of an inner node from its children, shifted to the common centre of mass
+static void innerMoments(Octree *tree, OctreeNode *node) {
+    float mass = 0.0f, x = 0.0f, y = 0.0f, z = 0.0f;
+
+    for (int c = 0; c < node->childCount; ++c) {
+        const OctreeNode *child = &tree->nodes[node->firstChild + c];
+
+        mass += child->mass;
+        x += child->mass * child->x;
+        y += child->mass * child->y;
+        z += child->mass * child->z;
+    }
+
+    node->mass = mass;
+    node->x = x / mass;
+    node->y = y / mass;
+    node->z = z / mass;
+
+    memset(node->quadrupole, 0, sizeof(node->quadrupole));
+    for (int c = 0; c < node->childCount; ++c) {
+        const OctreeNode *child = &tree->nodes[node->firstChild + c];
+
+        for (int q = 0; q < 6; ++q) {
+            node->quadrupole[q] += child->quadrupole[q];
+        }
+        addQuadrupole(node->quadrupole, child->mass, child->x - node->x, child->y - node->y, child->z - node->z);
+    }
+}
+
+// Octant of particle p in the cube around (cx, cy, cz), x is the high bit
+static inline int octant(const ParticleStore *particles, int p, float cx, float cy, float cz) {
+    return (particles->x[p] >= cx) << 2 | (particles->y[p] >= cy) << 1 | (particles->z[p] >= cz);
+}
+
+/**
+ * Splits the entries [begin, end) of node, the cube of edge size around
+ * (cx, cy, cz), into its octants and builds those depth first, so every node
+ * covers a contiguous run of the leaf order. Nodes are only referred to by
+ * index, adding them may move them.
+ */
+static void buildNode(Octree *tree, const ParticleStore *particles, float unitVolume, int node, float cx, float cy, float cz, float size, int depth) {
+    const int begin = tree->nodes[node].begin;
+    const int end = tree->nodes[node].end;
+
+    tree->nodes[node].size = size;
+
+    if (end - begin <= OCTREE_LEAF_SIZE || depth == OCTREE_MAX_DEPTH) {
+        tree->nodes[node].firstChild = 0;
+        tree->nodes[node].childCount = 0;
+        tree->leaves[tree->leafCount++] = node;
+
+        for (int i = begin; i < end; ++i) {
+            const int p = tree->index[i];
+            tree->x[i] = particles->x[p];
+            tree->y[i] = particles->y[p];
+            tree->z[i] = particles->z[p];
+            tree->mass[i] = particles->radius[p] * particles->radius[p] * particles->radius[p] / unitVolume;
+        }
+    } else {
+        // Counting sort of the entries by octant, through scratch
+        int counts[8] = {0};
+        for (int i = begin; i < end; ++i) {
+            counts[octant(particles, tree->index[i], cx, cy, cz)]++;
+        }
+
+        int starts[9];
+        starts[0] = begin;
+        int childCount = 0;
+        for (int o = 0; o < 8; ++o) {
+            starts[o + 1] = starts[o] + counts[o];
+            childCount += counts[o] > 0;
+        }
+
+        int cursor[8];
+        memcpy(cursor, starts, sizeof(cursor));
+
+        for (int i = begin; i < end; ++i) {
+            const int p = tree->index[i];
+            tree->scratch[cursor[octant(particles, p, cx, cy, cz)]++] = p;
+        }
+        memcpy(tree->index + begin, tree->scratch + begin, (end - begin) * sizeof(int));
+
+        const int first = addNodes(tree, childCount);
+        tree->nodes[node].firstChild = first;
+        tree->nodes[node].childCount = childCount;
+
+        const float quarter = size / 4.0f;
+        int child = first;
+
+        for (int o = 0; o < 8; ++o) {
+            if (counts[o] == 0) continue;
+
+            tree->nodes[child].begin = starts[o];
+            tree->nodes[child].end = starts[o + 1];
+
+            buildNode(tree, particles, unitVolume, child,
+                      cx + (o & 4 ? quarter : -quarter),
+                      cy + (o & 2 ? quarter : -quarter),
+                      cz + (o & 1 ? quarter : -quarter),
+                      size / 2.0f, depth + 1);
+            child++;
+        }
+    }
+
+    OctreeNode *current = &tree->nodes[node];
+
+    if (current->childCount == 0) {
+        leafMoments(tree, current);
+    } else {
+        innerMoments(tree, current);
+    }
+
+    const float dx = current->x - cx;
+    const float dy = current->y - cy;
+    const float dz = current->z - cz;
+    current->offset = sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+void buildOctree(Octree *tree, const ParticleStore *particles, float unitRadius) {
+    const size_t count = particles->count;
+    tree->nodeCount = 0;
+    tree->leafCount = 0;
+
+    if (count == 0) return;
+
+    float lower[3] = {particles->x[0], particles->y[0], particles->z[0]};
+    float upper[3] = {particles->x[0], particles->y[0], particles->z[0]};
+
+    for (size_t i = 0; i < count; ++i) {
+        lower[0] = fminf(lower[0], particles->x[i]);
+        lower[1] = fminf(lower[1], particles->y[i]);
+        lower[2] = fminf(lower[2], particles->z[i]);
+        upper[0] = fmaxf(upper[0], particles->x[i]);
+        upper[1] = fmaxf(upper[1], particles->y[i]);
+        upper[2] = fmaxf(upper[2], particles->z[i]);
+
+        tree->index[i] = (int)i;
+    }
+
+    // Cube around the bounding box, a little larger so no particle sits on its upper faces
+    const float size = fmaxf(upper[0] - lower[0], fmaxf(upper[1] - lower[1], upper[2] - lower[2])) * 1.001f + 1e-6f;
+
+    const int root = addNodes(tree, 1);
+    tree->nodes[root].begin = 0;
+    tree->nodes[root].end = (int)count;
+
+    buildNode(tree, particles, unitRadius * unitRadius * unitRadius, root,
+              (lower[0] + upper[0]) / 2.0f, (lower[1] + upper[1]) / 2.0f, (lower[2] + upper[2]) / 2.0f,
+              size, 0);
+}
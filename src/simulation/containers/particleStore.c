@@ -0,0 +1,190 @@
+#include "simulation/containers/particleStore.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void *allocAligned(size_t bytes) {
+    // aligned_alloc wants a multiple of the alignment
+    bytes = (bytes + PARTICLE_ALIGNMENT - 1) / PARTICLE_ALIGNMENT * PARTICLE_ALIGNMENT;
+    if (bytes == 0) bytes = PARTICLE_ALIGNMENT;
+
+    void *data = aligned_alloc(PARTICLE_ALIGNMENT, bytes);
+    if (data == NULL) {
+        fprintf(stderr, "Memory allocation failed for particle store (%zu bytes)\n", bytes);
+        exit(1);
+    }
+
+    return data;
+}
+
+void initParticleStore(ParticleStore *store, size_t count) {
+    store->count = count;
+
+    store->x = (float*)allocAligned(count * sizeof(float));
+    store->y = (float*)allocAligned(count * sizeof(float));
+    store->z = (float*)allocAligned(count * sizeof(float));
+    store->vx = (float*)allocAligned(count * sizeof(float));
+    store->vy = (float*)allocAligned(count * sizeof(float));
+    store->vz = (float*)allocAligned(count * sizeof(float));
+    store->radius = (float*)allocAligned(count * sizeof(float));
+
+    store->col = (uint8_t*)allocAligned(count * 3 * sizeof(uint8_t));
+    store->id = (uint32_t*)allocAligned(count * sizeof(uint32_t));
+
+    for (size_t i = 0; i < count; ++i) {
+        store->id[i] = i;
+    }
+
+    store->mapping = NULL;
+    store->mappedBytes = 0;
+}
+
+void reserveParticleStore(ParticleStore *store, size_t count, bool hugePages) {
+    const uint64_t alignment = hugePages ? HUGE_PAGE_BYTES : (uint64_t)sysconf(_SC_PAGESIZE);
+    const size_t sizes[9] = {sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+                             3 * sizeof(uint8_t), sizeof(uint32_t)};
+
+    uint64_t offsets[9];
+    uint64_t bytes = 0;
+
+    for (int a = 0; a < 9; ++a) {
+        offsets[a] = bytes;
+        bytes = (bytes + count * sizes[a] + alignment - 1) / alignment * alignment;
+    }
+
+    // Page aligned, so with huge pages the arrays start on a huge page once the mapping does
+    const size_t mappedBytes = bytes + (hugePages ? HUGE_PAGE_BYTES : 0);
+    char *mapping = (char*)mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %zu bytes for particle store\n", mappedBytes);
+        exit(1);
+    }
+
+    const uint64_t skip = hugePages ? (HUGE_PAGE_BYTES - (uintptr_t)mapping % HUGE_PAGE_BYTES) % HUGE_PAGE_BYTES : 0;
+    for (int a = 0; a < 9; ++a) {
+        offsets[a] += skip;
+    }
+
+    if (hugePages) {
+        madvise(mapping + skip, bytes, MADV_HUGEPAGE);
+    }
+
+    mapParticleStore(store, count, mapping, mappedBytes, offsets);
+}
+
+void freeParticleStore(ParticleStore *store) {
+    if (store->mapping != NULL) {
+        munmap(store->mapping, store->mappedBytes);
+
+        store->mapping = NULL;
+        store->mappedBytes = 0;
+        store->count = 0;
+        return;
+    }
+
+    free(store->x);
+    free(store->y);
+    free(store->z);
+    free(store->vx);
+    free(store->vy);
+    free(store->vz);
+    free(store->radius);
+    free(store->col);
+    free(store->id);
+
+    store->count = 0;
+}
+
+void mapParticleStore(ParticleStore *store, size_t count, void *mapping, size_t bytes, const uint64_t offsets[9]) {
+    char *base = (char*)mapping;
+
+    store->count = count;
+
+    store->x = (float*)(base + offsets[0]);
+    store->y = (float*)(base + offsets[1]);
+    store->z = (float*)(base + offsets[2]);
+    store->vx = (float*)(base + offsets[3]);
+    store->vy = (float*)(base + offsets[4]);
+    store->vz = (float*)(base + offsets[5]);
+    store->radius = (float*)(base + offsets[6]);
+    store->col = (uint8_t*)(base + offsets[7]);
+    store->id = (uint32_t*)(base + offsets[8]);
+
+    store->mapping = mapping;
+    store->mappedBytes = bytes;
+}
+
+void exportParticles(const ParticleStore *store, Particle *out) {
+    for (size_t i = 0; i < store->count; ++i) {
+        Particle *particle = &out[i];
+
+        particle->pos = (V3) {store->x[i], store->y[i], store->z[i]};
+        particle->vel = (V3) {store->vx[i], store->vy[i], store->vz[i]};
+        particle->mass = store->radius[i];
+        particle->density = 0.0f;
+
+        particle->col[0] = store->col[3 * i + 0];
+        particle->col[1] = store->col[3 * i + 1];
+        particle->col[2] = store->col[3 * i + 2];
+    }
+}
+
+void scatterParticles(const ParticleStore *source, ParticleStore *target, const int *destination) {
+    for (size_t i = 0; i < source->count; ++i) {
+        const int j = destination[i];
+
+        target->x[j] = source->x[i];
+        target->y[j] = source->y[i];
+        target->z[j] = source->z[i];
+        target->vx[j] = source->vx[i];
+        target->vy[j] = source->vy[i];
+        target->vz[j] = source->vz[i];
+        target->radius[j] = source->radius[i];
+
+        target->col[3 * j + 0] = source->col[3 * i + 0];
+        target->col[3 * j + 1] = source->col[3 * i + 1];
+        target->col[3 * j + 2] = source->col[3 * i + 2];
+
+        target->id[j] = source->id[i];
+    }
+}
+
+void moveParticle(ParticleStore *store, size_t from, size_t to) {
+    store->x[to] = store->x[from];
+    store->y[to] = store->y[from];
+    store->z[to] = store->z[from];
+    store->vx[to] = store->vx[from];
+    store->vy[to] = store->vy[from];
+    store->vz[to] = store->vz[from];
+    store->radius[to] = store->radius[from];
+    store->id[to] = store->id[from];
+    store->col[3 * to + 0] = store->col[3 * from + 0];
+    store->col[3 * to + 1] = store->col[3 * from + 1];
+    store->col[3 * to + 2] = store->col[3 * from + 2];
+}
+
+void swapParticleStores(ParticleStore *a, ParticleStore *b) {
+    ParticleStore temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+void copyParticleStore(const ParticleStore *source, ParticleStore *target) {
+    const size_t bytes = source->count * sizeof(float);
+
+    memcpy(target->x, source->x, bytes);
+    memcpy(target->y, source->y, bytes);
+    memcpy(target->z, source->z, bytes);
+    memcpy(target->vx, source->vx, bytes);
+    memcpy(target->vy, source->vy, bytes);
+    memcpy(target->vz, source->vz, bytes);
+    memcpy(target->radius, source->radius, bytes);
+    memcpy(target->col, source->col, source->count * 3 * sizeof(uint8_t));
+    memcpy(target->id, source->id, source->count * sizeof(uint32_t));
+}
@@ -0,0 +1,169 @@
+#include "simulation/containers/population.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+
+void initPopulation(Population *population, size_t capacity) {
+    population->alive = (uint8_t*)malloc(capacity * sizeof(uint8_t));
+    population->removals = (size_t*)malloc(capacity * sizeof(size_t));
+    if (population->alive == NULL || population->removals == NULL) {
+        fprintf(stderr, "Memory allocation failed for the population of %zu particles\n", capacity);
+        exit(1);
+    }
+
+    memset(population->alive, 1, capacity * sizeof(uint8_t));
+    population->removalCount = 0;
+    population->nextId = capacity;
+
+    for (int e = 0; e < MAX_EMITTERS; ++e) {
+        population->owed[e] = 0.0f;
+    }
+}
+
+void freePopulation(Population *population) {
+    free(population->alive);
+    free(population->removals);
+}
+
+float spawnRadius(const Config *config, Rng *rng) {
+    if (config->radiusRatio <= 1.0f) return config->mass;
+
+    // Equal volume per doubling of the radius, so the small particles are the most by far
+    const float ratio = config->radiusRatio;
+    const float fraction = 1.0f - randomFloat(rng) * (1.0f - powf(ratio, -3.0f));
+
+    return config->mass / ratio / cbrtf(fraction);
+}
+
+// Nothing may point at the old store any more
+static void populationChanged(Domain *domain) {
+    domain->membershipValid = false;
+    domain->neighbours.valid = false;
+}
+
+long spawnParticle(Domain *domain, float x, float y, float z, V3 velocity, float radius) {
+    ParticleStore *store = &domain->particles;
+
+    if (store->count >= domain->config.numParticles) {
+        domain->metrics.refusedParticles++;
+        return -1;
+    }
+
+    const size_t i = store->count++;
+
+    store->x[i] = x;
+    store->y[i] = y;
+    store->z[i] = z;
+    store->vx[i] = velocity.x;
+    store->vy[i] = velocity.y;
+    store->vz[i] = velocity.z;
+    store->radius[i] = radius;
+    store->id[i] = domain->population.nextId++;
+
+    store->col[3 * i + 0] = nextRng(&domain->rng) % 255;
+    store->col[3 * i + 1] = nextRng(&domain->rng) % 255;
+    store->col[3 * i + 2] = nextRng(&domain->rng) % 255;
+
+    // New particles start awake
+    if (domain->calmSteps != NULL) {
+        domain->calmSteps[i] = 0.0f;
+    }
+
+    domain->metrics.emittedParticles++;
+    populationChanged(domain);
+
+    return i;
+}
+
+void removeParticle(Domain *domain, size_t i) {
+    Population *population = &domain->population;
+
+    if (!population->alive[i]) return;
+
+    population->alive[i] = 0;
+    population->removals[population->removalCount++] = i;
+}
+
+static int compareDescending(const void *a, const void *b) {
+    const size_t left = *(const size_t*)a;
+    const size_t right = *(const size_t*)b;
+
+    return (left < right) - (left > right);
+}
+
+void compactParticles(Domain *domain) {
+    Population *population = &domain->population;
+    ParticleStore *store = &domain->particles;
+
+    if (population->removalCount == 0) return;
+
+    // From the back, so every dead slot above the current one is already gone and the last particle is alive
+    qsort(population->removals, population->removalCount, sizeof(size_t), compareDescending);
+
+    for (size_t r = 0; r < population->removalCount; ++r) {
+        const size_t i = population->removals[r];
+        const size_t last = --store->count;
+
+        if (i != last) {
+            moveParticle(store, last, i);
+
+            if (domain->calmSteps != NULL) {
+                domain->calmSteps[i] = domain->calmSteps[last];
+            }
+        }
+
+        population->alive[i] = 1;
+        population->alive[last] = 1;
+    }
+
+    domain->metrics.removedParticles += population->removalCount;
+    population->removalCount = 0;
+
+    populationChanged(domain);
+}
+
+static bool insideSink(const Sink *sink, float x, float y, float z) {
+    return x >= sink->lower.x && x < sink->upper.x
+        && y >= sink->lower.y && y < sink->upper.y
+        && z >= sink->lower.z && z < sink->upper.z;
+}
+
+void updatePopulation(Domain *domain) {
+    const Config *config = &domain->config;
+    if (config->emitterCount == 0 && config->sinkCount == 0 && domain->population.removalCount == 0) return;
+
+    const double start = beginPhase(&domain->metrics);
+    ParticleStore *store = &domain->particles;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        for (int s = 0; s < config->sinkCount; ++s) {
+            if (insideSink(&config->sinks[s], store->x[i], store->y[i], store->z[i])) {
+                removeParticle(domain, i);
+                break;
+            }
+        }
+    }
+
+    compactParticles(domain);
+
+    // The rate is per frame, so it holds whatever the substeps
+    for (int e = 0; e < config->emitterCount; ++e) {
+        const Emitter *emitter = &config->emitters[e];
+        float owed = domain->population.owed[e] + emitter->rate / config->supsampling;
+
+        for (; owed >= 1.0f; owed -= 1.0f) {
+            const float x = emitter->lower.x + randomFloat(&domain->rng) * (emitter->upper.x - emitter->lower.x);
+            const float y = emitter->lower.y + randomFloat(&domain->rng) * (emitter->upper.y - emitter->lower.y);
+            const float z = emitter->lower.z + randomFloat(&domain->rng) * (emitter->upper.z - emitter->lower.z);
+
+            spawnParticle(domain, x, y, z, emitter->velocity, spawnRadius(config, &domain->rng));
+        }
+
+        domain->population.owed[e] = owed;
+    }
+
+    endPhase(&domain->metrics, METRIC_PHASE_POPULATION, start);
+}
@@ -0,0 +1,326 @@
+#include "simulation/containers/sparseGrid.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/chunk.h"
+
+// Coordinates take 20 bits each, plenty for any grid that fits into memory as particles. The level goes above them
+#define SPARSE_COORDINATE_BITS 20
+
+static void *reallocSparse(void *data, size_t bytes) {
+    void *resized = realloc(data, bytes > 0 ? bytes : 1);
+    if (resized == NULL) {
+        fprintf(stderr, "Memory allocation failed for sparse chunk grid (%zu bytes)\n", bytes);
+        exit(1);
+    }
+
+    return resized;
+}
+
+static uint64_t packCoordinates(int level, int x, int y, int z) {
+    return ((uint64_t)level << (3 * SPARSE_COORDINATE_BITS) | (uint64_t)x << (2 * SPARSE_COORDINATE_BITS)
+        | (uint64_t)y << SPARSE_COORDINATE_BITS | (uint64_t)z) + 1;
+}
+
+// Chunks of level along axis d
+static int levelCount(const SparseGrid *grid, int level, int d) {
+    return (grid->chunkCounts[d] + (1 << level) - 1) >> level;
+}
+
+// Mixes all bits down, the table only keeps the low ones
+static size_t hashKey(uint64_t key, size_t tableSize) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+
+    return key & (tableSize - 1);
+}
+
+static void resizeTable(SparseGrid *grid, size_t tableSize) {
+    free(grid->keys);
+    free(grid->slots);
+
+    grid->tableSize = tableSize;
+    grid->keys = (uint64_t*)calloc(tableSize, sizeof(uint64_t));
+    grid->slots = (int*)malloc(tableSize * sizeof(int));
+    if (grid->keys == NULL || grid->slots == NULL) {
+        fprintf(stderr, "Memory allocation failed for sparse chunk table of %zu\n", tableSize);
+        exit(1);
+    }
+
+    // Put the existing chunks back
+    for (size_t c = 1; c <= grid->count; ++c) {
+        const int *coordinates = &grid->coordinates[3 * c];
+        const uint64_t key = packCoordinates(grid->chunkLevels[c], coordinates[0], coordinates[1], coordinates[2]);
+
+        size_t slot = hashKey(key, tableSize);
+        while (grid->keys[slot] != 0) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        grid->keys[slot] = key;
+        grid->slots[slot] = c;
+    }
+}
+
+static void growChunks(SparseGrid *grid) {
+    grid->capacity *= 2;
+
+    grid->chunks = (Chunk*)reallocSparse(grid->chunks, (grid->capacity + 1) * sizeof(Chunk));
+    grid->coordinates = (int*)reallocSparse(grid->coordinates, 3 * (grid->capacity + 1) * sizeof(int));
+    grid->neighbours = (int*)reallocSparse(grid->neighbours, 26 * (grid->capacity + 1) * sizeof(int));
+    grid->chunkLevels = (int*)reallocSparse(grid->chunkLevels, (grid->capacity + 1) * sizeof(int));
+    grid->parents = (int*)reallocSparse(grid->parents, (grid->capacity + 1) * sizeof(int));
+    grid->order = (int*)reallocSparse(grid->order, grid->capacity * sizeof(int));
+    grid->colourOrder = (int*)reallocSparse(grid->colourOrder, grid->capacity * sizeof(int));
+}
+
+static void clearChunk(Chunk *chunk) {
+    chunk->numParticles = 0;
+    chunk->size = 0;
+    chunk->particles = NULL;
+    chunk->begin = 0;
+    chunk->end = 0;
+    chunk->calm = 0.0f;
+    chunk->asleep = false;
+}
+
+SparseGrid *createSparseGrid(void) {
+    SparseGrid *grid = (SparseGrid*)reallocSparse(NULL, sizeof(SparseGrid));
+
+    grid->count = 0;
+    grid->capacity = 64;
+    grid->chunks = (Chunk*)reallocSparse(NULL, (grid->capacity + 1) * sizeof(Chunk));
+    grid->coordinates = (int*)reallocSparse(NULL, 3 * (grid->capacity + 1) * sizeof(int));
+    grid->neighbours = (int*)reallocSparse(NULL, 26 * (grid->capacity + 1) * sizeof(int));
+    grid->chunkLevels = (int*)reallocSparse(NULL, (grid->capacity + 1) * sizeof(int));
+    grid->parents = (int*)reallocSparse(NULL, (grid->capacity + 1) * sizeof(int));
+    grid->order = (int*)reallocSparse(NULL, grid->capacity * sizeof(int));
+    grid->colourOrder = (int*)reallocSparse(NULL, grid->capacity * sizeof(int));
+
+    clearChunk(&grid->chunks[0]);
+
+    for (int d = 0; d < 3; ++d) {
+        grid->chunkCounts[d] = 0;
+    }
+
+    grid->levels = 1;
+    grid->ordered = false;
+    grid->keys = NULL;
+    grid->slots = NULL;
+    resizeTable(grid, 2 * grid->capacity);
+
+    return grid;
+}
+
+void destroySparseGrid(SparseGrid *grid) {
+    free(grid->chunks);
+    free(grid->coordinates);
+    free(grid->neighbours);
+    free(grid->chunkLevels);
+    free(grid->parents);
+    free(grid->order);
+    free(grid->colourOrder);
+    free(grid->keys);
+    free(grid->slots);
+    free(grid);
+}
+
+void clearSparseGrid(SparseGrid *grid, const int chunkCounts[3], int levels) {
+    if (levels < 1 || levels > SPARSE_GRID_LEVELS) {
+        fprintf(stderr, "Sparse chunk grid supports 1 to %d levels, not %d\n", SPARSE_GRID_LEVELS, levels);
+        exit(1);
+    }
+
+    grid->count = 0;
+    grid->levels = levels;
+    grid->ordered = false;
+    memset(grid->keys, 0, grid->tableSize * sizeof(uint64_t));
+
+    for (int d = 0; d < 3; ++d) {
+        grid->chunkCounts[d] = chunkCounts[d];
+    }
+}
+
+void resetSparseGrid(SparseGrid *grid) {
+    for (size_t c = 1; c <= grid->count; ++c) {
+        grid->chunks[c].numParticles = 0;
+    }
+}
+
+// Index of the chunk with key, or 0, with the slot it has or would take
+static int lookupChunk(const SparseGrid *grid, uint64_t key, size_t *slot) {
+    *slot = hashKey(key, grid->tableSize);
+
+    while (grid->keys[*slot] != 0) {
+        if (grid->keys[*slot] == key) return grid->slots[*slot];
+
+        *slot = (*slot + 1) & (grid->tableSize - 1);
+    }
+
+    return 0;
+}
+
+// Links a new chunk both ways, neighbour n sees it as its neighbour 25 - n
+static void linkChunk(SparseGrid *grid, int chunk) {
+    const int *coordinates = &grid->coordinates[3 * chunk];
+    const int level = grid->chunkLevels[chunk];
+    int *neighbours = &grid->neighbours[26 * chunk];
+
+    int n = 0;
+    for (int ni = -1; ni <= 1; ++ni) {
+        for (int nj = -1; nj <= 1; ++nj) {
+            for (int nk = -1; nk <= 1; ++nk) {
+                if (ni == 0 && nj == 0 && nk == 0)
+                    continue;
+
+                const int x = coordinates[0] + ni;
+                const int y = coordinates[1] + nj;
+                const int z = coordinates[2] + nk;
+
+                int neighbour = 0;
+
+                if (x >= 0 && x < levelCount(grid, level, 0) && y >= 0 && y < levelCount(grid, level, 1) && z >= 0 && z < levelCount(grid, level, 2)) {
+                    size_t slot;
+                    neighbour = lookupChunk(grid, packCoordinates(level, x, y, z), &slot);
+                }
+
+                neighbours[n] = neighbour;
+                if (neighbour != 0) {
+                    grid->neighbours[26 * neighbour + 25 - n] = chunk;
+                }
+
+                n++;
+            }
+        }
+    }
+}
+
+int sparseChunk(SparseGrid *grid, int level, int x, int y, int z) {
+    const uint64_t key = packCoordinates(level, x, y, z);
+
+    size_t slot;
+    const int found = lookupChunk(grid, key, &slot);
+    if (found != 0) return found;
+
+    if (grid->count == grid->capacity) {
+        growChunks(grid);
+    }
+
+    const int chunk = ++grid->count;
+
+    clearChunk(&grid->chunks[chunk]);
+    grid->coordinates[3 * chunk + 0] = x;
+    grid->coordinates[3 * chunk + 1] = y;
+    grid->coordinates[3 * chunk + 2] = z;
+    grid->chunkLevels[chunk] = level;
+    grid->parents[chunk] = 0;
+
+    grid->keys[slot] = key;
+    grid->slots[slot] = chunk;
+
+    // At most half full, so probes stay short
+    if (2 * grid->count > grid->tableSize) {
+        resizeTable(grid, 2 * grid->tableSize);
+    }
+
+    linkChunk(grid, chunk);
+    grid->ordered = false;
+
+    // Might grow the arrays, so the index goes through a local
+    if (level + 1 < grid->levels) {
+        const int parent = sparseChunk(grid, level + 1, x >> 1, y >> 1, z >> 1);
+        grid->parents[chunk] = parent;
+    }
+
+    return chunk;
+}
+
+static uint64_t spreadBits(uint64_t value) {
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffull;
+    value = (value | value << 16) & 0x1f0000ff0000ffull;
+    value = (value | value << 8) & 0x100f00f00f00f00full;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+    value = (value | value << 2) & 0x1249249249249249ull;
+
+    return value;
+}
+
+typedef struct {
+    uint64_t code;
+    int chunk;
+} OrderEntry;
+
+static int compareOrder(const void *a, const void *b) {
+    const uint64_t codeA = ((const OrderEntry*)a)->code;
+    const uint64_t codeB = ((const OrderEntry*)b)->code;
+
+    return (codeA > codeB) - (codeA < codeB);
+}
+
+static int chunkColour(const SparseGrid *grid, int chunk) {
+    const int *coordinates = &grid->coordinates[3 * chunk];
+
+    return (coordinates[0] % 3) * 9 + (coordinates[1] % 3) * 3 + coordinates[2] % 3;
+}
+
+void orderSparseGrid(SparseGrid *grid, bool morton) {
+    if (grid->ordered) return;
+
+    // Chunks come in the order the store first visited them, which an earlier update sorted already
+    for (size_t c = 0; c < grid->count; ++c) {
+        grid->order[c] = c + 1;
+    }
+
+    if (morton && grid->count > 1) {
+        OrderEntry *entries = (OrderEntry*)reallocSparse(NULL, grid->count * sizeof(OrderEntry));
+
+        for (size_t c = 0; c < grid->count; ++c) {
+            const int *coordinates = &grid->coordinates[3 * (c + 1)];
+
+            // On the curve of level 0, so coarse chunks land next to the fine ones they contain
+            const int level = grid->chunkLevels[c + 1];
+
+            entries[c].code = spreadBits(coordinates[0] << level) << 2 | spreadBits(coordinates[1] << level) << 1 | spreadBits(coordinates[2] << level);
+            entries[c].chunk = c + 1;
+        }
+
+        qsort(entries, grid->count, sizeof(OrderEntry), compareOrder);
+
+        for (size_t c = 0; c < grid->count; ++c) {
+            grid->order[c] = entries[c].chunk;
+        }
+
+        free(entries);
+    }
+
+    // Counting sort by colour
+    size_t counts[27] = {0};
+
+    for (size_t c = 1; c <= grid->count; ++c) {
+        counts[chunkColour(grid, c)]++;
+    }
+
+    grid->colourStart[0] = 0;
+    for (int k = 0; k < 27; ++k) {
+        grid->colourStart[k + 1] = grid->colourStart[k] + counts[k];
+        counts[k] = grid->colourStart[k];
+    }
+
+    for (size_t c = 0; c < grid->count; ++c) {
+        const int chunk = grid->order[c];
+
+        grid->colourOrder[counts[chunkColour(grid, chunk)]++] = chunk;
+    }
+
+    grid->ordered = true;
+}
+
+size_t sparseGridBytes(const SparseGrid *grid) {
+    const size_t perChunk = sizeof(Chunk) + (3 + 26 + 1 + 1 + 1 + 1) * sizeof(int);
+
+    return sizeof(SparseGrid) + (grid->capacity + 1) * perChunk + grid->tableSize * (sizeof(uint64_t) + sizeof(int));
+}
@@ -5,14 +5,20 @@
  */
 
 
-void checkBoundaries(Particle *particle, Domain *domain) {
-    // Predict the new position
-    const V3 newPos = add3(&particle->pos, &particle->vel);
-
-    const float newPosX = newPos.x;
-    const float newPosY = newPos.y;
-    const float newPosZ = newPos.z;
+// Reflects one axis if the predicted position leaves [0, dim)
+static inline void checkAxis(float *pos, float *vel, float radius, int dim, float friction) {
+    const float newPos = *pos + *vel;
+
+    if (newPos - radius < 0) {
+        *vel *= -friction;
+        *pos = radius;
+    } else if (newPos + radius >= dim) {
+        *vel *= -friction;
+        *pos = dim - radius;
+    }
+}
 
+void checkBoundaries(ParticleStore *particles, size_t begin, size_t end, const Domain *domain) {
     const int DIM_X = domain->config.dim[0];
     const int DIM_Y = domain->config.dim[1];
     const int DIM_Z = domain->config.dim[2];
@@ -20,27 +26,11 @@ void checkBoundaries(Particle *particle, Domain *domain) {
     const float friction = domain->config.friction;
 
     // Check if we would go out of bounds and correct position and velocity if necessary
-    if (newPosX - particle->mass < 0) {
-        particle->vel.x *= -friction;
-        particle->pos.x = particle->mass;
-    } else if (newPosX + particle->mass >= DIM_X) {
-        particle->vel.x *= -friction;
-        particle->pos.x = DIM_X - particle->mass;
-    }
-
-    if (newPosY - particle->mass < 0) {
-        particle->vel.y *= -friction;
-        particle->pos.y = particle->mass;
-    } else if (newPosY + particle->mass >= DIM_Y) {
-        particle->vel.y *= -friction;
-        particle->pos.y = DIM_Y - particle->mass;
-    }
+    for (size_t i = begin; i < end; ++i) {
+        const float radius = particles->radius[i];
 
-    if (newPosZ - particle->mass < 0) {
-        particle->vel.z *= -friction;
-        particle->pos.z = particle->mass;
-    } else if (newPosZ + particle->mass >= DIM_Z) {
-        particle->vel.z *= -friction;
-        particle->pos.z = DIM_Z - particle->mass;
+        checkAxis(&particles->x[i], &particles->vx[i], radius, DIM_X, friction);
+        checkAxis(&particles->y[i], &particles->vy[i], radius, DIM_Y, friction);
+        checkAxis(&particles->z[i], &particles->vz[i], radius, DIM_Z, friction);
     }
 }
@@ -4,18 +4,20 @@
  * Copyright (c) Alexander Kurtz 2024
  */
 
-void handleCollision(Particle* a, Particle* b, float distance, float friction) {
-    V3 dif = sub3(&a->pos, &b->pos);
-
-    if (distance < a->mass + b->mass) {
+void handleCollision(ParticleStore *particles, int a, int b, float distance, float friction) {
+    if (distance < particles->radius[a] + particles->radius[b]) {
         // Normal vector
-        V3 normal = div3(&dif, distance);
+        const float normalX = (particles->x[a] - particles->x[b]) / distance;
+        const float normalY = (particles->y[a] - particles->y[b]) / distance;
+        const float normalZ = (particles->z[a] - particles->z[b]) / distance;
 
         // Relative velocity
-        V3 relVel = sub3(&a->vel, &b->vel);
+        const float relVelX = particles->vx[a] - particles->vx[b];
+        const float relVelY = particles->vy[a] - particles->vy[b];
+        const float relVelZ = particles->vz[a] - particles->vz[b];
 
         // Dot product of relative velocity and normal vector
-        float vDotN = dot3(&relVel, &normal);
+        float vDotN = relVelX * normalX + relVelY * normalY + relVelZ * normalZ;
 
         // Only resolve if particles are moving towards each other
         if (vDotN > 0) return;
@@ -24,9 +26,12 @@ void handleCollision(Particle* a, Particle* b, float distance, float friction) {
         float impulse = vDotN * friction;
 
         // Apply impulse
-        const V3 impulseVec = mul3(&normal, impulse);
+        particles->vx[a] -= normalX * impulse;
+        particles->vy[a] -= normalY * impulse;
+        particles->vz[a] -= normalZ * impulse;
 
-        a->vel = sub3(&a->vel, &impulseVec);
-        b->vel = add3(&b->vel, &impulseVec);
+        particles->vx[b] += normalX * impulse;
+        particles->vy[b] += normalY * impulse;
+        particles->vz[b] += normalZ * impulse;
     }
 }
@@ -0,0 +1,252 @@
+#include "simulation/forces/contactBlock.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/forces/contact.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONTACT_BLOCK_X86
+#endif
+
+int contactBlockScalar(const ParticleStore *particles, int a, int begin, int end, const ContactLaw *law, float dv[3], float *overlap) {
+    int contacts = 0;
+
+    if (dv == NULL) {
+        for (int b = begin; b < end; ++b) {
+            contacts += contactTouches(particles, a, b);
+        }
+
+        return contacts;
+    }
+
+    for (int b = begin; b < end; ++b) {
+        const float before[3] = {dv[0], dv[1], dv[2]};
+
+        if (!contactResponse(particles, a, b, law->repulsion, law->friction, law->contacts, dv, overlap)) continue;
+
+        if (law->scatter[0] != NULL) {
+            law->scatter[0][b] -= dv[0] - before[0];
+            law->scatter[1][b] -= dv[1] - before[1];
+            law->scatter[2][b] -= dv[2] - before[2];
+        }
+
+        contacts++;
+    }
+
+    return contacts;
+}
+
+#ifdef CONTACT_BLOCK_X86
+
+/**
+ * Resolves the velocity dependent part of contactResponse for the hit lanes of
+ * a vector, in lane order, so under the sequential law a sees each earlier
+ * contact like the scalar kernel. Contacts are rare next to tests, the
+ * geometry is what is worth vectorising.
+ */
+static inline void resolveHits(const ParticleStore *particles, int a, int b, int hitBits,
+                               const float *normalX, const float *normalY, const float *normalZ, const float *force,
+                               const float *depth, const ContactLaw *law, float dv[3], float *overlap) {
+    const bool running = law->contacts == NULL;
+
+    while (hitBits) {
+        const int lane = __builtin_ctz(hitBits);
+        hitBits &= hitBits - 1;
+
+        const int other = b + lane;
+
+        *overlap = fmaxf(*overlap, depth[lane]);
+
+        const float runX = running ? dv[0] : 0.0f;
+        const float runY = running ? dv[1] : 0.0f;
+        const float runZ = running ? dv[2] : 0.0f;
+
+        const float vDotN = (particles->vx[a] + runX - particles->vx[other]) * normalX[lane] +
+                            (particles->vy[a] + runY - particles->vy[other]) * normalY[lane] +
+                            (particles->vz[a] + runZ - particles->vz[other]) * normalZ[lane] + 2.0f * force[lane];
+
+        float push = 2.0f * force[lane];
+
+        // Only resolve if particles are moving towards each other
+        if (vDotN <= 0) {
+            push -= vDotN * (law->friction * (running ? 1.0f : contactShare(law->contacts, a, other)));
+        }
+
+        const float pushX = normalX[lane] * push;
+        const float pushY = normalY[lane] * push;
+        const float pushZ = normalZ[lane] * push;
+
+        dv[0] += pushX;
+        dv[1] += pushY;
+        dv[2] += pushZ;
+
+        if (law->scatter[0] != NULL) {
+            law->scatter[0][other] -= pushX;
+            law->scatter[1][other] -= pushY;
+            law->scatter[2][other] -= pushZ;
+        }
+    }
+}
+
+// Same arithmetic as contactResponse, the geometry eight lanes at a time
+__attribute__((target("avx2,fma")))
+static int contactBlockAvx2(const ParticleStore *particles, int a, int begin, int end, const ContactLaw *law, float dv[3], float *overlap) {
+    const __m256 ax = _mm256_set1_ps(particles->x[a]);
+    const __m256 ay = _mm256_set1_ps(particles->y[a]);
+    const __m256 az = _mm256_set1_ps(particles->z[a]);
+    const __m256 ar = _mm256_set1_ps(particles->radius[a]);
+
+    const __m256 repulsionVec = _mm256_set1_ps(law->repulsion);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    float normalX[8], normalY[8], normalZ[8], force[8], depth[8];
+    int contacts = 0;
+
+    for (int b = begin; b < end; b += 8) {
+        // Lanes past the end of the block are masked out of loads
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(end - b), lanes);
+
+        const __m256 bx = _mm256_maskload_ps(&particles->x[b], valid);
+        const __m256 by = _mm256_maskload_ps(&particles->y[b], valid);
+        const __m256 bz = _mm256_maskload_ps(&particles->z[b], valid);
+        const __m256 br = _mm256_maskload_ps(&particles->radius[b], valid);
+
+        const __m256 difX = _mm256_sub_ps(ax, bx);
+        const __m256 difY = _mm256_sub_ps(ay, by);
+        const __m256 difZ = _mm256_sub_ps(az, bz);
+
+        const __m256 distanceSq = _mm256_fmadd_ps(difZ, difZ, _mm256_fmadd_ps(difY, difY, _mm256_mul_ps(difX, difX)));
+        const __m256 contact = _mm256_add_ps(ar, br);
+
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(distanceSq, _mm256_mul_ps(contact, contact), _CMP_LT_OQ),
+                                   _mm256_cmp_ps(distanceSq, zero, _CMP_GT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_castsi256_ps(valid));
+
+        const int hitBits = _mm256_movemask_ps(hit);
+        if (hitBits == 0) continue;
+
+        contacts += __builtin_popcount(hitBits);
+        if (dv == NULL) continue;
+
+        // Misses divide by a dummy distance of one and are never resolved
+        const __m256 distance = _mm256_blendv_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(distanceSq), hit);
+
+        _mm256_storeu_ps(normalX, _mm256_div_ps(difX, distance));
+        _mm256_storeu_ps(normalY, _mm256_div_ps(difY, distance));
+        _mm256_storeu_ps(normalZ, _mm256_div_ps(difZ, distance));
+        _mm256_storeu_ps(force, _mm256_mul_ps(_mm256_sub_ps(contact, distance), repulsionVec));
+        _mm256_storeu_ps(depth, _mm256_div_ps(_mm256_sub_ps(contact, distance), contact));
+
+        resolveHits(particles, a, b, hitBits, normalX, normalY, normalZ, force, depth, law, dv, overlap);
+    }
+
+    return contacts;
+}
+
+// Same as the AVX2 kernel with sixteen lanes and mask registers
+__attribute__((target("avx512f")))
+static int contactBlockAvx512(const ParticleStore *particles, int a, int begin, int end, const ContactLaw *law, float dv[3], float *overlap) {
+    const __m512 ax = _mm512_set1_ps(particles->x[a]);
+    const __m512 ay = _mm512_set1_ps(particles->y[a]);
+    const __m512 az = _mm512_set1_ps(particles->z[a]);
+    const __m512 ar = _mm512_set1_ps(particles->radius[a]);
+
+    const __m512 repulsionVec = _mm512_set1_ps(law->repulsion);
+    const __m512 zero = _mm512_setzero_ps();
+
+    float normalX[16], normalY[16], normalZ[16], force[16], depth[16];
+    int contacts = 0;
+
+    for (int b = begin; b < end; b += 16) {
+        const int remaining = end - b;
+        const __mmask16 valid = remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1);
+
+        const __m512 bx = _mm512_maskz_loadu_ps(valid, &particles->x[b]);
+        const __m512 by = _mm512_maskz_loadu_ps(valid, &particles->y[b]);
+        const __m512 bz = _mm512_maskz_loadu_ps(valid, &particles->z[b]);
+        const __m512 br = _mm512_maskz_loadu_ps(valid, &particles->radius[b]);
+
+        const __m512 difX = _mm512_sub_ps(ax, bx);
+        const __m512 difY = _mm512_sub_ps(ay, by);
+        const __m512 difZ = _mm512_sub_ps(az, bz);
+
+        const __m512 distanceSq = _mm512_fmadd_ps(difZ, difZ, _mm512_fmadd_ps(difY, difY, _mm512_mul_ps(difX, difX)));
+        const __m512 contact = _mm512_add_ps(ar, br);
+
+        __mmask16 hit = _mm512_mask_cmp_ps_mask(valid, distanceSq, _mm512_mul_ps(contact, contact), _CMP_LT_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, distanceSq, zero, _CMP_GT_OQ);
+
+        if (hit == 0) continue;
+
+        contacts += __builtin_popcount(hit);
+        if (dv == NULL) continue;
+
+        const __m512 distance = _mm512_mask_sqrt_ps(_mm512_set1_ps(1.0f), hit, distanceSq);
+
+        _mm512_storeu_ps(normalX, _mm512_div_ps(difX, distance));
+        _mm512_storeu_ps(normalY, _mm512_div_ps(difY, distance));
+        _mm512_storeu_ps(normalZ, _mm512_div_ps(difZ, distance));
+        _mm512_storeu_ps(force, _mm512_mul_ps(_mm512_sub_ps(contact, distance), repulsionVec));
+        _mm512_storeu_ps(depth, _mm512_div_ps(_mm512_sub_ps(contact, distance), contact));
+
+        resolveHits(particles, a, b, hit, normalX, normalY, normalZ, force, depth, law, dv, overlap);
+    }
+
+    return contacts;
+}
+
+#endif
+
+PairKernel resolvePairKernel(PairKernel kernel) {
+#ifdef CONTACT_BLOCK_X86
+    __builtin_cpu_init();
+
+    const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool avx512 = __builtin_cpu_supports("avx512f");
+
+    switch (kernel) {
+        case PAIR_KERNEL_AUTO:
+            return avx512 ? PAIR_KERNEL_AVX512 : (avx2 ? PAIR_KERNEL_AVX2 : PAIR_KERNEL_SCALAR);
+        case PAIR_KERNEL_AVX512:
+            return avx512 ? PAIR_KERNEL_AVX512 : PAIR_KERNEL_SCALAR;
+        case PAIR_KERNEL_AVX2:
+            return avx2 ? PAIR_KERNEL_AVX2 : PAIR_KERNEL_SCALAR;
+        case PAIR_KERNEL_SCALAR:
+            return PAIR_KERNEL_SCALAR;
+    }
+#endif
+
+    return PAIR_KERNEL_SCALAR;
+}
+
+ContactBlockKernel getContactBlockKernel(PairKernel kernel) {
+    switch (resolvePairKernel(kernel)) {
+#ifdef CONTACT_BLOCK_X86
+        case PAIR_KERNEL_AVX512:
+            return contactBlockAvx512;
+        case PAIR_KERNEL_AVX2:
+            return contactBlockAvx2;
+#endif
+        default:
+            return contactBlockScalar;
+    }
+}
+
+const char *pairKernelName(PairKernel kernel) {
+    switch (kernel) {
+        case PAIR_KERNEL_AUTO:
+            return "auto";
+        case PAIR_KERNEL_SCALAR:
+            return "scalar";
+        case PAIR_KERNEL_AVX2:
+            return "avx2";
+        case PAIR_KERNEL_AVX512:
+            return "avx512";
+    }
+
+    return "unknown";
+}
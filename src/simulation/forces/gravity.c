@@ -5,6 +5,14 @@
  */
 
 
-void applyGravity(Particle* particle, V3 *gravity) {
-    particle->vel = add3(&particle->vel, gravity);
+void applyGravity(ParticleStore *particles, size_t begin, size_t end, const V3 *gravity) {
+    float *vx = particles->vx;
+    float *vy = particles->vy;
+    float *vz = particles->vz;
+
+    for (size_t i = begin; i < end; ++i) {
+        vx[i] += gravity->x;
+        vy[i] += gravity->y;
+        vz[i] += gravity->z;
+    }
 }
@@ -5,21 +5,26 @@
  */
 
 
-void handleRepulsion(Particle *a, Particle *b, float distance, float repulsion) {
-    float overlap = a->mass + b->mass - distance;
+void handleRepulsion(ParticleStore *particles, int a, int b, float distance, float repulsion) {
+    float overlap = particles->radius[a] + particles->radius[b] - distance;
 
     if (overlap > 0) {
         float force = overlap * repulsion;
 
-        V3 dif = sub3(&a->pos, &b->pos);
+        const float difX = particles->x[a] - particles->x[b];
+        const float difY = particles->y[a] - particles->y[b];
+        const float difZ = particles->z[a] - particles->z[b];
 
-        float norm = len3(&dif);
+        float norm = sqrtf(difX * difX + difY * difY + difZ * difZ);
 
-        const V3 normal = div3(&dif, norm);
+        const float scale = force / norm;
 
-        const V3 forceScaled = mul3(&normal, force);
+        particles->vx[a] += difX * scale;
+        particles->vy[a] += difY * scale;
+        particles->vz[a] += difZ * scale;
 
-        a->vel = add3(&a->vel, &forceScaled);
-        b->vel = sub3(&b->vel, &forceScaled);
+        particles->vx[b] -= difX * scale;
+        particles->vy[b] -= difY * scale;
+        particles->vz[b] -= difZ * scale;
     }
 }
@@ -0,0 +1,301 @@
+#include "simulation/forces/selfGravity.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SELF_GRAVITY_X86
+#endif
+
+// Pull on (x, y, z) of the entries [begin, end) of the leaf order, one at zero distance pulls nothing
+static inline void sumDirect(const Octree *tree, int begin, int end, float x, float y, float z, float softeningSq, float out[3]) {
+    float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+    for (int j = begin; j < end; ++j) {
+        const float dx = tree->x[j] - x;
+        const float dy = tree->y[j] - y;
+        const float dz = tree->z[j] - z;
+
+        const float distanceSq = dx * dx + dy * dy + dz * dz + softeningSq;
+        const float inverse = distanceSq > 0.0f ? 1.0f / sqrtf(distanceSq) : 0.0f;
+        const float scale = tree->mass[j] * inverse * inverse * inverse;
+
+        ax += dx * scale;
+        ay += dy * scale;
+        az += dz * scale;
+    }
+
+    out[0] += ax;
+    out[1] += ay;
+    out[2] += az;
+}
+
+// Pull of node through its monopole and quadrupole, r points from its centre of mass to the point
+static inline void sumMultipole(const OctreeNode *node, float rx, float ry, float rz, float softeningSq, float out[3]) {
+    const float *q = node->quadrupole;
+
+    const float inverseSq = 1.0f / (rx * rx + ry * ry + rz * rz + softeningSq);
+    const float inverse3 = inverseSq * sqrtf(inverseSq);
+    const float inverse5 = inverse3 * inverseSq;
+    const float inverse7 = inverse5 * inverseSq;
+
+    const float qx = q[0] * rx + q[1] * ry + q[2] * rz;
+    const float qy = q[1] * rx + q[3] * ry + q[4] * rz;
+    const float qz = q[2] * rx + q[4] * ry + q[5] * rz;
+    const float rqr = rx * qx + ry * qy + rz * qz;
+
+    const float radial = -node->mass * inverse3 - 2.5f * rqr * inverse7;
+
+    out[0] += rx * radial + qx * inverse5;
+    out[1] += ry * radial + qy * inverse5;
+    out[2] += rz * radial + qz * inverse5;
+}
+
+// One walk for the entries [begin, end) of the leaf order, at most OCTREE_LEAF_SIZE of them.
+// A node goes on the stack with the targets that have not accepted one of its ancestors
+static void pullGroup(Octree *tree, int begin, int end, float openingAngle, float softeningSq) {
+    const int count = end - begin;
+    const float *x = tree->x + begin;
+    const float *y = tree->y + begin;
+    const float *z = tree->z + begin;
+
+    float pull[OCTREE_LEAF_SIZE][3] = {{0.0f}};
+
+    // Depth first, a node pushes at most eight children per level
+    int stack[7 * OCTREE_MAX_DEPTH + 8];
+    unsigned masks[7 * OCTREE_MAX_DEPTH + 8];
+    int top = 0;
+
+    stack[top] = 0;
+    masks[top++] = (1u << count) - 1;
+
+    while (top > 0) {
+        top--;
+        const OctreeNode *node = &tree->nodes[stack[top]];
+        const float open = node->size / openingAngle + node->offset;
+        const float openSq = open * open;
+
+        unsigned remaining = 0;
+
+        for (int k = 0; k < count; ++k) {
+            if (!(masks[top] >> k & 1)) continue;
+
+            const float rx = x[k] - node->x;
+            const float ry = y[k] - node->y;
+            const float rz = z[k] - node->z;
+
+            if (rx * rx + ry * ry + rz * rz > openSq) {
+                sumMultipole(node, rx, ry, rz, softeningSq, pull[k]);
+            } else {
+                remaining |= 1u << k;
+            }
+        }
+
+        if (remaining == 0) continue;
+
+        if (node->childCount == 0) {
+            for (int k = 0; k < count; ++k) {
+                if (remaining >> k & 1) {
+                    sumDirect(tree, node->begin, node->end, x[k], y[k], z[k], softeningSq, pull[k]);
+                }
+            }
+            continue;
+        }
+
+        for (int c = 0; c < node->childCount; ++c) {
+            stack[top] = node->firstChild + c;
+            masks[top++] = remaining;
+        }
+    }
+
+    for (int k = 0; k < count; ++k) {
+        const int p = tree->index[begin + k];
+
+        tree->pullX[p] = pull[k][0];
+        tree->pullY[p] = pull[k][1];
+        tree->pullZ[p] = pull[k][2];
+    }
+}
+
+#ifdef SELF_GRAVITY_X86
+/**
+ * The walk of pullGroup with the targets as the eight lanes of a vector. A
+ * stack entry carries the lanes that still need its node as a mask, lanes
+ * past the end of the group start out of it.
+ */
+__attribute__((target("avx2,fma")))
+static void pullGroupAvx2(Octree *tree, int begin, int end, float openingAngle, float softeningSq) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(end - begin), lanes);
+
+    const __m256 x = _mm256_maskload_ps(tree->x + begin, valid);
+    const __m256 y = _mm256_maskload_ps(tree->y + begin, valid);
+    const __m256 z = _mm256_maskload_ps(tree->z + begin, valid);
+
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 softening = _mm256_set1_ps(softeningSq);
+
+    __m256 pullX = _mm256_setzero_ps();
+    __m256 pullY = _mm256_setzero_ps();
+    __m256 pullZ = _mm256_setzero_ps();
+
+    int stack[7 * OCTREE_MAX_DEPTH + 8];
+    __m256 masks[7 * OCTREE_MAX_DEPTH + 8];
+    int top = 0;
+
+    stack[top] = 0;
+    masks[top++] = _mm256_castsi256_ps(valid);
+
+    while (top > 0) {
+        top--;
+        const OctreeNode *node = &tree->nodes[stack[top]];
+        const __m256 mask = masks[top];
+
+        const float open = node->size / openingAngle + node->offset;
+
+        const __m256 rx = _mm256_sub_ps(x, _mm256_set1_ps(node->x));
+        const __m256 ry = _mm256_sub_ps(y, _mm256_set1_ps(node->y));
+        const __m256 rz = _mm256_sub_ps(z, _mm256_set1_ps(node->z));
+        const __m256 rSq = _mm256_fmadd_ps(rz, rz, _mm256_fmadd_ps(ry, ry, _mm256_mul_ps(rx, rx)));
+
+        const __m256 accepted = _mm256_and_ps(mask, _mm256_cmp_ps(rSq, _mm256_set1_ps(open * open), _CMP_GT_OQ));
+        const __m256 remaining = _mm256_andnot_ps(accepted, mask);
+
+        if (!_mm256_testz_ps(accepted, accepted)) {
+            const float *q = node->quadrupole;
+
+            // Lanes that do not accept divide by one and are masked out
+            const __m256 inverseSq = _mm256_div_ps(one, _mm256_blendv_ps(one, _mm256_add_ps(rSq, softening), accepted));
+            const __m256 inverse3 = _mm256_mul_ps(inverseSq, _mm256_sqrt_ps(inverseSq));
+            const __m256 inverse5 = _mm256_mul_ps(inverse3, inverseSq);
+            const __m256 inverse7 = _mm256_mul_ps(inverse5, inverseSq);
+
+            const __m256 qx = _mm256_fmadd_ps(_mm256_set1_ps(q[2]), rz, _mm256_fmadd_ps(_mm256_set1_ps(q[1]), ry, _mm256_mul_ps(_mm256_set1_ps(q[0]), rx)));
+            const __m256 qy = _mm256_fmadd_ps(_mm256_set1_ps(q[4]), rz, _mm256_fmadd_ps(_mm256_set1_ps(q[3]), ry, _mm256_mul_ps(_mm256_set1_ps(q[1]), rx)));
+            const __m256 qz = _mm256_fmadd_ps(_mm256_set1_ps(q[5]), rz, _mm256_fmadd_ps(_mm256_set1_ps(q[4]), ry, _mm256_mul_ps(_mm256_set1_ps(q[2]), rx)));
+            const __m256 rqr = _mm256_fmadd_ps(rz, qz, _mm256_fmadd_ps(ry, qy, _mm256_mul_ps(rx, qx)));
+
+            const __m256 radial = _mm256_and_ps(accepted, _mm256_fmsub_ps(_mm256_set1_ps(-node->mass), inverse3,
+                                                                          _mm256_mul_ps(_mm256_set1_ps(2.5f), _mm256_mul_ps(rqr, inverse7))));
+            const __m256 tangential = _mm256_and_ps(accepted, inverse5);
+
+            pullX = _mm256_fmadd_ps(qx, tangential, _mm256_fmadd_ps(rx, radial, pullX));
+            pullY = _mm256_fmadd_ps(qy, tangential, _mm256_fmadd_ps(ry, radial, pullY));
+            pullZ = _mm256_fmadd_ps(qz, tangential, _mm256_fmadd_ps(rz, radial, pullZ));
+        }
+
+        if (_mm256_testz_ps(remaining, remaining)) continue;
+
+        if (node->childCount == 0) {
+            for (int j = node->begin; j < node->end; ++j) {
+                const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(tree->x[j]), x);
+                const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(tree->y[j]), y);
+                const __m256 dz = _mm256_sub_ps(_mm256_set1_ps(tree->z[j]), z);
+
+                const __m256 distanceSq = _mm256_add_ps(_mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx))), softening);
+
+                // A particle at zero distance, itself, divides by one and is masked out
+                const __m256 pulls = _mm256_and_ps(remaining, _mm256_cmp_ps(distanceSq, _mm256_setzero_ps(), _CMP_GT_OQ));
+                const __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_blendv_ps(one, distanceSq, pulls)));
+                const __m256 scale = _mm256_and_ps(pulls, _mm256_mul_ps(_mm256_set1_ps(tree->mass[j]), _mm256_mul_ps(inverse, _mm256_mul_ps(inverse, inverse))));
+
+                pullX = _mm256_fmadd_ps(dx, scale, pullX);
+                pullY = _mm256_fmadd_ps(dy, scale, pullY);
+                pullZ = _mm256_fmadd_ps(dz, scale, pullZ);
+            }
+            continue;
+        }
+
+        for (int c = 0; c < node->childCount; ++c) {
+            stack[top] = node->firstChild + c;
+            masks[top++] = remaining;
+        }
+    }
+
+    float outX[8], outY[8], outZ[8];
+    _mm256_storeu_ps(outX, pullX);
+    _mm256_storeu_ps(outY, pullY);
+    _mm256_storeu_ps(outZ, pullZ);
+
+    for (int k = 0; k < end - begin; ++k) {
+        const int p = tree->index[begin + k];
+
+        tree->pullX[p] = outX[k];
+        tree->pullY[p] = outY[k];
+        tree->pullZ[p] = outZ[k];
+    }
+}
+#endif
+
+void computeSelfGravity(Octree *tree, size_t begin, size_t end, float openingAngle, float softening, PairKernel kernel) {
+    const float softeningSq = softening * softening;
+
+    // Groups have eight lanes, AVX-512 runs the AVX2 walk
+    void (*pull)(Octree*, int, int, float, float) = pullGroup;
+#ifdef SELF_GRAVITY_X86
+    if (kernel == PAIR_KERNEL_AVX2 || kernel == PAIR_KERNEL_AVX512) {
+        pull = pullGroupAvx2;
+    }
+#endif
+
+    for (size_t l = begin; l < end; ++l) {
+        const OctreeNode *leaf = &tree->nodes[tree->leaves[l]];
+
+        // Only leaves at OCTREE_MAX_DEPTH hold more than a group
+        for (int group = leaf->begin; group < leaf->end; group += OCTREE_LEAF_SIZE) {
+            const int groupEnd = group + OCTREE_LEAF_SIZE < leaf->end ? group + OCTREE_LEAF_SIZE : leaf->end;
+            pull(tree, group, groupEnd, openingAngle, softeningSq);
+        }
+    }
+}
+
+void applySelfGravity(const Octree *tree, ParticleStore *particles, size_t begin, size_t end, float strength) {
+    for (size_t i = begin; i < end; ++i) {
+        particles->vx[i] += strength * tree->pullX[i];
+        particles->vy[i] += strength * tree->pullY[i];
+        particles->vz[i] += strength * tree->pullZ[i];
+    }
+}
+
+void gravityAt(const Octree *tree, float x, float y, float z, float openingAngle, float softening, float out[3]) {
+    const float softeningSq = softening * softening;
+
+    out[0] = 0.0f;
+    out[1] = 0.0f;
+    out[2] = 0.0f;
+
+    if (tree->nodeCount == 0) return;
+
+    if (openingAngle <= 0.0f) {
+        sumDirect(tree, 0, (int)tree->count, x, y, z, softeningSq, out);
+        return;
+    }
+
+    int stack[7 * OCTREE_MAX_DEPTH + 8];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const OctreeNode *node = &tree->nodes[stack[--top]];
+
+        const float rx = x - node->x;
+        const float ry = y - node->y;
+        const float rz = z - node->z;
+        const float open = node->size / openingAngle + node->offset;
+
+        if (rx * rx + ry * ry + rz * rz > open * open) {
+            sumMultipole(node, rx, ry, rz, softeningSq, out);
+        } else if (node->childCount == 0) {
+            sumDirect(tree, node->begin, node->end, x, y, z, softeningSq, out);
+        } else {
+            for (int c = 0; c < node->childCount; ++c) {
+                stack[top++] = node->firstChild + c;
+            }
+        }
+    }
+}
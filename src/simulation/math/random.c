@@ -0,0 +1,22 @@
+#include "simulation/math/random.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+void seedRng(Rng *rng, uint64_t seed) {
+    rng->state = seed;
+}
+
+// SplitMix64
+uint64_t nextRng(Rng *rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+float randomFloat(Rng *rng) {
+    return (nextRng(rng) >> 40) * (1.0f / 16777216.0f);
+}
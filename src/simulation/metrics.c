@@ -0,0 +1,230 @@
+#include "simulation/metrics.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+
+static const char *PHASE_NAMES[] = {
+    "chunks",
+    "pairs",
+    "forces",
+    "integration",
+    "snapshot",
+    "exchange",
+    "population"
+};
+
+const char *metricPhaseName(MetricPhase phase) {
+    return PHASE_NAMES[phase];
+}
+
+static void clearMetrics(Metrics *metrics) {
+    const bool timed = metrics->timed;
+    const float chunkSize = metrics->chunkSize;
+    const double storeLocality = metrics->storeLocality;
+    const int substeps = metrics->substeps;
+
+    memset(metrics, 0, sizeof(Metrics));
+    metrics->timed = timed;
+    metrics->chunkSize = chunkSize;
+    metrics->storeLocality = storeLocality;
+    metrics->substeps = substeps;
+}
+
+void initMetrics(Domain *domain) {
+    const Config *config = &domain->config;
+
+    domain->metrics.timed = config->metrics;
+    domain->metrics.chunkSize = 0.0f;
+    domain->metrics.storeLocality = 0.0;
+    domain->metrics.substeps = config->supsampling;
+    clearMetrics(&domain->metrics);
+
+    domain->metricsLog.file = NULL;
+
+    if (config->metricsPath != NULL) {
+        openMetricsLog(domain, config->metricsPath, config->metricsInterval);
+    }
+}
+
+void openMetricsLog(Domain *domain, const char *path, int interval) {
+    MetricsLog *log = &domain->metricsLog;
+
+    closeMetricsLog(domain);
+
+    const size_t length = strlen(path);
+    log->format = length >= 4 && strcmp(path + length - 4, ".csv") == 0 ? METRICS_FORMAT_CSV : METRICS_FORMAT_JSON_LINES;
+    log->interval = interval > 0 ? interval : 1;
+    log->last = domain->metrics;
+
+    // A log without phase times is of little use
+    domain->metrics.timed = true;
+
+    log->file = fopen(path, "w");
+    if (log->file == NULL) {
+        fprintf(stderr, "Failed to open metrics file %s\n", path);
+        exit(1);
+    }
+
+    writeMetricsHeader(log->file, log->format);
+}
+
+void resetMetrics(Domain *domain) {
+    clearMetrics(&domain->metrics);
+    resetPairTasks(&domain->pairTasks, domain->config.threads > 1 ? domain->config.threads : 1);
+    domain->metricsLog.last = domain->metrics;
+}
+
+// Change of the counters since last, occupancy is a level and is taken as is
+static Metrics metricsWindow(const Metrics *now, const Metrics *last) {
+    Metrics window = *now;
+
+    window.steps -= last->steps;
+    window.particleSteps -= last->particleSteps;
+    window.frames -= last->frames;
+    window.pairTests -= last->pairTests;
+    window.pairHits -= last->pairHits;
+    window.chunkRebuilds -= last->chunkRebuilds;
+    window.chunkReallocs -= last->chunkReallocs;
+    window.chunkMovers -= last->chunkMovers;
+    window.chunkRetunes -= last->chunkRetunes;
+    window.reorders -= last->reorders;
+    window.emittedParticles -= last->emittedParticles;
+    window.removedParticles -= last->removedParticles;
+    window.refusedParticles -= last->refusedParticles;
+    window.pairBusySeconds -= last->pairBusySeconds;
+    window.pairIdleSeconds -= last->pairIdleSeconds;
+
+    for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+        window.phaseSeconds[phase] -= last->phaseSeconds[phase];
+    }
+
+    return window;
+}
+
+static void appendRecord(Domain *domain) {
+    MetricsLog *log = &domain->metricsLog;
+
+    const Metrics window = metricsWindow(&domain->metrics, &log->last);
+    writeMetricsRecord(log->file, log->format, &window, domain->metrics.steps);
+
+    domain->metrics.maxTravel = 0.0f;
+    domain->metrics.maxOverlap = 0.0f;
+    log->last = domain->metrics;
+}
+
+void recordStep(Domain *domain) {
+    const int workers = domain->config.threads > 1 ? domain->config.threads : 1;
+    float travel = 0.0f;
+    float overlap = 0.0f;
+
+    for (int w = 0; w < workers; ++w) {
+        travel = fmaxf(travel, domain->workerTravel[w]);
+        overlap = fmaxf(overlap, domain->workerOverlap[w]);
+        domain->workerTravel[w] = 0.0f;
+        domain->workerOverlap[w] = 0.0f;
+    }
+
+    domain->metrics.stepTravel = sqrtf(travel);
+    domain->metrics.stepOverlap = overlap;
+    domain->metrics.maxTravel = fmaxf(domain->metrics.maxTravel, domain->metrics.stepTravel);
+    domain->metrics.maxOverlap = fmaxf(domain->metrics.maxOverlap, overlap);
+    domain->metrics.liveParticles = domain->particles.count;
+    domain->metrics.particleSteps += domain->particles.count;
+    domain->metrics.steps++;
+
+    if (domain->metricsLog.file != NULL && domain->metrics.steps - domain->metricsLog.last.steps >= (size_t)domain->metricsLog.interval) {
+        appendRecord(domain);
+    }
+}
+
+void closeMetricsLog(Domain *domain) {
+    MetricsLog *log = &domain->metricsLog;
+
+    if (log->file == NULL) return;
+
+    if (domain->metrics.steps > log->last.steps) {
+        appendRecord(domain);
+    }
+
+    fclose(log->file);
+    log->file = NULL;
+}
+
+void measureOccupancy(Domain *domain) {
+    int maxOccupancy = 0;
+    size_t occupied = 0;
+    size_t particles = 0;
+
+    // Ghosts never hold particles, so the interior in store order covers every chunk of both grids
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        const int count = domain->chunks[domain->chunkOrder[c]].numParticles;
+
+        if (count == 0) continue;
+
+        maxOccupancy = count > maxOccupancy ? count : maxOccupancy;
+        occupied++;
+        particles += count;
+    }
+
+    domain->metrics.maxOccupancy = maxOccupancy;
+    domain->metrics.meanOccupancy = occupied > 0 ? (double)particles / occupied : 0.0;
+}
+
+void writeMetricsHeader(FILE *file, MetricsFormat format) {
+    if (format != METRICS_FORMAT_CSV) return;
+
+    fprintf(file, "step,steps,frames,substeps");
+
+    for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+        fprintf(file, ",%s_ms", PHASE_NAMES[phase]);
+    }
+
+    fprintf(file, ",pair_tests,pair_hits,hit_ratio,chunk_rebuilds,chunk_reallocs,chunk_movers,chunk_size,chunk_retunes,store_locality,reorders,max_occupancy,mean_occupancy,max_travel,max_overlap,sleeping_chunks,sleeping_particles,emitted,removed,refused,live_particles,pair_idle\n");
+}
+
+// Phase times are the mean per step of the window in milliseconds
+void writeMetricsRecord(FILE *file, MetricsFormat format, const Metrics *window, size_t step) {
+    const double steps = window->steps > 0 ? (double)window->steps : 1.0;
+    const double hitRatio = window->pairTests > 0 ? (double)window->pairHits / window->pairTests : 0.0;
+    const double pairSeconds = window->pairBusySeconds + window->pairIdleSeconds;
+    const double pairIdle = pairSeconds > 0 ? window->pairIdleSeconds / pairSeconds : 0.0;
+
+    if (format == METRICS_FORMAT_CSV) {
+        fprintf(file, "%zu,%zu,%zu,%d", step, window->steps, window->frames, window->substeps);
+
+        for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+            fprintf(file, ",%.6f", window->phaseSeconds[phase] * 1e3 / steps);
+        }
+
+        fprintf(file, ",%zu,%zu,%.6f,%zu,%zu,%zu,%.4f,%zu,%.3f,%zu,%d,%.3f,%.4f,%.4f,%zu,%zu,%zu,%zu,%zu,%zu,%.4f\n",
+                window->pairTests, window->pairHits, hitRatio,
+                window->chunkRebuilds, window->chunkReallocs, window->chunkMovers,
+                window->chunkSize, window->chunkRetunes,
+                window->storeLocality, window->reorders,
+                window->maxOccupancy, window->meanOccupancy,
+                window->maxTravel, window->maxOverlap,
+                window->sleepingChunks, window->sleepingParticles,
+                window->emittedParticles, window->removedParticles, window->refusedParticles, window->liveParticles, pairIdle);
+        return;
+    }
+
+    fprintf(file, "{\"step\": %zu, \"steps\": %zu, \"frames\": %zu, \"substeps\": %d", step, window->steps, window->frames, window->substeps);
+
+    for (int phase = 0; phase < METRIC_PHASE_COUNT; ++phase) {
+        fprintf(file, ", \"%s_ms\": %.6f", PHASE_NAMES[phase], window->phaseSeconds[phase] * 1e3 / steps);
+    }
+
+    fprintf(file, ", \"pair_tests\": %zu, \"pair_hits\": %zu, \"hit_ratio\": %.6f", window->pairTests, window->pairHits, hitRatio);
+    fprintf(file, ", \"chunk_rebuilds\": %zu, \"chunk_reallocs\": %zu, \"chunk_movers\": %zu", window->chunkRebuilds, window->chunkReallocs, window->chunkMovers);
+    fprintf(file, ", \"chunk_size\": %.4f, \"chunk_retunes\": %zu", window->chunkSize, window->chunkRetunes);
+    fprintf(file, ", \"store_locality\": %.3f, \"reorders\": %zu", window->storeLocality, window->reorders);
+    fprintf(file, ", \"max_occupancy\": %d, \"mean_occupancy\": %.3f", window->maxOccupancy, window->meanOccupancy);
+    fprintf(file, ", \"max_travel\": %.4f, \"max_overlap\": %.4f", window->maxTravel, window->maxOverlap);
+    fprintf(file, ", \"sleeping_chunks\": %zu, \"sleeping_particles\": %zu", window->sleepingChunks, window->sleepingParticles);
+    fprintf(file, ", \"emitted\": %zu, \"removed\": %zu, \"refused\": %zu, \"live_particles\": %zu",
+            window->emittedParticles, window->removedParticles, window->refusedParticles, window->liveParticles);
+    fprintf(file, ", \"pair_idle\": %.4f}\n", pairIdle);
+}
@@ -0,0 +1,465 @@
+#include "simulation/parallel/decomposition.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/step.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const float *axisPositions(const Domain *domain, int axis) {
+    const ParticleStore *store = &domain->particles;
+
+    return axis == 0 ? store->x : axis == 1 ? store->y : store->z;
+}
+
+// Chunk layer along the split axis of particle i
+static int particleLayer(const Decomposition *decomposition, const Domain *domain, size_t i) {
+    return axisPositions(domain, decomposition->axis)[i] / domain->chunkSize;
+}
+
+// Chunk layer along the split axis of a particle on the wire
+static int packedLayer(const Decomposition *decomposition, const Domain *domain, const PackedParticle *packed) {
+    const float position = decomposition->axis == 0 ? packed->x : decomposition->axis == 1 ? packed->y : packed->z;
+
+    return position / domain->chunkSize;
+}
+
+static void packParticle(const ParticleStore *store, size_t i, PackedParticle *packed) {
+    packed->x = store->x[i];
+    packed->y = store->y[i];
+    packed->z = store->z[i];
+    packed->vx = store->vx[i];
+    packed->vy = store->vy[i];
+    packed->vz = store->vz[i];
+    packed->radius = store->radius[i];
+    packed->id = store->id[i];
+    packed->col[0] = store->col[3 * i + 0];
+    packed->col[1] = store->col[3 * i + 1];
+    packed->col[2] = store->col[3 * i + 2];
+}
+
+static void unpackParticle(ParticleStore *store, size_t i, const PackedParticle *packed) {
+    store->x[i] = packed->x;
+    store->y[i] = packed->y;
+    store->z[i] = packed->z;
+    store->vx[i] = packed->vx;
+    store->vy[i] = packed->vy;
+    store->vz[i] = packed->vz;
+    store->radius[i] = packed->radius;
+    store->id[i] = packed->id;
+    store->col[3 * i + 0] = packed->col[0];
+    store->col[3 * i + 1] = packed->col[1];
+    store->col[3 * i + 2] = packed->col[2];
+}
+
+// Moves the whole store up by count places to make room at the front
+static void shiftParticles(ParticleStore *store, size_t count) {
+    float *arrays[] = {store->x, store->y, store->z, store->vx, store->vy, store->vz, store->radius};
+
+    for (int a = 0; a < 7; ++a) {
+        memmove(arrays[a] + count, arrays[a], store->count * sizeof(float));
+    }
+
+    memmove(store->id + count, store->id, store->count * sizeof(uint32_t));
+    memmove(store->col + 3 * count, store->col, 3 * store->count);
+}
+
+#define QUEUE_LOWER 0
+#define QUEUE_UPPER 1
+#define QUEUE_RELAY 2
+
+static void queueParticle(Decomposition *decomposition, int queue, const PackedParticle *packed) {
+    if (decomposition->queueCounts[queue] == decomposition->queueCapacities[queue]) {
+        decomposition->queueCapacities[queue] *= 2;
+        decomposition->queues[queue] = (PackedParticle*)realloc(decomposition->queues[queue], decomposition->queueCapacities[queue] * sizeof(PackedParticle));
+        if (decomposition->queues[queue] == NULL) {
+            fprintf(stderr, "Memory allocation failed for %zu queued particles\n", decomposition->queueCapacities[queue]);
+            exit(1);
+        }
+    }
+
+    decomposition->queues[queue][decomposition->queueCounts[queue]++] = *packed;
+}
+
+static void queueStoreParticle(Decomposition *decomposition, int queue, const ParticleStore *store, size_t i) {
+    PackedParticle packed;
+    packParticle(store, i, &packed);
+    queueParticle(decomposition, queue, &packed);
+}
+
+static void sendQueue(Decomposition *decomposition, int peer, int queue) {
+    const size_t bytes = decomposition->queueCounts[queue] * sizeof(PackedParticle);
+
+    sendMessage(decomposition->transport, peer, decomposition->queues[queue], bytes);
+    decomposition->bytes += bytes;
+    decomposition->queueCounts[queue] = 0;
+}
+
+static void reserveParticles(const Decomposition *decomposition, const Domain *domain, size_t count) {
+    if (domain->particles.count + count > domain->config.numParticles) {
+        fprintf(stderr, "Rank %d has no room for %zu more particles\n", decomposition->rank, count);
+        exit(1);
+    }
+}
+
+/**
+ * One pass of the migration along the chain of ranks, upwards (QUEUE_UPPER)
+ * or downwards (QUEUE_LOWER). Every rank waits for the particles coming from
+ * behind, keeps those that reached its slab and passes the others on with its
+ * own, so a particle may cross any number of slabs in one substep. Arrivals
+ * from below go in front of the store and those from above at its end, and
+ * particles that started further away stay further out. The store so keeps the
+ * order the ranks' stores have one after another.
+ */
+static void migrationPass(Decomposition *decomposition, Domain *domain, int direction) {
+    ParticleStore *store = &domain->particles;
+    const int rank = decomposition->rank;
+    const int first = decomposition->starts[rank];
+    const int last = decomposition->starts[rank + 1];
+    const bool upwards = direction == QUEUE_UPPER;
+
+    const int behind = upwards ? rank - 1 : rank + 1;
+    const int ahead = upwards ? rank + 1 : rank - 1;
+
+    // Going down the own particles are sent first, going up they are sent last
+    if (!upwards) {
+        decomposition->queueCounts[QUEUE_RELAY] = 0;
+
+        for (size_t k = 0; k < decomposition->queueCounts[direction]; ++k) {
+            queueParticle(decomposition, QUEUE_RELAY, &decomposition->queues[direction][k]);
+        }
+
+        decomposition->queueCounts[direction] = 0;
+    }
+
+    if (behind >= 0 && behind < decomposition->ranks) {
+        size_t bytes;
+        const PackedParticle *incoming = (const PackedParticle*)receiveMessage(decomposition->transport, behind, &bytes);
+        const size_t count = bytes / sizeof(PackedParticle);
+
+        size_t arrived = 0;
+        for (size_t k = 0; k < count; ++k) {
+            const int layer = packedLayer(decomposition, domain, &incoming[k]);
+            arrived += layer >= first && layer < last;
+        }
+
+        reserveParticles(decomposition, domain, arrived);
+
+        size_t at = store->count;
+        if (upwards) {
+            shiftParticles(store, arrived);
+            at = 0;
+        }
+
+        store->count += arrived;
+
+        for (size_t k = 0; k < count; ++k) {
+            const int layer = packedLayer(decomposition, domain, &incoming[k]);
+
+            if (layer >= first && layer < last) {
+                unpackParticle(store, at++, &incoming[k]);
+            } else {
+                queueParticle(decomposition, QUEUE_RELAY, &incoming[k]);
+            }
+        }
+    }
+
+    if (upwards) {
+        for (size_t k = 0; k < decomposition->queueCounts[direction]; ++k) {
+            queueParticle(decomposition, QUEUE_RELAY, &decomposition->queues[direction][k]);
+        }
+
+        decomposition->queueCounts[direction] = 0;
+    }
+
+    if (ahead >= 0 && ahead < decomposition->ranks) {
+        sendQueue(decomposition, ahead, QUEUE_RELAY);
+    }
+
+    decomposition->queueCounts[QUEUE_RELAY] = 0;
+}
+
+// Hands the particles that left the slab to the rank they moved into
+static void migrateParticles(Decomposition *decomposition, Domain *domain) {
+    ParticleStore *store = &domain->particles;
+    const int rank = decomposition->rank;
+    const int first = decomposition->starts[rank];
+    const int last = decomposition->starts[rank + 1];
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        const int layer = particleLayer(decomposition, domain, i);
+
+        if (layer >= first && layer < last) {
+            moveParticle(store, i, kept++);
+            continue;
+        }
+
+        queueStoreParticle(decomposition, layer < first ? QUEUE_LOWER : QUEUE_UPPER, store, i);
+        decomposition->migrants++;
+    }
+
+    store->count = kept;
+
+    migrationPass(decomposition, domain, QUEUE_UPPER);
+    migrationPass(decomposition, domain, QUEUE_LOWER);
+}
+
+// Sends copies of the outermost halo layers to the neighbours and appends theirs as ghosts
+static void exchangeHalo(Decomposition *decomposition, Domain *domain) {
+    ParticleStore *store = &domain->particles;
+    const int rank = decomposition->rank;
+    const int first = decomposition->starts[rank];
+    const int last = decomposition->starts[rank + 1];
+
+    for (size_t i = 0; i < store->count; ++i) {
+        const int layer = particleLayer(decomposition, domain, i);
+
+        if (rank > 0 && layer < first + DECOMPOSITION_HALO_LAYERS) {
+            queueStoreParticle(decomposition, QUEUE_LOWER, store, i);
+        }
+
+        if (rank < decomposition->ranks - 1 && layer >= last - DECOMPOSITION_HALO_LAYERS) {
+            queueStoreParticle(decomposition, QUEUE_UPPER, store, i);
+        }
+    }
+
+    // Lower neighbour first, the lower rank of a pair sends first, so the chain never waits on itself.
+    // Ghost layers hold nothing but ghosts, so where they go in the store does not matter
+    for (int queue = QUEUE_LOWER; queue <= QUEUE_UPPER; ++queue) {
+        const int peer = rank + (queue == QUEUE_LOWER ? -1 : 1);
+        if (peer < 0 || peer >= decomposition->ranks) continue;
+
+        const size_t bytes = decomposition->queueCounts[queue] * sizeof(PackedParticle);
+        size_t received;
+        const PackedParticle *incoming = (const PackedParticle*)exchangeMessage(decomposition->transport, peer, decomposition->queues[queue], bytes, &received);
+        const size_t count = received / sizeof(PackedParticle);
+
+        reserveParticles(decomposition, domain, count);
+
+        for (size_t k = 0; k < count; ++k) {
+            unpackParticle(store, store->count + k, &incoming[k]);
+        }
+
+        store->count += count;
+        decomposition->ghosts += count;
+        decomposition->bytes += bytes;
+        decomposition->queueCounts[queue] = 0;
+    }
+}
+
+// Drops the ghosts together with the velocity changes gathered for them
+static void dropGhosts(Decomposition *decomposition, Domain *domain) {
+    ParticleStore *store = &domain->particles;
+    const int first = decomposition->starts[decomposition->rank];
+    const int last = decomposition->starts[decomposition->rank + 1];
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        const int layer = particleLayer(decomposition, domain, i);
+        if (layer < first || layer >= last) continue;
+
+        moveParticle(store, i, kept);
+        domain->dvx[kept] = domain->dvx[i];
+        domain->dvy[kept] = domain->dvy[i];
+        domain->dvz[kept] = domain->dvz[i];
+        kept++;
+    }
+
+    store->count = kept;
+}
+
+// Cuts the layers where the particles of the full domain split evenly, at least a halo of layers per rank
+static void balanceSlabs(Decomposition *decomposition, const Domain *domain, int layers) {
+    const int ranks = decomposition->ranks;
+    const size_t count = domain->particles.count;
+
+    size_t *perLayer = (size_t*)calloc(layers, sizeof(size_t));
+    if (perLayer == NULL) {
+        fprintf(stderr, "Memory allocation failed for %d layer counts\n", layers);
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        perLayer[particleLayer(decomposition, domain, i)]++;
+    }
+
+    decomposition->starts[0] = 0;
+    decomposition->starts[ranks] = layers;
+
+    int layer = 0;
+    size_t below = 0;
+
+    for (int r = 1; r < ranks; ++r) {
+        const size_t target = count * r / ranks;
+
+        while (layer < layers - DECOMPOSITION_HALO_LAYERS * (ranks - r)
+               && (below < target || layer < decomposition->starts[r - 1] + DECOMPOSITION_HALO_LAYERS)) {
+            below += perLayer[layer++];
+        }
+
+        decomposition->starts[r] = layer;
+    }
+
+    free(perLayer);
+}
+
+Decomposition *createDecomposition(Domain *domain, Transport *transport) {
+    const Config *config = &domain->config;
+
+    // A rank only knows the particles of its slab, the pull of the others would be missing
+    if (config->chunkBuilder != CHUNK_BUILDER_SORTED || config->stencil != PAIR_STENCIL_FULL || config->neighbourSkin > 0
+        || config->selfGravity > 0) {
+        fprintf(stderr, "The decomposed step needs the sorted chunk builder, the full pair stencil, no neighbour lists and no self gravity\n");
+        exit(1);
+    }
+
+    // Every rank would hand out the same ids
+    if (config->emitterCount > 0 || config->sinkCount > 0) {
+        fprintf(stderr, "The decomposed step needs a fixed population, no emitters or sinks\n");
+        exit(1);
+    }
+
+    // The slabs are made of chunk layers
+    if (config->chunkSizing == CHUNK_SIZING_AUTO && config->chunkRetuneInterval > 0) {
+        fprintf(stderr, "The decomposed step needs a fixed chunk size, no retuning\n");
+        exit(1);
+    }
+
+    Decomposition *decomposition = (Decomposition*)malloc(sizeof(Decomposition));
+    if (decomposition == NULL) {
+        fprintf(stderr, "Memory allocation failed for decomposition\n");
+        exit(1);
+    }
+
+    decomposition->transport = transport;
+    decomposition->rank = transportRank(transport);
+    decomposition->ranks = transportRanks(transport);
+
+    // Thickest slabs along the axis with the most layers
+    decomposition->axis = 0;
+    for (int d = 1; d < 3; ++d) {
+        if (domain->chunkCounts[d] > domain->chunkCounts[decomposition->axis]) {
+            decomposition->axis = d;
+        }
+    }
+
+    const int layers = domain->chunkCounts[decomposition->axis];
+    if (decomposition->ranks * DECOMPOSITION_HALO_LAYERS > layers) {
+        fprintf(stderr, "%d ranks need at least %d chunk layers, the domain has %d\n", decomposition->ranks, decomposition->ranks * DECOMPOSITION_HALO_LAYERS, layers);
+        exit(1);
+    }
+
+    decomposition->starts = (int*)malloc((decomposition->ranks + 1) * sizeof(int));
+    if (decomposition->starts == NULL) {
+        fprintf(stderr, "Memory allocation failed for decomposition\n");
+        exit(1);
+    }
+
+    for (int queue = 0; queue < 3; ++queue) {
+        decomposition->queueCounts[queue] = 0;
+        decomposition->queueCapacities[queue] = 1024;
+        decomposition->queues[queue] = (PackedParticle*)malloc(decomposition->queueCapacities[queue] * sizeof(PackedParticle));
+        if (decomposition->queues[queue] == NULL) {
+            fprintf(stderr, "Memory allocation failed for decomposition\n");
+            exit(1);
+        }
+    }
+
+    balanceSlabs(decomposition, domain, layers);
+
+    decomposition->ghosts = 0;
+    decomposition->migrants = 0;
+    decomposition->bytes = 0;
+
+    // The gather leaves its results here, even without a pool
+    initSimultaneousContacts(domain);
+
+    return decomposition;
+}
+
+void destroyDecomposition(Decomposition *decomposition) {
+    free(decomposition->starts);
+    for (int queue = 0; queue < 3; ++queue) {
+        free(decomposition->queues[queue]);
+    }
+    free(decomposition);
+}
+
+void distributeParticles(Decomposition *decomposition, Domain *domain) {
+    ParticleStore *store = &domain->particles;
+    const int first = decomposition->starts[decomposition->rank];
+    const int last = decomposition->starts[decomposition->rank + 1];
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        const int layer = particleLayer(decomposition, domain, i);
+
+        if (layer >= first && layer < last) {
+            moveParticle(store, i, kept++);
+        }
+    }
+
+    store->count = kept;
+
+    // Nothing may point at the particles that are gone
+    domain->membershipValid = false;
+}
+
+void stepDecomposed(Decomposition *decomposition, Domain *domain) {
+    const double start = beginPhase(&domain->metrics);
+
+    migrateParticles(decomposition, domain);
+    exchangeHalo(decomposition, domain);
+
+    endPhase(&domain->metrics, METRIC_PHASE_EXCHANGE, start);
+
+    updateChunks(domain);
+    gatherContacts(domain);
+
+    dropGhosts(decomposition, domain);
+    applyGathered(domain);
+
+    recordStep(domain);
+}
+
+void collectParticles(Decomposition *decomposition, const Domain *domain, ParticleStore *global) {
+    const ParticleStore *store = &domain->particles;
+
+    if (decomposition->rank != 0) {
+        for (size_t i = 0; i < store->count; ++i) {
+            queueStoreParticle(decomposition, QUEUE_RELAY, store, i);
+        }
+
+        sendQueue(decomposition, 0, QUEUE_RELAY);
+        return;
+    }
+
+    // Rank order, with the sorted builder and slabs along x that is the order a single domain has
+    PackedParticle packed;
+    global->count = store->count;
+
+    for (size_t i = 0; i < store->count; ++i) {
+        packParticle(store, i, &packed);
+        unpackParticle(global, i, &packed);
+    }
+
+    for (int r = 1; r < decomposition->ranks; ++r) {
+        size_t bytes;
+        const PackedParticle *incoming = (const PackedParticle*)receiveMessage(decomposition->transport, r, &bytes);
+        const size_t count = bytes / sizeof(PackedParticle);
+
+        for (size_t k = 0; k < count; ++k) {
+            unpackParticle(global, global->count + k, &incoming[k]);
+        }
+
+        global->count += count;
+    }
+}
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include "simulation/parallel/numa.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Pages asked about per move_pages call
+#define PLACEMENT_BATCH 4096
+
+// Parses a sysfs cpu list such as "0-3,8,10-11" into a mask
+static void parseCpuList(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    while (*list >= '0' && *list <= '9') {
+        char *end;
+        const long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+static bool readNodeCpus(int node, cpu_set_t *set) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char list[4096];
+    const bool read = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+
+    if (read) {
+        parseCpuList(list, set);
+    }
+
+    return read;
+}
+
+void readNumaTopology(NumaTopology *topology) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+
+    const int allowedCount = CPU_COUNT(&allowed);
+
+    topology->cpus = (int*)malloc(allowedCount * sizeof(int));
+    topology->cpuNodes = (int*)malloc(allowedCount * sizeof(int));
+    if (topology->cpus == NULL || topology->cpuNodes == NULL) {
+        fprintf(stderr, "Memory allocation failed for the topology of %d cpus\n", allowedCount);
+        exit(1);
+    }
+
+    topology->nodeCount = 0;
+    topology->cpuCount = 0;
+
+    // Nodes are numbered densely on every machine we run on, the first gap ends the search
+    cpu_set_t nodeCpus;
+    for (int node = 0; node < NUMA_MAX_NODES && readNodeCpus(node, &nodeCpus); ++node) {
+        topology->nodeCount = node + 1;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &nodeCpus) && CPU_ISSET(cpu, &allowed) && topology->cpuCount < allowedCount) {
+                topology->cpus[topology->cpuCount] = cpu;
+                topology->cpuNodes[topology->cpuCount] = node;
+                topology->cpuCount++;
+            }
+        }
+    }
+
+    // No NUMA in sysfs, one node with everything
+    if (topology->cpuCount == 0) {
+        topology->nodeCount = 1;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE && topology->cpuCount < allowedCount; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                topology->cpus[topology->cpuCount] = cpu;
+                topology->cpuNodes[topology->cpuCount] = 0;
+                topology->cpuCount++;
+            }
+        }
+    }
+}
+
+void freeNumaTopology(NumaTopology *topology) {
+    free(topology->cpus);
+    free(topology->cpuNodes);
+}
+
+int workerCpu(const NumaTopology *topology, ThreadAffinity affinity, int worker) {
+    if (affinity == AFFINITY_NONE || topology->cpuCount == 0) return -1;
+
+    if (affinity == AFFINITY_COMPACT) {
+        return topology->cpus[worker % topology->cpuCount];
+    }
+
+    // Spread: the nodes with cpus take turns, each handing out its cpus in order
+    int nodes[NUMA_MAX_NODES];
+    int nodeCount = 0;
+
+    for (int c = 0; c < topology->cpuCount; ++c) {
+        if (c == 0 || topology->cpuNodes[c] != topology->cpuNodes[c - 1]) {
+            nodes[nodeCount++] = c;
+        }
+    }
+
+    const int node = worker % nodeCount;
+    const int first = nodes[node];
+    const int last = node + 1 < nodeCount ? nodes[node + 1] : topology->cpuCount;
+
+    return topology->cpus[first + (worker / nodeCount) % (last - first)];
+}
+
+int currentNode(void) {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return 0;
+
+    return (int)node;
+}
+
+// First entry of worker's share of count items
+static size_t shareBegin(size_t count, int worker, int workers) {
+    return count * worker / workers;
+}
+
+static int domainWorkers(const Domain *domain) {
+    return domain->pool != NULL ? threadPoolSize(domain->pool) : 1;
+}
+
+static void pinTask(void *context, size_t begin, size_t end, int worker) {
+    Domain *domain = (Domain*)context;
+    const int cpu = workerCpu(&domain->numa, domain->config.affinity, worker);
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            fprintf(stderr, "Warning: failed to pin worker %d to cpu %d\n", worker, cpu);
+        }
+    }
+
+    domain->workerNodes[worker] = currentNode();
+}
+
+// Writes every page of the range back as it is, which faults it in on the writer's node
+static void touchPages(void *data, size_t bytes) {
+    volatile char *bytesOf = (volatile char*)data;
+    const size_t page = sysconf(_SC_PAGESIZE);
+
+    for (size_t offset = 0; offset < bytes; offset += page) {
+        bytesOf[offset] = bytesOf[offset];
+    }
+}
+
+static void touchStore(ParticleStore *store, size_t begin, size_t end) {
+    float *arrays[] = {store->x, store->y, store->z, store->vx, store->vy, store->vz, store->radius};
+
+    for (int a = 0; a < 7; ++a) {
+        memset(arrays[a] + begin, 0, (end - begin) * sizeof(float));
+    }
+
+    memset(store->col + 3 * begin, 0, (end - begin) * 3 * sizeof(uint8_t));
+
+    for (size_t i = begin; i < end; ++i) {
+        store->id[i] = i;
+    }
+}
+
+static void touchTask(void *context, size_t begin, size_t end, int worker) {
+    Domain *domain = (Domain*)context;
+    const int workers = domainWorkers(domain);
+    const size_t capacity = domain->config.numParticles;
+
+    const size_t first = shareBegin(capacity, worker, workers);
+    const size_t last = shareBegin(capacity, worker + 1, workers);
+
+    touchStore(&domain->particles, first, last);
+
+    if (domain->sortBuffer.x != NULL) {
+        touchStore(&domain->sortBuffer, first, last);
+    }
+
+    float *accumulators[] = {domain->dvx, domain->dvy, domain->dvz};
+    for (int a = 0; a < 3; ++a) {
+        if (accumulators[a] != NULL) {
+            touchPages(accumulators[a] + first, (last - first) * sizeof(float));
+        }
+    }
+
+    if (domain->contactCounts != NULL) {
+        touchPages(domain->contactCounts + first, (last - first) * sizeof(uint16_t));
+    }
+
+    if (domain->calmSteps != NULL) {
+        touchPages(domain->calmSteps + first, (last - first) * sizeof(float));
+        touchPages(domain->calmBuffer + first, (last - first) * sizeof(float));
+    }
+
+    if (domain->sortDestination != NULL) {
+        touchPages(domain->sortDestination + first, (last - first) * sizeof(int));
+        touchPages(domain->particleChunks + first, (last - first) * sizeof(Chunk*));
+    }
+
+    // The sparse grid grows as it goes and is left to the thread that sorts
+    if (domain->sparse == NULL) {
+        const size_t chunks = (size_t)(domain->chunkCounts[0] + 2) * (domain->chunkCounts[1] + 2) * (domain->chunkCounts[2] + 2);
+        const size_t chunkFirst = shareBegin(chunks, worker, workers);
+        const size_t chunkLast = shareBegin(chunks, worker + 1, workers);
+
+        touchPages(domain->chunks + chunkFirst, (chunkLast - chunkFirst) * sizeof(Chunk));
+    }
+}
+
+void placeDomain(Domain *domain) {
+    const Config *config = &domain->config;
+    const int workers = domainWorkers(domain);
+
+    readNumaTopology(&domain->numa);
+
+    domain->workerNodes = (int*)malloc(workers * sizeof(int));
+    if (domain->workerNodes == NULL) {
+        fprintf(stderr, "Memory allocation failed for the nodes of %d workers\n", workers);
+        exit(1);
+    }
+
+    if (domain->pool != NULL) {
+        runOnWorkers(domain->pool, pinTask, domain);
+    } else {
+        pinTask(domain, 0, 1, 0);
+    }
+
+    if (!config->numaFirstTouch) return;
+
+    if (domain->pool != NULL) {
+        runOnWorkers(domain->pool, touchTask, domain);
+        setThreadPoolShares(domain->pool, true);
+    } else {
+        touchTask(domain, 0, 1, 0);
+    }
+}
+
+// Bytes of [data, data + bytes) on node, or on any for -1, and with placed set adds every page to the node it is on
+static size_t countPages(const void *data, size_t bytes, int node, size_t *placed) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)data / page * page;
+    const uintptr_t end = (uintptr_t)data + bytes;
+
+    void *pages[PLACEMENT_BATCH];
+    int status[PLACEMENT_BATCH];
+    size_t onNode = 0;
+
+    for (uintptr_t address = start; address < end;) {
+        unsigned long count = 0;
+        for (; count < PLACEMENT_BATCH && address < end; ++count, address += page) {
+            pages[count] = (void*)address;
+        }
+
+        // Without target nodes move_pages only reports where every page is
+        if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) return 0;
+
+        for (unsigned long p = 0; p < count; ++p) {
+            // Pages never touched report -ENOENT
+            if (status[p] < 0 || status[p] >= NUMA_MAX_NODES) continue;
+
+            onNode += node < 0 || status[p] == node ? page : 0;
+            if (placed != NULL) {
+                placed[status[p]] += page;
+            }
+        }
+    }
+
+    return onNode;
+}
+
+static size_t countStore(const ParticleStore *store, size_t begin, size_t end, int node, size_t *placed) {
+    const float *arrays[] = {store->x, store->y, store->z, store->vx, store->vy, store->vz, store->radius};
+    size_t onNode = 0;
+
+    for (int a = 0; a < 7; ++a) {
+        onNode += countPages(arrays[a] + begin, (end - begin) * sizeof(float), node, placed);
+    }
+
+    onNode += countPages(store->col + 3 * begin, (end - begin) * 3 * sizeof(uint8_t), node, placed);
+    onNode += countPages(store->id + begin, (end - begin) * sizeof(uint32_t), node, placed);
+
+    return onNode;
+}
+
+NumaPlacement measurePlacement(const Domain *domain) {
+    NumaPlacement placement = {{0}, 0.0};
+
+    const int workers = domainWorkers(domain);
+    const size_t capacity = domain->config.numParticles;
+
+    // Pages on the border of two shares count for both workers
+    size_t local = 0;
+    size_t total = 0;
+
+    for (int w = 0; w < workers; ++w) {
+        const size_t first = shareBegin(capacity, w, workers);
+        const size_t last = shareBegin(capacity, w + 1, workers);
+
+        local += countStore(&domain->particles, first, last, domain->workerNodes[w], NULL);
+        total += countStore(&domain->particles, first, last, -1, NULL);
+    }
+
+    countStore(&domain->particles, 0, capacity, -1, placement.bytes);
+
+    if (domain->sortBuffer.x != NULL) {
+        countStore(&domain->sortBuffer, 0, capacity, -1, placement.bytes);
+    }
+
+    if (domain->sparse == NULL) {
+        const size_t chunks = (size_t)(domain->chunkCounts[0] + 2) * (domain->chunkCounts[1] + 2) * (domain->chunkCounts[2] + 2);
+        countPages(domain->chunks, chunks * sizeof(Chunk), -1, placement.bytes);
+    }
+
+    placement.local = total > 0 ? (double)local / total : 0.0;
+
+    return placement;
+}
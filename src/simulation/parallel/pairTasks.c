@@ -0,0 +1,195 @@
+#include "simulation/parallel/pairTasks.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include "simulation/containers/domain.h"
+
+// Blocks of the cost pass handed to one worker at a time
+#define COST_GRAIN_BLOCKS 4
+
+// One pass of runPairTasks
+typedef struct {
+    Domain *domain;
+    size_t count;
+    PairEntryChunk entryChunk;
+    const void *entries;
+    ParallelTask task;
+    void *context;
+} PairPass;
+
+static int domainWorkers(const Domain *domain) {
+    return domain->pool != NULL ? threadPoolSize(domain->pool) : 1;
+}
+
+void initPairTasks(PairTasks *tasks, int workers) {
+    tasks->costs = NULL;
+    tasks->blockCosts = NULL;
+    tasks->capacity = 0;
+    tasks->taskCount = 0;
+
+    tasks->bounds = (size_t*)malloc((workers * PAIR_TASKS_PER_WORKER + 1) * sizeof(size_t));
+    tasks->busySeconds = (double*)calloc(workers, sizeof(double));
+    tasks->idleSeconds = (double*)calloc(workers, sizeof(double));
+    if (tasks->bounds == NULL || tasks->busySeconds == NULL || tasks->idleSeconds == NULL) {
+        fprintf(stderr, "Memory allocation failed for the pair tasks of %d workers\n", workers);
+        exit(1);
+    }
+}
+
+void freePairTasks(PairTasks *tasks) {
+    free(tasks->costs);
+    free(tasks->blockCosts);
+    free(tasks->bounds);
+    free(tasks->busySeconds);
+    free(tasks->idleSeconds);
+}
+
+void resetPairTasks(PairTasks *tasks, int workers) {
+    for (int w = 0; w < workers; ++w) {
+        tasks->busySeconds[w] = 0.0;
+        tasks->idleSeconds[w] = 0.0;
+    }
+}
+
+size_t estimatePairWork(const Domain *domain, const Chunk *chunk) {
+    if (chunk->numParticles == 0) return 0;
+
+    size_t partners = chunk->numParticles;
+
+    for (int n = 0; n < 26; ++n) {
+        partners += neighbourChunk(domain, chunk, n)->numParticles;
+    }
+
+    return (size_t)chunk->numParticles * partners;
+}
+
+static void costTask(void *context, size_t begin, size_t end, int worker) {
+    const PairPass *pass = (const PairPass*)context;
+    PairTasks *tasks = &pass->domain->pairTasks;
+
+    for (size_t b = begin; b < end; ++b) {
+        const size_t first = b * PAIR_COST_GRAIN;
+        const size_t last = first + PAIR_COST_GRAIN < pass->count ? first + PAIR_COST_GRAIN : pass->count;
+        size_t blockCost = 0;
+
+        for (size_t e = first; e < last; ++e) {
+            tasks->costs[e] = estimatePairWork(pass->domain, pass->entryChunk(pass->entries, e));
+            blockCost += tasks->costs[e];
+        }
+
+        tasks->blockCosts[b] = blockCost;
+    }
+}
+
+// Estimates every entry in parallel, then cuts where the running sum passes each multiple of the total over the tasks
+static void planTasks(const PairPass *pass) {
+    Domain *domain = pass->domain;
+    PairTasks *tasks = &domain->pairTasks;
+    const size_t count = pass->count;
+    const size_t blocks = (count + PAIR_COST_GRAIN - 1) / PAIR_COST_GRAIN;
+
+    if (count > tasks->capacity) {
+        tasks->capacity = count + count / 2;
+        tasks->costs = (size_t*)realloc(tasks->costs, tasks->capacity * sizeof(size_t));
+        tasks->blockCosts = (size_t*)realloc(tasks->blockCosts, (tasks->capacity / PAIR_COST_GRAIN + 1) * sizeof(size_t));
+        if (tasks->costs == NULL || tasks->blockCosts == NULL) {
+            fprintf(stderr, "Memory allocation failed for the pair costs of %zu chunks\n", count);
+            exit(1);
+        }
+    }
+
+    parallelFor(domain->pool, blocks, COST_GRAIN_BLOCKS, costTask, (void*)pass);
+
+    size_t total = 0;
+    for (size_t b = 0; b < blocks; ++b) {
+        total += tasks->blockCosts[b];
+    }
+
+    const size_t taskCount = (size_t)domainWorkers(domain) * PAIR_TASKS_PER_WORKER;
+    tasks->taskCount = taskCount;
+    tasks->bounds[0] = 0;
+
+    // Nothing to weigh, an even split does as well as any
+    if (total == 0) {
+        for (size_t t = 1; t <= taskCount; ++t) {
+            tasks->bounds[t] = count * t / taskCount;
+        }
+        return;
+    }
+
+    size_t t = 1;
+    size_t sum = 0;
+
+    for (size_t b = 0; b < blocks && t < taskCount; ++b) {
+        // Whole blocks before the next cut are skipped
+        if (sum + tasks->blockCosts[b] < total * t / taskCount) {
+            sum += tasks->blockCosts[b];
+            continue;
+        }
+
+        const size_t last = (b + 1) * PAIR_COST_GRAIN < count ? (b + 1) * PAIR_COST_GRAIN : count;
+
+        for (size_t e = b * PAIR_COST_GRAIN; e < last; ++e) {
+            sum += tasks->costs[e];
+
+            while (t < taskCount && sum >= total * t / taskCount) {
+                tasks->bounds[t++] = e + 1;
+            }
+        }
+    }
+
+    for (; t <= taskCount; ++t) {
+        tasks->bounds[t] = count;
+    }
+}
+
+static void timedTask(void *context, size_t begin, size_t end, int worker) {
+    const PairPass *pass = (const PairPass*)context;
+    PairTasks *tasks = &pass->domain->pairTasks;
+
+    const double start = metricsClock();
+    pass->task(pass->context, begin, end, worker);
+    const double seconds = metricsClock() - start;
+
+    // The whole pass is added to idle once it is over
+    tasks->busySeconds[worker] += seconds;
+    tasks->idleSeconds[worker] -= seconds;
+}
+
+void runPairTasks(Domain *domain, size_t count, size_t grain, PairEntryChunk entryChunk, const void *entries, ParallelTask task, void *context) {
+    if (count == 0) return;
+
+    PairPass pass = {domain, count, entryChunk, entries, task, context};
+    PairTasks *tasks = &domain->pairTasks;
+
+    const bool timed = domain->metrics.timed;
+    const ParallelTask run = timed ? timedTask : task;
+    void *runContext = timed ? (void*)&pass : context;
+    const double start = timed ? metricsClock() : 0.0;
+
+    if (domain->pool == NULL) {
+        run(runContext, 0, count, 0);
+    } else if (domain->config.pairSchedule == PAIR_SCHEDULE_WEIGHTED && entryChunk != NULL) {
+        planTasks(&pass);
+        parallelForTasks(domain->pool, tasks->bounds, tasks->taskCount, run, runContext);
+    } else {
+        parallelFor(domain->pool, count, grain, run, runContext);
+    }
+
+    if (!timed) return;
+
+    const int workers = domainWorkers(domain);
+    const double seconds = metricsClock() - start;
+
+    domain->metrics.pairBusySeconds = 0.0;
+    domain->metrics.pairIdleSeconds = 0.0;
+
+    for (int w = 0; w < workers; ++w) {
+        tasks->idleSeconds[w] += seconds;
+
+        domain->metrics.pairBusySeconds += tasks->busySeconds[w];
+        domain->metrics.pairIdleSeconds += tasks->idleSeconds[w];
+    }
+}
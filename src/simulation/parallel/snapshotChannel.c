@@ -0,0 +1,112 @@
+#include "simulation/parallel/snapshotChannel.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Set in the middle index while it holds a frame the consumer has not taken
+#define SNAPSHOT_FRESH 4u
+#define SNAPSHOT_INDEX 3u
+
+struct SnapshotChannel {
+    Snapshot buffers[3];
+
+    // Only the producer touches back, only the consumer touches front
+    unsigned back;
+    unsigned front;
+    atomic_uint middle;
+
+    // Particles every buffer has room for, a frame holds the live ones
+    size_t capacity;
+
+    atomic_uint_least64_t published;
+    atomic_uint_least64_t dropped;
+};
+
+SnapshotChannel *createSnapshotChannel(size_t count) {
+    SnapshotChannel *channel = (SnapshotChannel*)malloc(sizeof(SnapshotChannel));
+    if (channel == NULL) {
+        fprintf(stderr, "Memory allocation failed for snapshot channel\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        Snapshot *buffer = &channel->buffers[i];
+
+        buffer->particles = (Particle*)malloc(count * sizeof(Particle));
+        if (buffer->particles == NULL) {
+            fprintf(stderr, "Memory allocation failed for snapshot of %zu particles\n", count);
+            exit(1);
+        }
+
+        buffer->count = 0;
+        buffer->frame = 0;
+    }
+
+    channel->capacity = count;
+
+    channel->back = 0;
+    channel->front = 1;
+    atomic_init(&channel->middle, 2u);
+    atomic_init(&channel->published, 0);
+    atomic_init(&channel->dropped, 0);
+
+    return channel;
+}
+
+void destroySnapshotChannel(SnapshotChannel *channel) {
+    for (int i = 0; i < 3; ++i) {
+        free(channel->buffers[i].particles);
+    }
+
+    free(channel);
+}
+
+size_t snapshotCapacity(const SnapshotChannel *channel) {
+    return channel->capacity;
+}
+
+void publishSnapshot(SnapshotChannel *channel, const ParticleStore *particles, const Config *config) {
+    Snapshot *buffer = &channel->buffers[channel->back];
+
+    if (particles->count > channel->capacity) {
+        fprintf(stderr, "Snapshot of %zu particles published into a channel of %zu\n", particles->count, channel->capacity);
+        exit(1);
+    }
+
+    exportParticles(particles, buffer->particles);
+    buffer->count = particles->count;
+    buffer->config = *config;
+    buffer->frame = atomic_load_explicit(&channel->published, memory_order_relaxed) + 1;
+
+    // Release the frame, acquire whatever the consumer left in the middle
+    const unsigned previous = atomic_exchange_explicit(&channel->middle, channel->back | SNAPSHOT_FRESH, memory_order_acq_rel);
+    channel->back = previous & SNAPSHOT_INDEX;
+
+    if (previous & SNAPSHOT_FRESH) {
+        atomic_fetch_add_explicit(&channel->dropped, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&channel->published, 1, memory_order_relaxed);
+}
+
+const Snapshot *acquireSnapshot(SnapshotChannel *channel) {
+    if (!(atomic_load_explicit(&channel->middle, memory_order_relaxed) & SNAPSHOT_FRESH)) return NULL;
+
+    const unsigned previous = atomic_exchange_explicit(&channel->middle, channel->front, memory_order_acq_rel);
+    channel->front = previous & SNAPSHOT_INDEX;
+
+    return &channel->buffers[channel->front];
+}
+
+uint64_t snapshotsPublished(const SnapshotChannel *channel) {
+    return atomic_load_explicit(&channel->published, memory_order_relaxed);
+}
+
+uint64_t snapshotsDropped(const SnapshotChannel *channel) {
+    return atomic_load_explicit(&channel->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,280 @@
+#include "simulation/parallel/threadPool.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} Worker;
+
+/**
+ * Items of one worker's share, on a cache line of its own. Begin and end are
+ * packed into one word, the owner takes blocks from the front and the others
+ * steal from the back, so the owner keeps working through what it touched
+ * last time and a thief only takes what the owner would have reached last.
+ */
+typedef struct {
+    _Atomic uint64_t range;
+    char padding[64 - sizeof(uint64_t)];
+} Share;
+
+static uint64_t packRange(size_t begin, size_t end) {
+    return (uint64_t)end << 32 | begin;
+}
+
+struct ThreadPool {
+    int size;
+    pthread_t *threads;
+    Worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    // Current job, guarded by lock except for the atomic cursor
+    unsigned long generation;
+    int busy;
+    bool stop;
+
+    ParallelTask task;
+    void *context;
+    size_t count;
+    size_t grain;
+    atomic_size_t next;
+
+    // runOnWorkers: every worker runs the task once for its own index
+    bool once;
+
+    // Set by setThreadPoolShares, every worker starts on shares[worker]
+    bool sharing;
+    Share *shares;
+
+    // parallelForTasks: item t is the range [bounds[t], bounds[t + 1]), always run in shares
+    const size_t *bounds;
+    bool sharedJob;
+};
+
+// Takes a block of up to grain items from the front or the back of the share, false once it is empty
+static bool takeBlock(Share *share, size_t grain, bool front, size_t *begin, size_t *end) {
+    uint64_t range = atomic_load_explicit(&share->range, memory_order_relaxed);
+
+    while (true) {
+        const size_t first = range & UINT32_MAX;
+        const size_t last = range >> 32;
+        if (first >= last) return false;
+
+        *begin = front || last - first <= grain ? first : last - grain;
+        *end = !front || last - first <= grain ? last : first + grain;
+
+        const uint64_t rest = front ? packRange(*end, last) : packRange(first, *begin);
+        if (atomic_compare_exchange_weak_explicit(&share->range, &range, rest, memory_order_relaxed, memory_order_relaxed)) return true;
+    }
+}
+
+// Blocks of the share until it is used up, by its owner or by the others once they are done with theirs
+static void runShare(ThreadPool *pool, Share *share, bool own, int worker) {
+    size_t begin, end;
+
+    while (takeBlock(share, pool->grain, own, &begin, &end)) {
+        // Neighbouring tasks are one range, so a block of them is handed over in one go
+        if (pool->bounds != NULL) {
+            pool->task(pool->context, pool->bounds[begin], pool->bounds[end], worker);
+        } else {
+            pool->task(pool->context, begin, end, worker);
+        }
+    }
+}
+
+static void runBlocks(ThreadPool *pool, int worker) {
+    if (pool->once) {
+        pool->task(pool->context, worker, worker + 1, worker);
+        return;
+    }
+
+    if (pool->sharedJob) {
+        for (int s = 0; s < pool->size; ++s) {
+            runShare(pool, &pool->shares[(worker + s) % pool->size], s == 0, worker);
+        }
+        return;
+    }
+
+    while (true) {
+        const size_t begin = atomic_fetch_add_explicit(&pool->next, pool->grain, memory_order_relaxed);
+        if (begin >= pool->count) break;
+
+        const size_t end = begin + pool->grain < pool->count ? begin + pool->grain : pool->count;
+        pool->task(pool->context, begin, end, worker);
+    }
+}
+
+static void *workerMain(void *argument) {
+    Worker *worker = (Worker*)argument;
+    ThreadPool *pool = worker->pool;
+
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+
+        if (pool->stop) break;
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runBlocks(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ThreadPool *createThreadPool(int threads) {
+    if (threads < 1) threads = 1;
+
+    ThreadPool *pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        fprintf(stderr, "Memory allocation failed for thread pool\n");
+        exit(1);
+    }
+
+    pool->size = threads;
+    pool->threads = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    pool->workers = (Worker*)malloc(threads * sizeof(Worker));
+    if (pool->threads == NULL || pool->workers == NULL) {
+        fprintf(stderr, "Memory allocation failed for %d workers\n", threads);
+        exit(1);
+    }
+
+    pool->shares = (Share*)aligned_alloc(64, threads * sizeof(Share));
+    if (pool->shares == NULL) {
+        fprintf(stderr, "Memory allocation failed for the shares of %d workers\n", threads);
+        exit(1);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next, 0);
+
+    for (int i = 1; i < threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+
+        if (pthread_create(&pool->threads[i], NULL, workerMain, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    return pool;
+}
+
+void destroyThreadPool(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->size; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->shares);
+    free(pool);
+}
+
+int threadPoolSize(const ThreadPool *pool) {
+    return pool->size;
+}
+
+void setThreadPoolShares(ThreadPool *pool, bool sharing) {
+    pool->sharing = sharing;
+}
+
+// Hands the job to the workers, takes part as worker 0 and returns once all are done
+static void runJob(ThreadPool *pool, size_t count, size_t grain, bool once, const size_t *bounds, ParallelTask task, void *context) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->count = count;
+    pool->grain = grain;
+    pool->once = once;
+    pool->bounds = bounds;
+    atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+
+    // Shares hold 32 bit indices, anything larger goes to whoever asks next
+    pool->sharedJob = (pool->sharing || bounds != NULL) && count <= UINT32_MAX;
+
+    for (int w = 0; w < pool->size && pool->sharedJob; ++w) {
+        atomic_store_explicit(&pool->shares[w].range, packRange(count * w / pool->size, count * (w + 1) / pool->size), memory_order_relaxed);
+    }
+
+    pool->busy = pool->size - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    runBlocks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void parallelFor(ThreadPool *pool, size_t count, size_t grain, ParallelTask task, void *context) {
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+
+    // Not worth waking anyone up
+    if (pool->size == 1 || count <= grain) {
+        task(context, 0, count, 0);
+        return;
+    }
+
+    runJob(pool, count, grain, false, NULL, task, context);
+}
+
+void parallelForTasks(ThreadPool *pool, const size_t *bounds, size_t tasks, ParallelTask task, void *context) {
+    if (tasks == 0) return;
+
+    if (pool->size == 1 || tasks == 1) {
+        task(context, bounds[0], bounds[tasks], 0);
+        return;
+    }
+
+    runJob(pool, tasks, 1, false, bounds, task, context);
+}
+
+void runOnWorkers(ThreadPool *pool, ParallelTask task, void *context) {
+    if (pool->size == 1) {
+        task(context, 0, 1, 0);
+        return;
+    }
+
+    runJob(pool, pool->size, 1, true, NULL, task, context);
+}
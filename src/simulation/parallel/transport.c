@@ -0,0 +1,344 @@
+#include "simulation/parallel/transport.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Bytes in flight from one rank to another before the sender waits
+#define SHARED_RING_BYTES (1 << 20)
+
+// What a backend has to provide: blocking byte streams to every peer
+typedef struct {
+    void (*attach)(Transport *transport);
+    void (*write)(Transport *transport, int peer, const void *data, size_t bytes);
+    void (*read)(Transport *transport, int peer, void *data, size_t bytes);
+    void (*destroy)(Transport *transport);
+} TransportOps;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // Bytes written and read so far
+    size_t head;
+    size_t tail;
+
+    unsigned char data[SHARED_RING_BYTES];
+} SharedRing;
+
+struct Transport {
+    TransportKind kind;
+    const TransportOps *ops;
+    int rank;
+    int ranks;
+
+    // TRANSPORT_SHARED_MEMORY: ring from a to b is rings[a * ranks + b]
+    SharedRing *rings;
+    size_t ringBytes;
+
+    // TRANSPORT_SOCKETS: end of a towards b is sockets[a * ranks + b]
+    int *sockets;
+
+    // Holds the last received message
+    void *buffer;
+    size_t capacity;
+};
+
+static void sharedWrite(Transport *transport, int peer, const void *data, size_t bytes) {
+    SharedRing *ring = &transport->rings[transport->rank * transport->ranks + peer];
+    const unsigned char *source = (const unsigned char*)data;
+
+    while (bytes > 0) {
+        pthread_mutex_lock(&ring->lock);
+        while (ring->head - ring->tail == SHARED_RING_BYTES) {
+            pthread_cond_wait(&ring->changed, &ring->lock);
+        }
+
+        // Up to the free space or the end of the ring, whichever comes first
+        const size_t offset = ring->head % SHARED_RING_BYTES;
+        size_t chunk = SHARED_RING_BYTES - (ring->head - ring->tail);
+        if (chunk > SHARED_RING_BYTES - offset) chunk = SHARED_RING_BYTES - offset;
+        if (chunk > bytes) chunk = bytes;
+
+        memcpy(ring->data + offset, source, chunk);
+        ring->head += chunk;
+
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+
+        source += chunk;
+        bytes -= chunk;
+    }
+}
+
+static void sharedRead(Transport *transport, int peer, void *data, size_t bytes) {
+    SharedRing *ring = &transport->rings[peer * transport->ranks + transport->rank];
+    unsigned char *target = (unsigned char*)data;
+
+    while (bytes > 0) {
+        pthread_mutex_lock(&ring->lock);
+        while (ring->head == ring->tail) {
+            pthread_cond_wait(&ring->changed, &ring->lock);
+        }
+
+        const size_t offset = ring->tail % SHARED_RING_BYTES;
+        size_t chunk = ring->head - ring->tail;
+        if (chunk > SHARED_RING_BYTES - offset) chunk = SHARED_RING_BYTES - offset;
+        if (chunk > bytes) chunk = bytes;
+
+        memcpy(target, ring->data + offset, chunk);
+        ring->tail += chunk;
+
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+
+        target += chunk;
+        bytes -= chunk;
+    }
+}
+
+// Every rank maps all rings and only ever touches its own
+static void sharedAttach(Transport *transport) {
+}
+
+static void sharedDestroy(Transport *transport) {
+    munmap(transport->rings, transport->ringBytes);
+}
+
+static void createSharedRings(Transport *transport) {
+    const int ranks = transport->ranks;
+
+    // Anonymous and shared, so every forked rank sees the same rings
+    transport->ringBytes = (size_t)ranks * ranks * sizeof(SharedRing);
+    transport->rings = (SharedRing*)mmap(NULL, transport->ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (transport->rings == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %zu bytes of shared memory for %d ranks\n", transport->ringBytes, ranks);
+        exit(1);
+    }
+
+    pthread_mutexattr_t mutexAttributes;
+    pthread_mutexattr_init(&mutexAttributes);
+    pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+
+    pthread_condattr_t condAttributes;
+    pthread_condattr_init(&condAttributes);
+    pthread_condattr_setpshared(&condAttributes, PTHREAD_PROCESS_SHARED);
+
+    for (int r = 0; r < ranks * ranks; ++r) {
+        SharedRing *ring = &transport->rings[r];
+
+        pthread_mutex_init(&ring->lock, &mutexAttributes);
+        pthread_cond_init(&ring->changed, &condAttributes);
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    pthread_mutexattr_destroy(&mutexAttributes);
+    pthread_condattr_destroy(&condAttributes);
+}
+
+static const TransportOps SHARED_MEMORY_OPS = {
+    sharedAttach,
+    sharedWrite,
+    sharedRead,
+    sharedDestroy
+};
+
+static void socketWrite(Transport *transport, int peer, const void *data, size_t bytes) {
+    const int fd = transport->sockets[transport->rank * transport->ranks + peer];
+    const unsigned char *source = (const unsigned char*)data;
+
+    while (bytes > 0) {
+        const ssize_t written = write(fd, source, bytes);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+
+            fprintf(stderr, "Rank %d failed to send to rank %d: %s\n", transport->rank, peer, strerror(errno));
+            exit(1);
+        }
+
+        source += written;
+        bytes -= written;
+    }
+}
+
+static void socketRead(Transport *transport, int peer, void *data, size_t bytes) {
+    const int fd = transport->sockets[transport->rank * transport->ranks + peer];
+    unsigned char *target = (unsigned char*)data;
+
+    while (bytes > 0) {
+        const ssize_t received = read(fd, target, bytes);
+        if (received < 0 && errno == EINTR) continue;
+
+        if (received <= 0) {
+            fprintf(stderr, "Rank %d lost rank %d: %s\n", transport->rank, peer, received == 0 ? "closed" : strerror(errno));
+            exit(1);
+        }
+
+        target += received;
+        bytes -= received;
+    }
+}
+
+// The other ranks' ends stay open in every process otherwise, and a dead peer would never be noticed
+static void socketAttach(Transport *transport) {
+    const int ranks = transport->ranks;
+
+    for (int a = 0; a < ranks; ++a) {
+        if (a == transport->rank) continue;
+
+        for (int b = 0; b < ranks; ++b) {
+            if (a == b) continue;
+
+            close(transport->sockets[a * ranks + b]);
+            transport->sockets[a * ranks + b] = -1;
+        }
+    }
+}
+
+static void socketDestroy(Transport *transport) {
+    for (int s = 0; s < transport->ranks * transport->ranks; ++s) {
+        if (transport->sockets[s] >= 0) {
+            close(transport->sockets[s]);
+        }
+    }
+
+    free(transport->sockets);
+}
+
+static void createSockets(Transport *transport) {
+    const int ranks = transport->ranks;
+
+    transport->sockets = (int*)malloc((size_t)ranks * ranks * sizeof(int));
+    if (transport->sockets == NULL) {
+        fprintf(stderr, "Memory allocation failed for the sockets of %d ranks\n", ranks);
+        exit(1);
+    }
+
+    for (int a = 0; a < ranks; ++a) {
+        transport->sockets[a * ranks + a] = -1;
+
+        for (int b = a + 1; b < ranks; ++b) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                fprintf(stderr, "Failed to connect rank %d to rank %d: %s\n", a, b, strerror(errno));
+                exit(1);
+            }
+
+            transport->sockets[a * ranks + b] = pair[0];
+            transport->sockets[b * ranks + a] = pair[1];
+        }
+    }
+}
+
+static const TransportOps SOCKET_OPS = {
+    socketAttach,
+    socketWrite,
+    socketRead,
+    socketDestroy
+};
+
+Transport *createTransport(TransportKind kind, int ranks) {
+    Transport *transport = (Transport*)malloc(sizeof(Transport));
+    if (transport == NULL) {
+        fprintf(stderr, "Memory allocation failed for transport\n");
+        exit(1);
+    }
+
+    transport->kind = kind;
+    transport->rank = 0;
+    transport->ranks = ranks;
+    transport->rings = NULL;
+    transport->ringBytes = 0;
+    transport->sockets = NULL;
+    transport->buffer = NULL;
+    transport->capacity = 0;
+
+    switch (kind) {
+        case TRANSPORT_SHARED_MEMORY:
+            transport->ops = &SHARED_MEMORY_OPS;
+            createSharedRings(transport);
+            break;
+        case TRANSPORT_SOCKETS:
+            transport->ops = &SOCKET_OPS;
+            createSockets(transport);
+            break;
+    }
+
+    return transport;
+}
+
+void attachTransport(Transport *transport, int rank) {
+    transport->rank = rank;
+    transport->ops->attach(transport);
+}
+
+void destroyTransport(Transport *transport) {
+    transport->ops->destroy(transport);
+    free(transport->buffer);
+    free(transport);
+}
+
+int transportRank(const Transport *transport) {
+    return transport->rank;
+}
+
+int transportRanks(const Transport *transport) {
+    return transport->ranks;
+}
+
+const char *transportName(TransportKind kind) {
+    return kind == TRANSPORT_SOCKETS ? "sockets" : "shm";
+}
+
+// Messages go out as their length followed by the bytes
+void sendMessage(Transport *transport, int peer, const void *data, size_t bytes) {
+    const uint64_t length = bytes;
+
+    transport->ops->write(transport, peer, &length, sizeof(length));
+    transport->ops->write(transport, peer, data, bytes);
+}
+
+const void *receiveMessage(Transport *transport, int peer, size_t *bytes) {
+    uint64_t length;
+    transport->ops->read(transport, peer, &length, sizeof(length));
+
+    if (length > transport->capacity) {
+        free(transport->buffer);
+
+        transport->capacity = length;
+        transport->buffer = malloc(length);
+        if (transport->buffer == NULL) {
+            fprintf(stderr, "Memory allocation failed for a message of %llu bytes\n", (unsigned long long)length);
+            exit(1);
+        }
+    }
+
+    transport->ops->read(transport, peer, transport->buffer, length);
+
+    *bytes = length;
+    return transport->buffer;
+}
+
+const void *exchangeMessage(Transport *transport, int peer, const void *data, size_t bytes, size_t *received) {
+    if (transport->rank < peer) {
+        sendMessage(transport, peer, data, bytes);
+        return receiveMessage(transport, peer, received);
+    }
+
+    const void *message = receiveMessage(transport, peer, received);
+
+    // Sending leaves the receive buffer alone
+    sendMessage(transport, peer, data, bytes);
+    return message;
+}
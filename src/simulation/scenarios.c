@@ -0,0 +1,276 @@
+#include "simulation/scenarios.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static const char *SCENARIO_NAMES[] = {
+    "dam_break",
+    "settled_column",
+    "dilute_gas",
+    "cloud",
+    "hopper"
+};
+
+bool parseScenario(const char *name, Scenario *scenario) {
+    for (int i = 0; i < 5; ++i) {
+        if (strcmp(name, SCENARIO_NAMES[i]) == 0) {
+            *scenario = (Scenario)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *scenarioName(Scenario scenario) {
+    return SCENARIO_NAMES[scenario];
+}
+
+Config scenarioConfig(Scenario scenario, size_t numParticles) {
+    Config config;
+    config.dim[0] = 75;
+    config.dim[1] = 50;
+    config.dim[2] = 10;
+
+    config.friction = 0.9;
+    config.repulsion = 0.01f;
+    config.selfGravity = 0.0f;
+    config.openingAngle = 0.5f;
+    config.softening = 0.5f;
+
+    config.gravity = (V3) {0.0f, -0.01f, 0.0f};
+    config.speed = 0.01f;
+    config.supsampling = 1;
+    config.fps = 60;
+    config.schedule = SCHEDULE_REALTIME;
+    config.catchUpFrames = 4;
+    config.runFrames = 0;
+    config.adaptiveSubsteps = false;
+    config.minSubsteps = 1;
+    config.maxSubsteps = 16;
+    config.maxStepTravel = 0.1f;
+    config.maxStepOverlap = 0.0f;
+
+    config.numParticles = numParticles;
+    config.mass = 0.5f;
+    config.radiusRatio = 1.0f;
+    config.targetChunkCount = pow(4, 9);
+    config.chunkSizing = CHUNK_SIZING_TARGET_COUNT;
+    config.chunkOrder = CHUNK_ORDER_ROWS;
+    config.reorderInterval = 0;
+    config.reorderLocality = 0.0f;
+    config.chunkRetuneInterval = 0;
+    config.chunkBuilder = CHUNK_BUILDER_SORTED;
+    config.incrementalChunks = false;
+    config.chunkGrid = CHUNK_GRID_DENSE;
+    config.gridLevels = 1;
+    config.stencil = PAIR_STENCIL_HALF;
+    config.kernel = PAIR_KERNEL_AUTO;
+    config.neighbourSkin = 0.0f;
+    config.sleepSteps = 0;
+    config.sleepTravel = 0.1f;
+    config.emitterCount = 0;
+    config.sinkCount = 0;
+    config.pairSchedule = PAIR_SCHEDULE_BLOCKS;
+    config.affinity = AFFINITY_NONE;
+    config.numaFirstTouch = false;
+    config.hugePages = false;
+    config.metrics = false;
+    config.metricsPath = NULL;
+    config.metricsInterval = 0;
+    config.restartPath = NULL;
+    config.checkpointPath = NULL;
+    config.checkpointInterval = 0;
+    config.trajectoryPath = NULL;
+    config.trajectoryInterval = 1;
+    config.trajectoryFields = TRAJECTORY_POSITIONS;
+    config.trajectoryEncoding = TRAJECTORY_DELTA;
+    config.threads = 1;
+
+    if (scenario == SCENARIO_DILUTE_GAS) {
+        config.gravity = (V3) {0.0f, 0.0f, 0.0f};
+    }
+
+    // The same total pull whatever the count
+    if (scenario == SCENARIO_CLOUD) {
+        config.dim[0] = 60;
+        config.dim[1] = 60;
+        config.dim[2] = 60;
+        config.gravity = (V3) {0.0f, 0.0f, 0.0f};
+        config.selfGravity = 0.5f / numParticles;
+    }
+
+    // Pours in a twentieth of the capacity per simulated second
+    if (scenario == SCENARIO_HOPPER) {
+        const float drain = 4.0f * config.mass;
+
+        config.emitterCount = 1;
+        config.emitters[0] = (Emitter) {
+            .lower = {config.dim[0] / 2.0f - 3.0f, config.dim[1] - 3.0f, config.mass},
+            .upper = {config.dim[0] / 2.0f + 3.0f, config.dim[1] - config.mass, config.dim[2] - config.mass},
+            .velocity = {0.0f, 0.0f, 0.0f},
+            .rate = numParticles / 20.0f / config.fps
+        };
+
+        config.sinkCount = 2;
+        config.sinks[0] = (Sink) {{0.0f, 0.0f, 0.0f}, {drain, drain, (float)config.dim[2]}};
+        config.sinks[1] = (Sink) {{config.dim[0] - drain, 0.0f, 0.0f}, {(float)config.dim[0], drain, (float)config.dim[2]}};
+    }
+
+    return config;
+}
+
+static void spawnDamBreak(Domain *domain) {
+    const Config *config = &domain->config;
+    ParticleStore *store = &domain->particles;
+
+    float maxInitialVelocity = 0.005f * config->__internalSpeedFactor;
+
+    // Calculate the volume of the domain
+    int custPointScatX = config->dim[0] / 6;
+    int custPointScatY = config->dim[1] / 1.5;
+    int custPointScatZ = config->dim[2];
+
+    float volume = (custPointScatX - 0.2) * (custPointScatY - 0.2) * (custPointScatZ - 0.2);
+
+    // Calculate the approximate spacing between particles to achieve even distribution
+    float spacing = pow(volume / config->numParticles, 1.0 / 3.0);
+
+    // Calculate the number of particles along each dimension
+    int numParticlesX = ceil((custPointScatX - 0.2) / spacing);
+    int numParticlesY = ceil((custPointScatY - 0.2) / spacing);
+    int numParticlesZ = ceil((custPointScatZ - 0.2) / spacing);
+
+    // Recalculate the actual spacing based on the number of particles
+    spacing = min((custPointScatX - 0.2) / numParticlesX, min((custPointScatY - 0.2) / numParticlesY, (custPointScatZ - 0.2) / numParticlesZ));
+
+    // Initialize the particles
+    for (int i = 0; i < config->numParticles; ++i) {
+        // Calculate the grid indices for each particle
+        int xIndex = i % numParticlesX;
+        int yIndex = (i / numParticlesX) % numParticlesY;
+        int zIndex = i / (numParticlesX * numParticlesY);
+
+        // Assign positions based on the grid indices, with padding added
+        store->x[i] = xIndex * spacing + 0.1;
+        store->y[i] = yIndex * spacing + 0.1;
+        store->z[i] = zIndex * spacing + 0.1;
+
+        store->vx[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+        store->vy[i] = 0;
+        store->vz[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+    }
+}
+
+static void spawnSettledColumn(Domain *domain) {
+    const Config *config = &domain->config;
+    ParticleStore *store = &domain->particles;
+
+    // Slightly closer than contact so the bed is under load from the start
+    const float spacing = 1.9f * config->mass;
+
+    const int numParticlesX = (config->dim[0] - 2 * config->mass) / spacing + 1;
+    const int numParticlesZ = (config->dim[2] - 2 * config->mass) / spacing + 1;
+    const int layers = (config->numParticles + numParticlesX * numParticlesZ - 1) / (numParticlesX * numParticlesZ);
+
+    if (config->mass + (layers - 1) * spacing + config->mass >= config->dim[1]) {
+        fprintf(stderr, "Settled column does not fit into the domain: %d layers\n", layers);
+        exit(1);
+    }
+
+    for (int i = 0; i < config->numParticles; ++i) {
+        int xIndex = i % numParticlesX;
+        int zIndex = (i / numParticlesX) % numParticlesZ;
+        int yIndex = i / (numParticlesX * numParticlesZ);
+
+        store->x[i] = config->mass + xIndex * spacing;
+        store->y[i] = config->mass + yIndex * spacing;
+        store->z[i] = config->mass + zIndex * spacing;
+
+        store->vx[i] = 0.0f;
+        store->vy[i] = 0.0f;
+        store->vz[i] = 0.0f;
+    }
+}
+
+static void spawnDiluteGas(Domain *domain) {
+    const Config *config = &domain->config;
+    ParticleStore *store = &domain->particles;
+
+    float maxInitialVelocity = 0.05f * config->__internalSpeedFactor;
+
+    for (int i = 0; i < config->numParticles; ++i) {
+        store->x[i] = config->mass + randomFloat(&domain->rng) * (config->dim[0] - 2 * config->mass);
+        store->y[i] = config->mass + randomFloat(&domain->rng) * (config->dim[1] - 2 * config->mass);
+        store->z[i] = config->mass + randomFloat(&domain->rng) * (config->dim[2] - 2 * config->mass);
+
+        store->vx[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+        store->vy[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+        store->vz[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+    }
+}
+
+static void spawnCloud(Domain *domain) {
+    const Config *config = &domain->config;
+    ParticleStore *store = &domain->particles;
+
+    float maxInitialVelocity = 0.005f * config->__internalSpeedFactor;
+
+    const float centre[3] = {config->dim[0] / 2.0f, config->dim[1] / 2.0f, config->dim[2] / 2.0f};
+    const float radius = 0.35f * min(config->dim[0], min(config->dim[1], config->dim[2]));
+
+    for (int i = 0; i < config->numParticles; ++i) {
+        // Rejection sampling of the ball
+        float x, y, z;
+        do {
+            x = 2.0f * randomFloat(&domain->rng) - 1.0f;
+            y = 2.0f * randomFloat(&domain->rng) - 1.0f;
+            z = 2.0f * randomFloat(&domain->rng) - 1.0f;
+        } while (x * x + y * y + z * z > 1.0f);
+
+        store->x[i] = centre[0] + x * radius;
+        store->y[i] = centre[1] + y * radius;
+        store->z[i] = centre[2] + z * radius;
+
+        store->vx[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+        store->vy[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+        store->vz[i] = randomFloat(&domain->rng) * maxInitialVelocity - maxInitialVelocity / 2;
+    }
+}
+
+void spawnScenario(Domain *domain, Scenario scenario, uint64_t seed) {
+    seedRng(&domain->rng, seed);
+
+    switch (scenario) {
+        case SCENARIO_DAM_BREAK:
+            spawnDamBreak(domain);
+            break;
+        case SCENARIO_SETTLED_COLUMN:
+            spawnSettledColumn(domain);
+            break;
+        case SCENARIO_DILUTE_GAS:
+            spawnDiluteGas(domain);
+            break;
+        case SCENARIO_CLOUD:
+            spawnCloud(domain);
+            break;
+        case SCENARIO_HOPPER:
+            // Everything comes from the emitter
+            domain->particles.count = 0;
+            break;
+    }
+
+    // Shared particle properties
+    ParticleStore *store = &domain->particles;
+
+    for (int i = 0; i < store->count; ++i) {
+        store->col[3 * i + 0] = nextRng(&domain->rng) % 255;
+        store->col[3 * i + 1] = nextRng(&domain->rng) % 255;
+        store->col[3 * i + 2] = nextRng(&domain->rng) % 255;
+
+        store->radius[i] = spawnRadius(&domain->config, &domain->rng);
+    }
+}
@@ -0,0 +1,118 @@
+#include "simulation/scheduler.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *SCHEDULE_NAMES[] = {
+    "batch",
+    "realtime",
+    "skip"
+};
+
+bool parseSchedule(const char *name, ScheduleMode *mode) {
+    for (int i = 0; i < 3; ++i) {
+        if (strcmp(name, SCHEDULE_NAMES[i]) == 0) {
+            *mode = (ScheduleMode)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *scheduleName(ScheduleMode mode) {
+    return SCHEDULE_NAMES[mode];
+}
+
+static double sinceStart(const FrameScheduler *scheduler) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - scheduler->start.tv_sec) + (now.tv_nsec - scheduler->start.tv_nsec) / 1e9;
+}
+
+void initScheduler(FrameScheduler *scheduler, const Config *config) {
+    if (config->fps <= 0 || config->catchUpFrames < 0 || config->runFrames < 0) {
+        fprintf(stderr, "Scheduling needs a positive fps and no negative catch up or run frames\n");
+        exit(1);
+    }
+
+    scheduler->mode = config->schedule;
+    scheduler->frameSeconds = 1.0 / config->fps;
+    scheduler->catchUpFrames = config->catchUpFrames;
+
+    clock_gettime(CLOCK_MONOTONIC, &scheduler->start);
+    scheduler->due = 0.0;
+    scheduler->published = -scheduler->frameSeconds;
+
+    scheduler->frames = 0;
+    scheduler->lateFrames = 0;
+    scheduler->droppedFrames = 0;
+    scheduler->skippedFrames = 0;
+}
+
+void awaitFrame(FrameScheduler *scheduler) {
+    if (scheduler->mode == SCHEDULE_BATCH) return;
+
+    // The first frame is due whenever it comes
+    if (scheduler->frames > 0 && sinceStart(scheduler) > scheduler->due) {
+        scheduler->lateFrames++;
+        return;
+    }
+
+    // Against the start rather than for the remaining time, so oversleeping does not add up
+    const double due = floor(scheduler->due);
+    struct timespec wake = scheduler->start;
+    wake.tv_sec += (time_t)due;
+    wake.tv_nsec += (long)((scheduler->due - due) * 1e9);
+    if (wake.tv_nsec >= 1000000000L) {
+        wake.tv_sec++;
+        wake.tv_nsec -= 1000000000L;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+}
+
+bool completeFrame(FrameScheduler *scheduler) {
+    scheduler->frames++;
+    scheduler->due += scheduler->frameSeconds;
+
+    if (scheduler->mode == SCHEDULE_BATCH) return true;
+
+    const double now = sinceStart(scheduler);
+
+    // Slots further behind than the catch up allows are given up
+    const double behind = floor((now - scheduler->due) / scheduler->frameSeconds);
+    if (behind > scheduler->catchUpFrames) {
+        const size_t dropped = (size_t)behind - scheduler->catchUpFrames;
+
+        scheduler->droppedFrames += dropped;
+        scheduler->due += dropped * scheduler->frameSeconds;
+    }
+
+    if (scheduler->mode == SCHEDULE_REALTIME) return true;
+
+    // Caught up, or no frame was published during the slot
+    if (now < scheduler->due || now - scheduler->published >= scheduler->frameSeconds) {
+        scheduler->published = now;
+        return true;
+    }
+
+    scheduler->skippedFrames++;
+    return false;
+}
+
+double simulatedSeconds(const FrameScheduler *scheduler) {
+    return scheduler->frames * scheduler->frameSeconds;
+}
+
+double wallSeconds(const FrameScheduler *scheduler) {
+    return sinceStart(scheduler);
+}
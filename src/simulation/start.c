@@ -4,192 +4,121 @@
  * Copyright (c) Alexander Kurtz 2024
  */
 
-void updateDraw(Domain *source, Domain *target) {
-    // Update the visualizer domain
-    source->drawable = true;
-    memccpy(target, source, sizeof(Domain), sizeof(Domain));
-    source->drawable = false;
-}
-
-void handleParticleInteraction(Particle *a, Particle *b, Domain *domain) {
-    const V3 delta = sub3(&a->pos, &b->pos);
-    float distance = len3(&delta);
-
-    const float repulsion = domain->config.repulsion;
-    const float friction = domain->config.friction;
-
-    handleRepulsion(a, b, distance, repulsion);
-    handleCollision(a, b, distance, friction);
-}
-
-void stepGlobal(Domain *domain) {
-    const size_t particles = domain->config.numParticles;
-
-    // Apply forces
-    for (int i = 0; i < particles; ++i) {
-        Particle *particle = &domain->particles[i];
-
-        const V3 temp = div3(&particle->pos, domain->chunkSize);
-
-        const int chunkX = temp.x;
-        const int chunkY = temp.y;
-        const int chunkZ = temp.z;
-
-        Chunk *chunk = &domain->chunks[chunkX][chunkY][chunkZ];
-        const int chunkParticles = chunk->numParticles;
-
-        // Check for this particle in the chunk
-        for (int j = 0; j < chunkParticles; ++j) {
-            Particle *other = chunk->particles[j];
+void startSimulation(SnapshotChannel* channel, Config config) {
+    Domain domain;
 
-            if (other == particle) continue;
+    if (config.restartPath != NULL) {
+        loadCheckpoint(&domain, config.restartPath, config);
 
-            handleParticleInteraction(particle, other, domain);
+        // The channel was sized before the checkpoint could raise the count
+        if (domain.config.numParticles > snapshotCapacity(channel)) {
+            fprintf(stderr, "Checkpoint %s holds %zu particles, the snapshots were sized for %zu, restart with at least that many\n",
+                    config.restartPath, domain.config.numParticles, snapshotCapacity(channel));
+            exit(1);
         }
+    } else {
+        initDomain(&domain, config);
 
-        // Check for particles in adjacent chunks
-        for (int j = 0; j < 26; ++j) {
-            Chunk *adj = chunk->adj[j];
-
-            if (adj == NULL) continue;
-
-            const int adjParticles = adj->numParticles;
-
-            for (int k = 0; k < adjParticles; ++k) {
-                Particle *other = adj->particles[k];
-
-                handleParticleInteraction(particle, other, domain);
-            }
-        }
+        // spawn particles
+        spawnScenario(&domain, SCENARIO_DAM_BREAK, time(NULL));
     }
 
-    // Global applies
-    for (int i = 0; i < particles; i++) {
-        Particle *particle = &domain->particles[i];
+    // A restart brings its own timestep settings
+    config = domain.config;
 
-        applyGravity(particle, &domain->config.gravity);
-        checkBoundaries(particle, domain);
+    CheckpointWriter *checkpoints = NULL;
+    if (config.checkpointPath != NULL && config.checkpointInterval > 0) {
+        checkpoints = createCheckpointWriter(config.numParticles);
     }
 
-    // Update positions
-    for (int i = 0; i < particles; ++i) {
-        Particle *particle = &domain->particles[i];
-
-        particle->pos = add3(&particle->pos, &particle->vel);
+    TrajectoryWriter *trajectory = NULL;
+    if (config.trajectoryPath != NULL) {
+        trajectory = createTrajectoryWriter(config.trajectoryPath, domain.particles.count, &config, 4);
     }
-}
-
-#define min(a, b) ((a) < (b) ? (a) : (b))
-
-
-void startSimulation(Domain* visualizerDomain, Config config) {
-    Domain domain;
-
-    initDomain(&domain, config);
-
-    // spawn particles
-    srand(time(NULL));
-
-    float maxInitialVelocity = 0.005f * domain.config.__internalSpeedFactor;
-    domain.config.repulsion *= domain.config.__internalSpeedFactor;
-    domain.config.gravity = mul3(&domain.config.gravity, domain.config.__internalSpeedFactor);
-
 
     printf("Timestep scaling factor: %f\n", domain.config.__internalSpeedFactor);
+    printf("Schedule: %s\n", scheduleName(config.schedule));
 
-    // Calculate the volume of the domain
-    int custPointScatX = domain.config.dim[0] / 6;
-    int custPointScatY = domain.config.dim[1] / 1.5;
-    int custPointScatZ = domain.config.dim[2];
-
-    float volume = (custPointScatX - 0.2) * (custPointScatY - 0.2) * (custPointScatZ - 0.2);
-
-    // Calculate the approximate spacing between particles to achieve even distribution
-    float spacing = pow(volume / domain.config.numParticles, 1.0 / 3.0);
-
-    // Calculate the number of particles along each dimension
-    int numParticlesX = ceil((custPointScatX - 0.2) / spacing);
-    int numParticlesY = ceil((custPointScatY - 0.2) / spacing);
-    int numParticlesZ = ceil((custPointScatZ - 0.2) / spacing);
-
-    // Recalculate the actual spacing based on the number of particles
-    spacing = min((custPointScatX - 0.2) / numParticlesX, min((custPointScatY - 0.2) / numParticlesY, (custPointScatZ - 0.2) / numParticlesZ));
-
-    // Initialize the particles
-    for (int i = 0; i < domain.config.numParticles; ++i) {
-        Particle *particle = &domain.particles[i];
-
-        // Calculate the grid indices for each particle
-        int xIndex = i % numParticlesX;
-        int yIndex = (i / numParticlesX) % numParticlesY;
-        int zIndex = i / (numParticlesX * numParticlesY);
-
-        // Assign positions based on the grid indices, with padding added
-        particle->pos.x = xIndex * spacing + 0.1;
-        particle->pos.y = yIndex * spacing + 0.1;
-        particle->pos.z = zIndex * spacing + 0.1;
-
-        // Velocity and color settings remain unchanged
-        particle->vel.x = (rand() % 1000) / 1000.0 * maxInitialVelocity - maxInitialVelocity / 2;
-        particle->vel.y = 0;
-        particle->vel.z = (rand() % 1000) / 1000.0 * maxInitialVelocity - maxInitialVelocity / 2;
-
-        particle->col[0] = rand() % 255;
-        particle->col[1] = rand() % 255;
-        particle->col[2] = rand() % 255;
-
-        particle->mass = config.mass;
-    }
-
-
-    const double frameDuration = 1.0 / config.fps;
+    FrameScheduler scheduler;
+    initScheduler(&scheduler, &config);
 
     struct timespec start, end;
-    double elapsedTime;
     double totalTime = 0.0;
     int frameCount = 0;
-    bool runningSlow = false;
 
-    while (1) {
+    // Scheduler totals at the last report
+    double reportWall = 0.0;
+    double reportSimulated = 0.0;
+    size_t reportLate = 0;
+    size_t reportDropped = 0;
+
+    while (config.runFrames == 0 || frameCount < config.runFrames) {
+        awaitFrame(&scheduler);
+
         clock_gettime(CLOCK_MONOTONIC, &start);
 
-        // Perform the simulation steps for supsampling
-        for (int i = 0; i < config.supsampling; ++i) {
-            updateChunks(&domain);
-            stepGlobal(&domain);
+        // Perform the simulation steps for supsampling, which may change for the next frame
+        stepFrame(&domain);
+
+        // Hand the new state to the visualiser, never waits on it
+        if (completeFrame(&scheduler)) {
+            const double publishStart = beginPhase(&domain.metrics);
+            publishSnapshot(channel, &domain.particles, &domain.config);
+            endPhase(&domain.metrics, METRIC_PHASE_SNAPSHOT, publishStart);
+        }
+
+        // Skipped rather than waited for if the last one is still being written
+        if (checkpoints != NULL && (frameCount + 1) % config.checkpointInterval == 0) {
+            requestCheckpoint(checkpoints, &domain, config.checkpointPath);
         }
 
-        // Update the visualization with the new state
-        updateDraw(&domain, visualizerDomain);
+        // Dropped rather than waited for if the disk falls behind
+        if (trajectory != NULL) {
+            submitTrajectoryFrame(trajectory, &domain);
+        }
 
         clock_gettime(CLOCK_MONOTONIC, &end);
-        elapsedTime = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
-
-        totalTime += elapsedTime;
+        totalTime += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
         frameCount++;
 
-        if (elapsedTime > frameDuration) {
-            runningSlow = true;
-        }
-
         if (frameCount % config.fps == 0) {
-            double averageTime = totalTime / frameCount;
-            printf("Average time per frame: %.6f seconds", averageTime);
+            const double wall = wallSeconds(&scheduler);
+            const double simulated = simulatedSeconds(&scheduler);
+
+            printf("Average time per frame: %.6f seconds", totalTime / frameCount);
+            printf(" Simulated seconds per second: %.3f", (simulated - reportSimulated) / (wall - reportWall));
+            printf(" Snapshots published: %llu dropped: %llu",
+                   (unsigned long long)snapshotsPublished(channel), (unsigned long long)snapshotsDropped(channel));
+
+            if (scheduler.mode == SCHEDULE_FRAME_SKIP) {
+                printf(" skipped: %zu", scheduler.skippedFrames);
+            }
 
-            if (runningSlow) {
-                printf(" Warning: Running slow");
-                runningSlow = false;
+            if (scheduler.lateFrames > reportLate || scheduler.droppedFrames > reportDropped) {
+                printf(" Warning: Running slow, %zu frames late, %zu dropped",
+                       scheduler.lateFrames - reportLate, scheduler.droppedFrames - reportDropped);
             }
 
             printf("\n");
-        }
 
-        double sleepTime = frameDuration - elapsedTime;
-        if (sleepTime > 0) {
-            struct timespec sleepDuration;
-            sleepDuration.tv_sec = (time_t)sleepTime;
-            sleepDuration.tv_nsec = (sleepTime - sleepDuration.tv_sec) * 1e9;
-            nanosleep(&sleepDuration, NULL);
+            reportWall = wall;
+            reportSimulated = simulated;
+            reportLate = scheduler.lateFrames;
+            reportDropped = scheduler.droppedFrames;
         }
     }
+
+    printf("Simulated %.3f seconds in %.3f, %zu frames late, %zu dropped, %zu skipped\n",
+           simulatedSeconds(&scheduler), wallSeconds(&scheduler),
+           scheduler.lateFrames, scheduler.droppedFrames, scheduler.skippedFrames);
+
+    if (trajectory != NULL) {
+        destroyTrajectoryWriter(trajectory);
+    }
+
+    if (checkpoints != NULL) {
+        destroyCheckpointWriter(checkpoints);
+    }
+
+    freeDomain(&domain);
 }
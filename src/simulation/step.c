@@ -0,0 +1,938 @@
+#include "simulation/step.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <stdatomic.h>
+
+// Serial visit of a to b, counting a contact into hits and raising overlap to its depth
+static inline void interactPair(ParticleStore *store, int a, int b, float repulsion, float friction, size_t *hits, float *overlap) {
+    const float deltaX = store->x[a] - store->x[b];
+    const float deltaY = store->y[a] - store->y[b];
+    const float deltaZ = store->z[a] - store->z[b];
+    float distance = sqrtf(deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ);
+
+    const float contact = store->radius[a] + store->radius[b];
+    if (distance < contact) {
+        (*hits)++;
+        *overlap = fmaxf(*overlap, (contact - distance) / contact);
+    }
+
+    handleRepulsion(store, a, b, distance, repulsion);
+    handleCollision(store, a, b, distance, friction);
+}
+
+void handleParticleInteraction(int a, int b, Domain *domain) {
+    interactPair(&domain->particles, a, b, domain->config.repulsion, domain->config.friction, &domain->metrics.pairHits, &domain->workerOverlap[0]);
+}
+
+// Full stencil over the index lists of CHUNK_BUILDER_LISTS, returns the pair tests
+static size_t fullStencilListsChunk(Domain *domain, const Chunk *chunk, size_t *hits, float *overlap) {
+    ParticleStore *store = &domain->particles;
+    const float repulsion = domain->config.repulsion;
+    const float friction = domain->config.friction;
+    const int chunkParticles = chunk->numParticles;
+    size_t pairTests = 0;
+
+    for (int p = 0; p < chunkParticles; ++p) {
+        const int i = chunk->particles[p];
+
+        pairTests += chunkParticles - 1;
+
+        // Check for this particle in the chunk
+        for (int j = 0; j < chunkParticles; ++j) {
+            const int other = chunk->particles[j];
+
+            if (other == i) continue;
+
+            interactPair(store, i, other, repulsion, friction, hits, overlap);
+        }
+
+        // Check for particles in adjacent chunks
+        for (int j = 0; j < 26; ++j) {
+            const Chunk *adj = chunk + domain->chunkOffsets[j];
+
+            pairTests += adj->numParticles;
+
+            for (int k = 0; k < adj->numParticles; ++k) {
+                interactPair(store, i, adj->particles[k], repulsion, friction, hits, overlap);
+            }
+        }
+    }
+
+    return pairTests;
+}
+
+// Full stencil over the contiguous ranges of CHUNK_BUILDER_SORTED, returns the pair tests
+static size_t fullStencilSortedChunk(Domain *domain, const Chunk *chunk, size_t *hits, float *overlap) {
+    ParticleStore *store = &domain->particles;
+    const float repulsion = domain->config.repulsion;
+    const float friction = domain->config.friction;
+    size_t pairTests = 0;
+
+    for (int i = chunk->begin; i < chunk->end; ++i) {
+        pairTests += chunk->numParticles - 1;
+
+        // Check for this particle in the chunk
+        for (int j = chunk->begin; j < chunk->end; ++j) {
+            if (j == i) continue;
+
+            interactPair(store, i, j, repulsion, friction, hits, overlap);
+        }
+
+        // Check for particles in adjacent chunks
+        for (int j = 0; j < 26; ++j) {
+            const Chunk *adj = neighbourChunk(domain, chunk, j);
+
+            pairTests += adj->numParticles;
+
+            for (int k = adj->begin; k < adj->end; ++k) {
+                interactPair(store, i, k, repulsion, friction, hits, overlap);
+            }
+        }
+    }
+
+    return pairTests;
+}
+
+// Blocks handed to one worker at a time
+#define GATHER_GRAIN_CHUNKS 64
+#define GATHER_GRAIN_PARTICLES 256
+#define INTEGRATE_GRAIN 4096
+#define GRAVITY_GRAIN_LEAVES 32
+
+/**
+ * The simultaneous law of the decomposed step, see initSimultaneousContacts:
+ * every particle gathers the velocity change from all of its contacts into dv
+ * while only reading the store, so no two workers ever write the same
+ * particle. The changes are applied afterwards in a separate pass.
+ *
+ * The law shares the collision impulses by the contact counts, so those are
+ * counted first in a pass of their own.
+ */
+typedef struct {
+    Domain *domain;
+    ContactLaw law;
+    bool counting;
+    atomic_size_t pairTests;
+    atomic_size_t pairHits;
+} GatherContext;
+
+// Contact of a and b under law, only tested without dv
+static inline bool gatherPair(const ParticleStore *store, int a, int b, const ContactLaw *law, float *dv, float *overlap) {
+    if (dv == NULL) return contactTouches(store, a, b);
+
+    return contactResponse(store, a, b, law->repulsion, law->friction, law->contacts, dv, overlap);
+}
+
+// Leaves what particle i gathered, its contacts while counting and its velocity change after
+static inline void storeGathered(Domain *domain, bool counting, size_t i, int hits, const float dv[3]) {
+    if (counting) {
+        domain->contactCounts[i] = hits < UINT16_MAX ? hits : UINT16_MAX;
+    }
+
+    domain->dvx[i] = dv[0];
+    domain->dvy[i] = dv[1];
+    domain->dvz[i] = dv[2];
+}
+
+static void gatherListsTask(void *context, size_t begin, size_t end, int worker) {
+    GatherContext *gather = (GatherContext*)context;
+    Domain *domain = gather->domain;
+    const ParticleStore *store = &domain->particles;
+    const ContactLaw *law = &gather->law;
+
+    size_t pairTests = 0;
+    size_t pairHits = 0;
+    float overlap = domain->workerOverlap[worker];
+
+    for (size_t i = begin; i < end; ++i) {
+        const int chunkX = store->x[i] / domain->chunkSize;
+        const int chunkY = store->y[i] / domain->chunkSize;
+        const int chunkZ = store->z[i] / domain->chunkSize;
+
+        const Chunk *chunk = &domain->chunks[chunkIndex(domain, chunkX, chunkY, chunkZ)];
+
+        float dv[3] = {0.0f, 0.0f, 0.0f};
+        float *response = gather->counting ? NULL : dv;
+        int hits = 0;
+
+        pairTests += chunk->numParticles - 1;
+
+        for (int j = 0; j < chunk->numParticles; ++j) {
+            const int other = chunk->particles[j];
+
+            if (other == i) continue;
+
+            hits += gatherPair(store, i, other, law, response, &overlap);
+        }
+
+        for (int j = 0; j < 26; ++j) {
+            const Chunk *adj = chunk + domain->chunkOffsets[j];
+
+            pairTests += adj->numParticles;
+
+            for (int k = 0; k < adj->numParticles; ++k) {
+                hits += gatherPair(store, i, adj->particles[k], law, response, &overlap);
+            }
+        }
+
+        pairHits += hits;
+        storeGathered(domain, gather->counting, i, hits, dv);
+    }
+
+    domain->workerOverlap[worker] = overlap;
+
+    if (gather->counting) return;
+
+    atomic_fetch_add_explicit(&gather->pairTests, pairTests, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gather->pairHits, pairHits, memory_order_relaxed);
+}
+
+static void gatherSortedTask(void *context, size_t begin, size_t end, int worker) {
+    GatherContext *gather = (GatherContext*)context;
+    Domain *domain = gather->domain;
+    const ParticleStore *store = &domain->particles;
+    const ContactBlockKernel contactBlock = domain->contactBlock;
+    const ContactLaw *law = &gather->law;
+
+    size_t pairTests = 0;
+    size_t pairHits = 0;
+    float overlap = domain->workerOverlap[worker];
+
+    for (size_t c = begin; c < end; ++c) {
+        const Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+        for (int i = chunk->begin; i < chunk->end; ++i) {
+            float dv[3] = {0.0f, 0.0f, 0.0f};
+            float *response = gather->counting ? NULL : dv;
+
+            pairTests += chunk->numParticles - 1;
+
+            // The kernel skips i itself
+            int hits = contactBlock(store, i, chunk->begin, chunk->end, law, response, &overlap);
+
+            for (int j = 0; j < 26; ++j) {
+                const Chunk *adj = neighbourChunk(domain, chunk, j);
+
+                pairTests += adj->numParticles;
+
+                hits += contactBlock(store, i, adj->begin, adj->end, law, response, &overlap);
+            }
+
+            pairHits += hits;
+            storeGathered(domain, gather->counting, i, hits, dv);
+        }
+    }
+
+    domain->workerOverlap[worker] = overlap;
+
+    if (gather->counting) return;
+
+    atomic_fetch_add_explicit(&gather->pairTests, pairTests, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gather->pairHits, pairHits, memory_order_relaxed);
+}
+
+// Gravity and boundaries of particles [begin, end), the gravity tree has to be built
+static void forcesRange(Domain *domain, size_t begin, size_t end) {
+    ParticleStore *store = &domain->particles;
+    const Config *config = &domain->config;
+
+    // Global applies
+    applyGravity(store, begin, end, &config->gravity);
+
+    if (config->selfGravity > 0) {
+        applySelfGravity(&domain->gravityTree, store, begin, end, config->selfGravity);
+    }
+
+    checkBoundaries(store, begin, end, domain);
+}
+
+static void selfGravityTask(void *context, size_t begin, size_t end, int worker) {
+    const Domain *domain = (const Domain*)context;
+    computeSelfGravity((Octree*)&domain->gravityTree, begin, end, domain->config.openingAngle, domain->config.softening, domain->config.kernel);
+}
+
+// Also raises the longest move of the worker, squared and relative to the radius
+static void positionsRange(Domain *domain, size_t begin, size_t end, int worker) {
+    ParticleStore *store = &domain->particles;
+    float travel = domain->workerTravel[worker];
+
+    // Update positions
+    for (size_t i = begin; i < end; ++i) {
+        store->x[i] += store->vx[i];
+        store->y[i] += store->vy[i];
+        store->z[i] += store->vz[i];
+
+        const float moveSq = store->vx[i] * store->vx[i] + store->vy[i] * store->vy[i] + store->vz[i] * store->vz[i];
+        const float radiusSq = store->radius[i] * store->radius[i];
+        travel = moveSq > travel * radiusSq ? moveSq / radiusSq : travel;
+    }
+
+    domain->workerTravel[worker] = travel;
+}
+
+// Adds the velocity changes of the simultaneous law
+static void applyGatheredRange(Domain *domain, size_t begin, size_t end) {
+    ParticleStore *store = &domain->particles;
+
+    // Apply the gathered contact forces
+    for (size_t i = begin; i < end; ++i) {
+        store->vx[i] += domain->dvx[i];
+        store->vy[i] += domain->dvy[i];
+        store->vz[i] += domain->dvz[i];
+    }
+}
+
+static void forcesTask(void *context, size_t begin, size_t end, int worker) {
+    Domain *domain = (Domain*)context;
+
+    if (domain->dvx != NULL) {
+        applyGatheredRange(domain, begin, end);
+    }
+
+    forcesRange(domain, begin, end);
+}
+
+static void positionsTask(void *context, size_t begin, size_t end, int worker) {
+    positionsRange((Domain*)context, begin, end, worker);
+}
+
+// Both in one pass, unless the phases are timed
+static void integrateTask(void *context, size_t begin, size_t end, int worker) {
+    forcesTask(context, begin, end, worker);
+    positionsRange((Domain*)context, begin, end, worker);
+}
+
+// Appends the range of chunk to ranges unless it is empty, merged into the last one if they touch
+static void appendRange(int *ranges, int *count, const Chunk *chunk) {
+    if (chunk->numParticles == 0) return;
+
+    if (*count > 0 && ranges[2 * *count - 1] == chunk->begin) {
+        ranges[2 * *count - 1] = chunk->end;
+        return;
+    }
+
+    ranges[2 * *count] = chunk->begin;
+    ranges[2 * *count + 1] = chunk->end;
+    (*count)++;
+}
+
+/**
+ * Appends the ranges on every coarser level that particles of chunk can touch.
+ * A particle of level l reaches at most (s_l + s_m) / 2 into level m, for
+ * chunk edges s, which from a small chunk mostly only crosses into one more
+ * coarse chunk per axis instead of two.
+ */
+static void appendCoarserRanges(const Domain *domain, const Chunk *chunk, int *ranges, int *count) {
+    const SparseGrid *grid = domain->sparse;
+    const int index = chunk - domain->chunks;
+    const int *coordinates = &grid->coordinates[3 * index];
+
+    for (int parent = grid->parents[index], up = 1; parent != 0; parent = grid->parents[parent], ++up) {
+        const Chunk *coarse = &domain->chunks[parent];
+        const int *coarseCoordinates = &grid->coordinates[3 * parent];
+
+        // In chunks of the fine level, the reach is (1 + 2^up) / 2 of them
+        const float scale = (float)(1 << up);
+        const float reach = 0.5f * (1.0f + scale);
+
+        int low[3], high[3];
+        for (int d = 0; d < 3; ++d) {
+            low[d] = (int)floorf((coordinates[d] - reach) / scale) - coarseCoordinates[d];
+            high[d] = (int)floorf((coordinates[d] + 1 + reach) / scale) - coarseCoordinates[d];
+        }
+
+        for (int dx = low[0]; dx <= high[0]; ++dx) {
+            for (int dy = low[1]; dy <= high[1]; ++dy) {
+                for (int dz = low[2]; dz <= high[2]; ++dz) {
+                    // Position in Domain.chunkOffsets order, which skips (0, 0, 0)
+                    const int n = 9 * (dx + 1) + 3 * (dy + 1) + dz + 1;
+
+                    appendRange(ranges, count, n == 13 ? coarse : neighbourChunk(domain, coarse, n - (n > 13)));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Half stencil: visits every pair once, from the later half of its own chunk or
+ * from the forward neighbours chunkOffsets[13..25], and scatters both sides
+ * into the store. A sleeping chunk skips its pairs with itself and other
+ * sleepers. With grid levels the finer particle also visits the coarser chunks
+ * it can reach. Returns the pair tests, adds the contacts to hits and raises
+ * overlap to the deepest of them.
+ */
+static size_t halfStencilChunk(Domain *domain, const Chunk *chunk, size_t *hits, float *overlap) {
+    const ParticleStore *store = &domain->particles;
+    const ContactBlockKernel contactBlock = domain->contactBlock;
+
+    // Sequential law, straight into the store
+    const ContactLaw law = {domain->config.repulsion, domain->config.friction, NULL, {store->vx, store->vy, store->vz}};
+
+    if (chunk->numParticles == 0) return 0;
+
+    // Partner ranges in visiting order, the kernels take touching ones in one go just the same
+    int ranges[2 * (26 - HALF_STENCIL_BEGIN + 27 * SPARSE_GRID_LEVELS)];
+    int count = 0;
+
+    for (int j = HALF_STENCIL_BEGIN; j < 26; ++j) {
+        const Chunk *neighbour = neighbourChunk(domain, chunk, j);
+
+        if (!chunk->asleep || !neighbour->asleep) {
+            appendRange(ranges, &count, neighbour);
+        }
+    }
+
+    if (domain->config.gridLevels > 1) {
+        appendCoarserRanges(domain, chunk, ranges, &count);
+    }
+
+    if (chunk->asleep && count == 0) return 0;
+
+    // A sleeping chunk keeps still against itself
+    size_t pairTests = chunk->asleep ? 0 : (size_t)chunk->numParticles * (chunk->numParticles - 1) / 2;
+
+    for (int r = 0; r < count; ++r) {
+        pairTests += (size_t)chunk->numParticles * (ranges[2 * r + 1] - ranges[2 * r]);
+    }
+
+    for (int i = chunk->begin; i < chunk->end; ++i) {
+        float dv[3] = {0.0f, 0.0f, 0.0f};
+
+        if (!chunk->asleep) {
+            *hits += contactBlock(store, i, i + 1, chunk->end, &law, dv, overlap);
+        }
+
+        for (int r = 0; r < count; ++r) {
+            *hits += contactBlock(store, i, ranges[2 * r], ranges[2 * r + 1], &law, dv, overlap);
+        }
+
+        store->vx[i] += dv[0];
+        store->vy[i] += dv[1];
+        store->vz[i] += dv[2];
+    }
+
+    return pairTests;
+}
+
+/**
+ * Neighbour lists of the particles of chunk, scattering into half lists or in
+ * place over full ones. The chunks stay those of the last build until the lists
+ * expire, so no partner lies beyond the neighbours of the chunk.
+ */
+static size_t neighboursChunk(Domain *domain, const Chunk *chunk, size_t *hits, float *overlap) {
+    ParticleStore *store = &domain->particles;
+    const NeighbourList *list = &domain->neighbours;
+
+    const float repulsion = domain->config.repulsion;
+    const float friction = domain->config.friction;
+
+    if (chunk->numParticles == 0) return 0;
+
+    for (int i = chunk->begin; i < chunk->end; ++i) {
+        if (!list->half) {
+            for (int k = list->start[i]; k < list->start[i + 1]; ++k) {
+                interactPair(store, i, list->entries[k], repulsion, friction, hits, overlap);
+            }
+            continue;
+        }
+
+        float dv[3] = {0.0f, 0.0f, 0.0f};
+
+        for (int k = list->start[i]; k < list->start[i + 1]; ++k) {
+            const int j = list->entries[k];
+            const float before[3] = {dv[0], dv[1], dv[2]};
+
+            if (!contactResponse(store, i, j, repulsion, friction, NULL, dv, overlap)) continue;
+
+            (*hits)++;
+
+            store->vx[j] -= dv[0] - before[0];
+            store->vy[j] -= dv[1] - before[1];
+            store->vz[j] -= dv[2] - before[2];
+        }
+
+        store->vx[i] += dv[0];
+        store->vy[i] += dv[1];
+        store->vz[i] += dv[2];
+    }
+
+    return list->start[chunk->end] - list->start[chunk->begin];
+}
+
+/**
+ * Every pair phase runs in 27 colours, the chunks coloured by their coordinates
+ * modulo 3, one colour after the other. A chunk only reads and writes the
+ * particles in it and in its neighbours, so chunks of one colour, at least
+ * three apart, never share a particle. They run on any number of workers in any
+ * order and resolve the sequential law in place, without a pool just the same.
+ * Grid levels reach past the neighbours and keep to one thread.
+ */
+typedef size_t (*ChunkPairs)(Domain *domain, const Chunk *chunk, size_t *hits, float *overlap);
+
+typedef struct {
+    Domain *domain;
+    ChunkPairs pairs;
+    int colour[3];
+    int counts[3];
+
+    // Sparse grid: the chunks of this colour, as indices into chunks
+    const int *chunks;
+
+    atomic_size_t pairTests;
+    atomic_size_t pairHits;
+} ColourContext;
+
+// Chunk c of the colour
+static const Chunk *colourChunk(const void *context, size_t c) {
+    const ColourContext *colour = (const ColourContext*)context;
+    const Domain *domain = colour->domain;
+
+    if (colour->chunks != NULL) {
+        return &domain->chunks[colour->chunks[c]];
+    }
+
+    const int x = colour->colour[0] + 3 * (c / (colour->counts[1] * colour->counts[2]));
+    const int y = colour->colour[1] + 3 * ((c / colour->counts[2]) % colour->counts[1]);
+    const int z = colour->colour[2] + 3 * (c % colour->counts[2]);
+
+    return &domain->chunks[chunkIndex(domain, x, y, z)];
+}
+
+static void colourTask(void *context, size_t begin, size_t end, int worker) {
+    ColourContext *colour = (ColourContext*)context;
+    Domain *domain = colour->domain;
+
+    size_t pairTests = 0;
+    size_t pairHits = 0;
+    float *overlap = &domain->workerOverlap[worker];
+
+    for (size_t c = begin; c < end; ++c) {
+        pairTests += colour->pairs(domain, colourChunk(colour, c), &pairHits, overlap);
+    }
+
+    atomic_fetch_add_explicit(&colour->pairTests, pairTests, memory_order_relaxed);
+    atomic_fetch_add_explicit(&colour->pairHits, pairHits, memory_order_relaxed);
+}
+
+static void stepPairs(Domain *domain) {
+    ColourContext colour;
+    colour.domain = domain;
+    colour.chunks = NULL;
+    atomic_init(&colour.pairTests, 0);
+    atomic_init(&colour.pairHits, 0);
+
+    if (domain->config.neighbourSkin > 0) {
+        colour.pairs = neighboursChunk;
+    } else if (domain->config.stencil == PAIR_STENCIL_HALF) {
+        // Sleepers only take part in pairs with awake particles
+        if (domain->calmSteps != NULL && domain->awakeRangeCount == 0) return;
+
+        colour.pairs = halfStencilChunk;
+    } else {
+        colour.pairs = domain->config.chunkBuilder == CHUNK_BUILDER_LISTS ? fullStencilListsChunk : fullStencilSortedChunk;
+    }
+
+    if (domain->sparse != NULL) {
+        // The sparse grid buckets its chunks by colour on every update
+        const SparseGrid *grid = domain->sparse;
+
+        for (int k = 0; k < 27; ++k) {
+            colour.chunks = grid->colourOrder + grid->colourStart[k];
+            runPairTasks(domain, grid->colourStart[k + 1] - grid->colourStart[k], GATHER_GRAIN_CHUNKS, colourChunk, &colour, colourTask, &colour);
+        }
+    } else {
+        for (int cx = 0; cx < 3; ++cx) {
+            for (int cy = 0; cy < 3; ++cy) {
+                for (int cz = 0; cz < 3; ++cz) {
+                    colour.colour[0] = cx;
+                    colour.colour[1] = cy;
+                    colour.colour[2] = cz;
+
+                    // Chunks of this colour along each axis
+                    for (int d = 0; d < 3; ++d) {
+                        const int start = d == 0 ? cx : (d == 1 ? cy : cz);
+                        colour.counts[d] = domain->chunkCounts[d] > start ? (domain->chunkCounts[d] - start + 2) / 3 : 0;
+                    }
+
+                    const size_t chunks = (size_t)colour.counts[0] * colour.counts[1] * colour.counts[2];
+                    runPairTasks(domain, chunks, GATHER_GRAIN_CHUNKS, colourChunk, &colour, colourTask, &colour);
+                }
+            }
+        }
+    }
+
+    domain->metrics.pairTests += atomic_load(&colour.pairTests);
+    domain->metrics.pairHits += atomic_load(&colour.pairHits);
+}
+
+static void gatherNeighboursTask(void *context, size_t begin, size_t end, int worker) {
+    GatherContext *gather = (GatherContext*)context;
+    Domain *domain = gather->domain;
+    const ParticleStore *store = &domain->particles;
+    const NeighbourList *list = &domain->neighbours;
+    const ContactLaw *law = &gather->law;
+
+    size_t pairHits = 0;
+    float overlap = domain->workerOverlap[worker];
+
+    for (size_t i = begin; i < end; ++i) {
+        float dv[3] = {0.0f, 0.0f, 0.0f};
+        float *response = gather->counting ? NULL : dv;
+        int hits = 0;
+
+        for (int k = list->start[i]; k < list->start[i + 1]; ++k) {
+            hits += gatherPair(store, i, list->entries[k], law, response, &overlap);
+        }
+
+        pairHits += hits;
+        storeGathered(domain, gather->counting, i, hits, dv);
+    }
+
+    domain->workerOverlap[worker] = overlap;
+
+    if (gather->counting) return;
+
+    atomic_fetch_add_explicit(&gather->pairTests, list->start[end] - list->start[begin], memory_order_relaxed);
+    atomic_fetch_add_explicit(&gather->pairHits, pairHits, memory_order_relaxed);
+}
+
+// Chunk c in store order
+static const Chunk *orderChunk(const void *context, size_t c) {
+    const Domain *domain = (const Domain*)context;
+    return &domain->chunks[domain->chunkOrder[c]];
+}
+
+// parallelFor, or the whole range at once without a pool
+static void forEachBlock(Domain *domain, size_t count, size_t grain, ParallelTask task, void *context) {
+    if (domain->pool == NULL) {
+        if (count > 0) task(context, 0, count, 0);
+        return;
+    }
+
+    parallelFor(domain->pool, count, grain, task, context);
+}
+
+// Positions only change in the integration, so the pulls hold for the whole forces phase
+static void pullSelfGravity(Domain *domain) {
+    if (domain->config.selfGravity <= 0) return;
+
+    buildOctree(&domain->gravityTree, &domain->particles, domain->config.mass);
+    forEachBlock(domain, domain->gravityTree.leafCount, GRAVITY_GRAIN_LEAVES, selfGravityTask, domain);
+}
+
+// Everything after the pair phase, adding the gathered velocity changes first if there are any
+static void integrate(Domain *domain, double start) {
+    const size_t count = domain->particles.count;
+
+    pullSelfGravity(domain);
+
+    if (!domain->metrics.timed) {
+        forEachBlock(domain, count, INTEGRATE_GRAIN, integrateTask, domain);
+        return;
+    }
+
+    forEachBlock(domain, count, INTEGRATE_GRAIN, forcesTask, domain);
+    start = endPhase(&domain->metrics, METRIC_PHASE_FORCES, start);
+
+    forEachBlock(domain, count, INTEGRATE_GRAIN, positionsTask, domain);
+    endPhase(&domain->metrics, METRIC_PHASE_INTEGRATION, start);
+}
+
+// One pass of the gather over every particle
+static void runGather(Domain *domain, GatherContext *gather) {
+    // The particle gathers have no chunks to weigh and always go in blocks
+    if (domain->config.neighbourSkin > 0) {
+        runPairTasks(domain, domain->particles.count, GATHER_GRAIN_PARTICLES, NULL, NULL, gatherNeighboursTask, gather);
+        return;
+    }
+
+    switch (domain->config.chunkBuilder) {
+        case CHUNK_BUILDER_LISTS:
+            runPairTasks(domain, domain->particles.count, GATHER_GRAIN_PARTICLES, NULL, NULL, gatherListsTask, gather);
+            break;
+        case CHUNK_BUILDER_SORTED:
+            runPairTasks(domain, domain->chunkOrderCount, GATHER_GRAIN_CHUNKS, orderChunk, domain, gatherSortedTask, gather);
+            break;
+    }
+}
+
+static void initGather(GatherContext *gather, Domain *domain, bool counting) {
+    gather->domain = domain;
+    gather->law = (ContactLaw){domain->config.repulsion, domain->config.friction, domain->contactCounts, {NULL, NULL, NULL}};
+    gather->counting = counting;
+    atomic_init(&gather->pairTests, 0);
+    atomic_init(&gather->pairHits, 0);
+}
+
+// Counts the contacts of every particle
+static void countContacts(Domain *domain) {
+    GatherContext gather;
+    initGather(&gather, domain, true);
+    runGather(domain, &gather);
+}
+
+void gatherContacts(Domain *domain) {
+    const double start = beginPhase(&domain->metrics);
+
+    countContacts(domain);
+
+    GatherContext gather;
+    initGather(&gather, domain, false);
+    runGather(domain, &gather);
+
+    domain->metrics.pairTests += atomic_load(&gather.pairTests);
+    domain->metrics.pairHits += atomic_load(&gather.pairHits);
+
+    endPhase(&domain->metrics, METRIC_PHASE_PAIRS, start);
+}
+
+void applyGathered(Domain *domain) {
+    integrate(domain, beginPhase(&domain->metrics));
+}
+
+/**
+ * Sleeping: a chunk sleeps while every particle in it has been calm for
+ * Config.sleepSteps substeps, see calmRange, and none of its neighbours holds
+ * a particle that moved in the last one. Sleepers skip everything but their
+ * pairs with awake particles, to which they are fixed obstacles. What those
+ * pairs push into a sleeper is dropped on the next substep, unless it is above
+ * Config.sleepTravel, which wakes the particle and then the chunks around it.
+ */
+static void sleepChunks(Domain *domain) {
+    ParticleStore *store = &domain->particles;
+    float *calmSteps = domain->calmSteps;
+    const float steps = (float)domain->config.sleepSteps;
+    const float travel = domain->config.sleepTravel;
+
+    // Nothing moved or pushed since everything fell asleep, and the store was not touched either
+    if (store->count > 0 && domain->metrics.sleepingParticles == store->count && domain->membershipValid) return;
+
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+        float calm = steps;
+
+        for (int i = chunk->begin; i < chunk->end; ++i) {
+            calm = calmSteps[i] < calm ? calmSteps[i] : calm;
+        }
+
+        if (calm >= steps) {
+            for (int i = chunk->begin; i < chunk->end; ++i) {
+                const float moveSq = store->vx[i] * store->vx[i] + store->vy[i] * store->vy[i] + store->vz[i] * store->vz[i];
+                const float limit = travel * store->radius[i];
+
+                if (moveSq >= limit * limit) {
+                    calmSteps[i] = 0.0f;
+                    calm = 0.0f;
+                } else if (moveSq > 0.0f) {
+                    store->vx[i] = 0.0f;
+                    store->vy[i] = 0.0f;
+                    store->vz[i] = 0.0f;
+                }
+            }
+        }
+
+        chunk->calm = calm;
+        chunk->asleep = chunk->numParticles > 0 && calm >= steps;
+    }
+
+    // Moving particles keep the chunks around them awake
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        const Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+        if (chunk->numParticles == 0 || chunk->calm > 0) continue;
+
+        for (int n = 0; n < 26; ++n) {
+            neighbourChunk(domain, chunk, n)->asleep = false;
+        }
+    }
+
+    domain->metrics.sleepingChunks = 0;
+    domain->metrics.sleepingParticles = 0;
+
+    // Ranges of the awake chunks, touching ones merged
+    int *ranges = domain->awakeRanges;
+    size_t count = 0;
+
+    for (size_t c = 0; c < domain->chunkOrderCount; ++c) {
+        const Chunk *chunk = &domain->chunks[domain->chunkOrder[c]];
+
+        if (chunk->numParticles == 0) continue;
+
+        if (chunk->asleep) {
+            domain->metrics.sleepingChunks++;
+            domain->metrics.sleepingParticles += chunk->numParticles;
+            continue;
+        }
+
+        if (count > 0 && ranges[2 * count - 1] == chunk->begin) {
+            ranges[2 * count - 1] = chunk->end;
+            continue;
+        }
+
+        ranges[2 * count] = chunk->begin;
+        ranges[2 * count + 1] = chunk->end;
+        count++;
+    }
+
+    domain->awakeRangeCount = count;
+}
+
+/**
+ * Counts the calm substeps of particles [begin, end) after they moved. Slow is
+ * not settled while gravity still speeds a particle up, so under an external
+ * acceleration a substep only counts in part: a calm run has to last until the
+ * acceleration alone would have taken a free particle to twice the limit.
+ * Particles falling or collapsing from rest pass the limit first and never
+ * count a full run.
+ */
+static void calmRange(Domain *domain, size_t begin, size_t end) {
+    const ParticleStore *store = &domain->particles;
+    const Config *config = &domain->config;
+    const Octree *tree = &domain->gravityTree;
+    float *calmSteps = domain->calmSteps;
+    const float steps = (float)config->sleepSteps;
+    const float travel = config->sleepTravel;
+
+    for (size_t i = begin; i < end; ++i) {
+        const float moveSq = store->vx[i] * store->vx[i] + store->vy[i] * store->vy[i] + store->vz[i] * store->vz[i];
+        const float limit = travel * store->radius[i];
+
+        if (moveSq >= limit * limit) {
+            calmSteps[i] = 0.0f;
+            continue;
+        }
+
+        float ax = config->gravity.x;
+        float ay = config->gravity.y;
+        float az = config->gravity.z;
+
+        if (config->selfGravity > 0) {
+            ax += config->selfGravity * tree->pullX[i];
+            ay += config->selfGravity * tree->pullY[i];
+            az += config->selfGravity * tree->pullZ[i];
+        }
+
+        // A free particle takes 2 * limit / accel substeps from rest to twice the limit
+        const float accel = sqrtf(ax * ax + ay * ay + az * az);
+        const float count = accel > 0.0f ? fminf(1.0f, steps * accel / (2.0f * limit)) : 1.0f;
+
+        calmSteps[i] = fminf(calmSteps[i] + count, steps);
+    }
+}
+
+static void moveAwakeRange(Domain *domain, size_t begin, size_t end) {
+    positionsRange(domain, begin, end, 0);
+    calmRange(domain, begin, end);
+}
+
+static void forAwakeRanges(Domain *domain, void (*range)(Domain*, size_t, size_t)) {
+    for (size_t r = 0; r < domain->awakeRangeCount; ++r) {
+        range(domain, domain->awakeRanges[2 * r], domain->awakeRanges[2 * r + 1]);
+    }
+}
+
+void stepGlobal(Domain *domain) {
+    // Set up on purpose for the simultaneous law, see initSimultaneousContacts
+    if (domain->dvx != NULL) {
+        gatherContacts(domain);
+        applyGathered(domain);
+        recordStep(domain);
+        return;
+    }
+
+    const bool sleeping = domain->calmSteps != NULL;
+    double start = beginPhase(&domain->metrics);
+
+    if (sleeping) {
+        sleepChunks(domain);
+        start = endPhase(&domain->metrics, METRIC_PHASE_CHUNKS, start);
+    }
+
+    // Apply forces
+    stepPairs(domain);
+
+    start = endPhase(&domain->metrics, METRIC_PHASE_PAIRS, start);
+
+    if (sleeping) {
+        pullSelfGravity(domain);
+
+        forAwakeRanges(domain, forcesRange);
+        start = endPhase(&domain->metrics, METRIC_PHASE_FORCES, start);
+
+        forAwakeRanges(domain, moveAwakeRange);
+        endPhase(&domain->metrics, METRIC_PHASE_INTEGRATION, start);
+
+        recordStep(domain);
+        return;
+    }
+
+    integrate(domain, start);
+    recordStep(domain);
+}
+
+static void rescaleSubsteps(Domain *domain, int substeps) {
+    ParticleStore *store = &domain->particles;
+
+    const float scale = (float)domain->config.supsampling / substeps;
+    splitFrames(&domain->config, substeps);
+
+    // Velocities are moves per substep
+    for (size_t i = 0; i < store->count; ++i) {
+        store->vx[i] *= scale;
+        store->vy[i] *= scale;
+        store->vz[i] *= scale;
+    }
+}
+
+/**
+ * Both limits are crossed roughly in proportion to the timestep, so the next
+ * frame gets the substeps that would have kept this one within them. Counts
+ * only drop once the frame used less than half of its limits, so a system on
+ * the edge does not flip between two counts every frame.
+ */
+static int pickSubsteps(const Config *config, int substeps, float travel, float overlap) {
+    float ratio = travel / config->maxStepTravel;
+    if (config->maxStepOverlap > 0) {
+        ratio = fmaxf(ratio, overlap / config->maxStepOverlap);
+    }
+
+    int next = substeps;
+    if (ratio > 1.0f) {
+        next = (int)ceilf(substeps * ratio);
+    } else if (ratio < 0.5f) {
+        next = (int)ceilf(2.0f * substeps * ratio);
+    }
+
+    next = next < config->minSubsteps ? config->minSubsteps : next;
+    return next > config->maxSubsteps ? config->maxSubsteps : next;
+}
+
+void stepFrame(Domain *domain) {
+    const int substeps = domain->config.supsampling;
+
+    float travel = 0.0f;
+    float overlap = 0.0f;
+
+    for (int i = 0; i < substeps; ++i) {
+        updatePopulation(domain);
+        updateChunks(domain);
+        stepGlobal(domain);
+
+        travel = fmaxf(travel, domain->metrics.stepTravel);
+        overlap = fmaxf(overlap, domain->metrics.stepOverlap);
+    }
+
+    domain->metrics.frames++;
+    domain->metrics.substeps = substeps;
+
+    if (!domain->config.adaptiveSubsteps) return;
+
+    const int next = pickSubsteps(&domain->config, substeps, travel, overlap);
+    if (next != substeps) {
+        rescaleSubsteps(domain, next);
+    }
+}
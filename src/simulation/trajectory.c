@@ -0,0 +1,575 @@
+#include "simulation/trajectory.h"
+
+/**
+ * Copyright (c) Alexander Kurtz 2024
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define TRAJECTORY_MAGIC "PSIMTRAJ"
+#define TRAJECTORY_FRAME_MAGIC 0x4d415246u
+#define TRAJECTORY_FRAME_KEYFRAME 1u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t fields;
+    uint32_t encoding;
+    uint32_t keyframeInterval;
+    uint64_t count;
+    float dim[3];
+    uint32_t interval;
+} TrajectoryHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t step;
+    uint64_t payloadBytes;
+
+    // Maximum magnitude per velocity component, quantised encodings only
+    float velocityScale[3];
+    uint32_t reserved;
+} FrameHeader;
+
+// A frame in store order, as copied by the step loop
+typedef struct {
+    uint64_t step;
+    float *values[6];
+    uint32_t *id;
+} QueuedFrame;
+
+struct TrajectoryWriter {
+    FILE *file;
+    size_t count;
+    int components;
+    TrajectoryEncoding encoding;
+    int interval;
+    float dim[3];
+    size_t submissions;
+
+    // Ring of depth frames, queued of them from head on wait for the background thread
+    QueuedFrame *queue;
+    int depth;
+    int head;
+    int queued;
+    bool stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t drained;
+    pthread_t thread;
+
+    // Only touched by the background thread
+    float *ordered[6];
+    uint16_t *previous[3];
+    uint64_t encoded;
+    uint8_t *payload;
+
+    atomic_uint_least64_t written;
+    atomic_uint_least64_t dropped;
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t rawBytes;
+};
+
+struct TrajectoryReader {
+    FILE *file;
+    TrajectoryHeader header;
+    TrajectoryFrame frame;
+
+    uint16_t *previous[3];
+    uint8_t *payload;
+    size_t capacity;
+};
+
+static void *allocTrajectory(size_t bytes) {
+    void *data = malloc(bytes > 0 ? bytes : 1);
+    if (data == NULL) {
+        fprintf(stderr, "Memory allocation failed for trajectory buffers (%zu bytes)\n", bytes);
+        exit(1);
+    }
+
+    return data;
+}
+
+static uint16_t quantisePosition(float value, float dim) {
+    float unit = value / dim;
+    unit = unit < 0.0f ? 0.0f : (unit > 1.0f ? 1.0f : unit);
+
+    return (uint16_t)lrintf(unit * 65535.0f);
+}
+
+static float dequantisePosition(uint16_t value, float dim) {
+    return value / 65535.0f * dim;
+}
+
+// Zigzag keeps small negative differences small, then 7 bits per byte
+static size_t putVarint(uint8_t *out, int32_t value) {
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t size = 0;
+
+    while (zigzag >= 0x80) {
+        out[size++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+
+    out[size++] = (uint8_t)zigzag;
+
+    return size;
+}
+
+static bool getVarint(const uint8_t *in, size_t size, size_t *position, int32_t *value) {
+    uint32_t zigzag = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*position >= size) return false;
+
+        const uint8_t byte = in[(*position)++];
+        zigzag |= (uint32_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) {
+            *value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void encodeFrame(TrajectoryWriter *writer, const QueuedFrame *queued) {
+    const size_t count = writer->count;
+
+    // Back to id order, so consecutive frames line up particle by particle
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t id = queued->id[i];
+
+        for (int k = 0; k < writer->components; ++k) {
+            writer->ordered[k][id] = queued->values[k][i];
+        }
+    }
+
+    FrameHeader header;
+    memset(&header, 0, sizeof(FrameHeader));
+    header.magic = TRAJECTORY_FRAME_MAGIC;
+    header.step = queued->step;
+
+    const bool keyframe = writer->encoding != TRAJECTORY_DELTA || writer->encoded % TRAJECTORY_KEYFRAME_INTERVAL == 0;
+    if (keyframe) header.flags |= TRAJECTORY_FRAME_KEYFRAME;
+
+    uint8_t *out = writer->payload;
+    size_t size = 0;
+
+    if (writer->encoding == TRAJECTORY_RAW) {
+        for (int k = 0; k < writer->components; ++k) {
+            memcpy(out + size, writer->ordered[k], count * sizeof(float));
+            size += count * sizeof(float);
+        }
+    } else {
+        for (int k = 0; k < 3; ++k) {
+            uint16_t *previous = writer->previous[k];
+
+            for (size_t j = 0; j < count; ++j) {
+                const uint16_t value = quantisePosition(writer->ordered[k][j], writer->dim[k]);
+
+                if (keyframe) {
+                    memcpy(out + size, &value, sizeof(uint16_t));
+                    size += sizeof(uint16_t);
+                } else {
+                    size += putVarint(out + size, (int32_t)value - (int32_t)previous[j]);
+                }
+
+                previous[j] = value;
+            }
+        }
+
+        // Velocities change too much from frame to frame for differences to pay off
+        for (int k = 3; k < writer->components; ++k) {
+            float scale = 0.0f;
+            for (size_t j = 0; j < count; ++j) {
+                scale = fmaxf(scale, fabsf(writer->ordered[k][j]));
+            }
+
+            header.velocityScale[k - 3] = scale;
+
+            for (size_t j = 0; j < count; ++j) {
+                const int16_t value = scale > 0.0f ? (int16_t)lrintf(writer->ordered[k][j] / scale * 32767.0f) : 0;
+
+                memcpy(out + size, &value, sizeof(int16_t));
+                size += sizeof(int16_t);
+            }
+        }
+    }
+
+    header.payloadBytes = size;
+
+    if (fwrite(&header, sizeof(FrameHeader), 1, writer->file) != 1 || fwrite(out, 1, size, writer->file) != size) {
+        fprintf(stderr, "Failed to write trajectory frame of step %" PRIu64 "\n", header.step);
+        exit(1);
+    }
+
+    writer->encoded++;
+
+    atomic_fetch_add_explicit(&writer->written, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&writer->bytes, sizeof(FrameHeader) + size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&writer->rawBytes, sizeof(FrameHeader) + count * writer->components * sizeof(float), memory_order_relaxed);
+}
+
+static void *writerMain(void *argument) {
+    TrajectoryWriter *writer = (TrajectoryWriter*)argument;
+
+    pthread_mutex_lock(&writer->lock);
+    while (true) {
+        while (writer->queued == 0 && !writer->stop) {
+            pthread_cond_wait(&writer->ready, &writer->lock);
+        }
+
+        if (writer->queued == 0) break;
+
+        const QueuedFrame *frame = &writer->queue[writer->head];
+        pthread_mutex_unlock(&writer->lock);
+
+        // The slot stays ours until head moves past it
+        encodeFrame(writer, frame);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->head = (writer->head + 1) % writer->depth;
+        writer->queued--;
+        pthread_cond_signal(&writer->drained);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+TrajectoryWriter *createTrajectoryWriter(const char *path, size_t count, const Config *config, int depth) {
+    // Frames are indexed by id, one per spawned particle
+    if (config->emitterCount > 0 || config->sinkCount > 0) {
+        fprintf(stderr, "Trajectories need a fixed population, no emitters or sinks\n");
+        exit(1);
+    }
+
+    TrajectoryWriter *writer = (TrajectoryWriter*)allocTrajectory(sizeof(TrajectoryWriter));
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        fprintf(stderr, "Failed to open trajectory %s\n", path);
+        exit(1);
+    }
+
+    writer->count = count;
+    writer->components = config->trajectoryFields == TRAJECTORY_POSITIONS_VELOCITIES ? 6 : 3;
+    writer->encoding = config->trajectoryEncoding;
+    writer->interval = config->trajectoryInterval > 0 ? config->trajectoryInterval : 1;
+    writer->submissions = 0;
+
+    for (int d = 0; d < 3; ++d) {
+        writer->dim[d] = config->dim[d];
+    }
+
+    writer->depth = depth > 0 ? depth : 1;
+    writer->queue = (QueuedFrame*)allocTrajectory(writer->depth * sizeof(QueuedFrame));
+
+    for (int q = 0; q < writer->depth; ++q) {
+        for (int k = 0; k < writer->components; ++k) {
+            writer->queue[q].values[k] = (float*)allocTrajectory(count * sizeof(float));
+        }
+
+        writer->queue[q].id = (uint32_t*)allocTrajectory(count * sizeof(uint32_t));
+    }
+
+    for (int k = 0; k < writer->components; ++k) {
+        writer->ordered[k] = (float*)allocTrajectory(count * sizeof(float));
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        writer->previous[k] = (uint16_t*)allocTrajectory(count * sizeof(uint16_t));
+    }
+
+    // Raw floats are the largest encoding, a varint difference takes at most three bytes
+    writer->payload = (uint8_t*)allocTrajectory(count * (writer->components * sizeof(float) + 9));
+    writer->encoded = 0;
+
+    writer->head = 0;
+    writer->queued = 0;
+    writer->stop = false;
+
+    atomic_init(&writer->written, 0);
+    atomic_init(&writer->dropped, 0);
+    atomic_init(&writer->bytes, 0);
+    atomic_init(&writer->rawBytes, 0);
+
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(TrajectoryHeader));
+    memcpy(header.magic, TRAJECTORY_MAGIC, 8);
+    header.version = TRAJECTORY_VERSION;
+    header.fields = config->trajectoryFields;
+    header.encoding = writer->encoding;
+    header.keyframeInterval = TRAJECTORY_KEYFRAME_INTERVAL;
+    header.count = count;
+    header.interval = writer->interval;
+
+    for (int d = 0; d < 3; ++d) {
+        header.dim[d] = writer->dim[d];
+    }
+
+    if (fwrite(&header, sizeof(TrajectoryHeader), 1, writer->file) != 1) {
+        fprintf(stderr, "Failed to write trajectory header to %s\n", path);
+        exit(1);
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->ready, NULL);
+    pthread_cond_init(&writer->drained, NULL);
+
+    if (pthread_create(&writer->thread, NULL, writerMain, writer) != 0) {
+        fprintf(stderr, "Failed to start trajectory writer\n");
+        exit(1);
+    }
+
+    return writer;
+}
+
+void destroyTrajectoryWriter(TrajectoryWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+
+    if (fclose(writer->file) != 0) {
+        fprintf(stderr, "Failed to close trajectory\n");
+        exit(1);
+    }
+
+    for (int q = 0; q < writer->depth; ++q) {
+        for (int k = 0; k < writer->components; ++k) {
+            free(writer->queue[q].values[k]);
+        }
+
+        free(writer->queue[q].id);
+    }
+
+    for (int k = 0; k < writer->components; ++k) {
+        free(writer->ordered[k]);
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        free(writer->previous[k]);
+    }
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->ready);
+    pthread_cond_destroy(&writer->drained);
+
+    free(writer->queue);
+    free(writer->payload);
+    free(writer);
+}
+
+void flushTrajectoryWriter(TrajectoryWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->queued > 0) {
+        pthread_cond_wait(&writer->drained, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    if (fflush(writer->file) != 0) {
+        fprintf(stderr, "Failed to flush trajectory\n");
+        exit(1);
+    }
+}
+
+bool submitTrajectoryFrame(TrajectoryWriter *writer, const Domain *domain) {
+    if (writer->submissions++ % writer->interval != 0) return false;
+
+    const ParticleStore *particles = &domain->particles;
+
+    if (particles->count != writer->count) {
+        fprintf(stderr, "Trajectory of %zu particles fed %zu\n", writer->count, particles->count);
+        exit(1);
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    const bool full = writer->queued == writer->depth;
+    const int slot = (writer->head + writer->queued) % writer->depth;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (full) {
+        atomic_fetch_add_explicit(&writer->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    // Free slots are not seen by the background thread until queued grows
+    QueuedFrame *frame = &writer->queue[slot];
+    const float *values[6] = {particles->x, particles->y, particles->z, particles->vx, particles->vy, particles->vz};
+
+    frame->step = domain->metrics.steps;
+
+    for (int k = 0; k < writer->components; ++k) {
+        memcpy(frame->values[k], values[k], writer->count * sizeof(float));
+    }
+
+    memcpy(frame->id, particles->id, writer->count * sizeof(uint32_t));
+
+    pthread_mutex_lock(&writer->lock);
+    writer->queued++;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+
+    return true;
+}
+
+uint64_t trajectoryFramesWritten(const TrajectoryWriter *writer) {
+    return atomic_load_explicit(&writer->written, memory_order_relaxed);
+}
+
+uint64_t trajectoryFramesDropped(const TrajectoryWriter *writer) {
+    return atomic_load_explicit(&writer->dropped, memory_order_relaxed);
+}
+
+uint64_t trajectoryBytesWritten(const TrajectoryWriter *writer) {
+    return sizeof(TrajectoryHeader) + atomic_load_explicit(&writer->bytes, memory_order_relaxed);
+}
+
+uint64_t trajectoryRawBytes(const TrajectoryWriter *writer) {
+    return sizeof(TrajectoryHeader) + atomic_load_explicit(&writer->rawBytes, memory_order_relaxed);
+}
+
+TrajectoryReader *openTrajectory(const char *path) {
+    TrajectoryReader *reader = (TrajectoryReader*)allocTrajectory(sizeof(TrajectoryReader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Failed to open trajectory %s\n", path);
+        exit(1);
+    }
+
+    TrajectoryHeader *header = &reader->header;
+
+    if (fread(header, sizeof(TrajectoryHeader), 1, reader->file) != 1 || memcmp(header->magic, TRAJECTORY_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not a trajectory\n", path);
+        exit(1);
+    }
+
+    if (header->version != TRAJECTORY_VERSION) {
+        fprintf(stderr, "Trajectory %s has version %u, expected %d\n", path, header->version, TRAJECTORY_VERSION);
+        exit(1);
+    }
+
+    const size_t count = header->count;
+    TrajectoryFrame *frame = &reader->frame;
+
+    frame->count = count;
+    frame->velocities = header->fields == TRAJECTORY_POSITIONS_VELOCITIES;
+
+    float **arrays[6] = {&frame->x, &frame->y, &frame->z, &frame->vx, &frame->vy, &frame->vz};
+    for (int k = 0; k < 6; ++k) {
+        *arrays[k] = k < 3 || frame->velocities ? (float*)allocTrajectory(count * sizeof(float)) : NULL;
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        reader->previous[k] = (uint16_t*)allocTrajectory(count * sizeof(uint16_t));
+    }
+
+    reader->payload = NULL;
+    reader->capacity = 0;
+
+    return reader;
+}
+
+void closeTrajectory(TrajectoryReader *reader) {
+    fclose(reader->file);
+
+    free(reader->frame.x);
+    free(reader->frame.y);
+    free(reader->frame.z);
+    free(reader->frame.vx);
+    free(reader->frame.vy);
+    free(reader->frame.vz);
+
+    for (int k = 0; k < 3; ++k) {
+        free(reader->previous[k]);
+    }
+
+    free(reader->payload);
+    free(reader);
+}
+
+static void corruptTrajectory(uint64_t step) {
+    fprintf(stderr, "Corrupt trajectory frame at step %" PRIu64 "\n", step);
+    exit(1);
+}
+
+const TrajectoryFrame *readTrajectoryFrame(TrajectoryReader *reader) {
+    FrameHeader header;
+    if (fread(&header, sizeof(FrameHeader), 1, reader->file) != 1) return NULL;
+
+    if (header.magic != TRAJECTORY_FRAME_MAGIC) corruptTrajectory(header.step);
+
+    if (header.payloadBytes > reader->capacity) {
+        free(reader->payload);
+        reader->capacity = header.payloadBytes;
+        reader->payload = (uint8_t*)allocTrajectory(reader->capacity);
+    }
+
+    const size_t size = header.payloadBytes;
+    if (fread(reader->payload, 1, size, reader->file) != size) corruptTrajectory(header.step);
+
+    TrajectoryFrame *frame = &reader->frame;
+    const size_t count = frame->count;
+    const int components = frame->velocities ? 6 : 3;
+    float *arrays[6] = {frame->x, frame->y, frame->z, frame->vx, frame->vy, frame->vz};
+    const uint8_t *in = reader->payload;
+    size_t position = 0;
+
+    frame->step = header.step;
+
+    if (reader->header.encoding == TRAJECTORY_RAW) {
+        if (size != count * components * sizeof(float)) corruptTrajectory(header.step);
+
+        for (int k = 0; k < components; ++k) {
+            memcpy(arrays[k], in + k * count * sizeof(float), count * sizeof(float));
+        }
+
+        return frame;
+    }
+
+    const bool keyframe = header.flags & TRAJECTORY_FRAME_KEYFRAME;
+
+    for (int k = 0; k < 3; ++k) {
+        uint16_t *previous = reader->previous[k];
+
+        for (size_t j = 0; j < count; ++j) {
+            if (keyframe) {
+                if (position + sizeof(uint16_t) > size) corruptTrajectory(header.step);
+
+                memcpy(&previous[j], in + position, sizeof(uint16_t));
+                position += sizeof(uint16_t);
+            } else {
+                int32_t difference;
+                if (!getVarint(in, size, &position, &difference)) corruptTrajectory(header.step);
+
+                previous[j] = (uint16_t)(previous[j] + difference);
+            }
+
+            arrays[k][j] = dequantisePosition(previous[j], reader->header.dim[k]);
+        }
+    }
+
+    for (int k = 3; k < components; ++k) {
+        if (position + count * sizeof(int16_t) > size) corruptTrajectory(header.step);
+
+        for (size_t j = 0; j < count; ++j) {
+            int16_t value;
+            memcpy(&value, in + position, sizeof(int16_t));
+            position += sizeof(int16_t);
+
+            arrays[k][j] = value / 32767.0f * header.velocityScale[k - 3];
+        }
+    }
+
+    return frame;
+}
@@ -4,10 +4,9 @@
 
 #include "visualiser/common.hpp"
 
-Domain* getSimulationHandle(Config config) {
-    Domain* renderDomain = new Domain();
-    renderDomain->drawable = false;
-    std::thread simulationThread(startSimulation, renderDomain, config);
+SnapshotChannel* getSimulationHandle(Config config) {
+    SnapshotChannel* channel = createSnapshotChannel(config.numParticles);
+    std::thread simulationThread(startSimulation, channel, config);
     simulationThread.detach();
-    return renderDomain;
+    return channel;
 }
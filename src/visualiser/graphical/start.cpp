@@ -243,27 +243,71 @@ void startVisualiser() {
 
     config.friction = 0.9;
     config.repulsion = 0.01f;
+    config.selfGravity = 0.0f;
+    config.openingAngle = 0.5f;
+    config.softening = 0.5f;
 
     config.gravity = {0.0f, -0.01f, 0.0f}; 
     config.speed = 0.01f;
     config.supsampling = 1;
     config.fps = 60;
+    config.schedule = SCHEDULE_REALTIME;
+    config.catchUpFrames = 4;
+    config.runFrames = 0;
+    config.adaptiveSubsteps = false;
+    config.minSubsteps = 1;
+    config.maxSubsteps = 16;
+    config.maxStepTravel = 0.1f;
+    config.maxStepOverlap = 0.0f;
 
     config.numParticles = 20000;
     config.mass = 0.5f;
+    config.radiusRatio = 1.0f;
     config.targetChunkCount = pow(4, 9);
-
-    Domain* renderDomain = getSimulationHandle(config);
-
-    while (!renderDomain->drawable) {
+    config.chunkSizing = CHUNK_SIZING_AUTO;
+    config.chunkOrder = CHUNK_ORDER_ROWS;
+    config.reorderInterval = 0;
+    config.reorderLocality = 0.0f;
+    config.chunkRetuneInterval = 60;
+    config.chunkBuilder = CHUNK_BUILDER_SORTED;
+    config.incrementalChunks = false;
+    config.chunkGrid = CHUNK_GRID_DENSE;
+    config.gridLevels = 1;
+    config.stencil = PAIR_STENCIL_HALF;
+    config.kernel = PAIR_KERNEL_AUTO;
+    config.neighbourSkin = 0.0f;
+    config.sleepSteps = 0;
+    config.sleepTravel = 0.1f;
+    config.emitterCount = 0;
+    config.sinkCount = 0;
+    config.pairSchedule = PAIR_SCHEDULE_BLOCKS;
+    config.affinity = AFFINITY_NONE;
+    config.numaFirstTouch = false;
+    config.hugePages = false;
+    config.metrics = false;
+    config.metricsPath = NULL;
+    config.metricsInterval = 0;
+    config.restartPath = NULL;
+    config.checkpointPath = NULL;
+    config.checkpointInterval = 0;
+    config.trajectoryPath = NULL;
+    config.trajectoryInterval = 1;
+    config.trajectoryFields = TRAJECTORY_POSITIONS;
+    config.trajectoryEncoding = TRAJECTORY_DELTA;
+    // Worker threads of the step, any count steps the same particles as one
+    config.threads = 1;
+
+    SnapshotChannel* channel = getSimulationHandle(config);
+
+    const Snapshot *snapshot;
+    while ((snapshot = acquireSnapshot(channel)) == NULL) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
-    const Particle *particles = renderDomain->particles;
     std::vector<glm::vec3> cords;
     std::vector<glm::vec3> colors;
 
-    updatePoints(particles, config.numParticles, cords, colors, config.dim[0], config.dim[1], config.dim[2], config.speed);
+    updatePoints(snapshot->particles, snapshot->count, cords, colors, config.dim[0], config.dim[1], config.dim[2], config.speed);
 
     GLuint VBO, CBO;
     glGenBuffers(1, &VBO);
@@ -298,16 +342,15 @@ void startVisualiser() {
             // Set background color
             glClearColor(0.831372549, 0.7960784314f, 0.8980392157f, 1.0f);
 
-            if (renderDomain->drawable) {
-                updatePoints(particles, config.numParticles, cords, colors, config.dim[0], config.dim[1], config.dim[2], config.speed);
+            // Our frame stays untouched until the next acquire
+            if ((snapshot = acquireSnapshot(channel)) != NULL) {
+                updatePoints(snapshot->particles, snapshot->count, cords, colors, config.dim[0], config.dim[1], config.dim[2], config.speed);
 
                 glBindBuffer(GL_ARRAY_BUFFER, VBO);
                 glBufferSubData(GL_ARRAY_BUFFER, 0, cords.size() * sizeof(glm::vec3), cords.data());
 
                 glBindBuffer(GL_ARRAY_BUFFER, CBO);
                 glBufferSubData(GL_ARRAY_BUFFER, 0, colors.size() * sizeof(glm::vec3), colors.data());
-
-                renderDomain->drawable = false;
             }
 
             float camX = std::cos(glm::radians(camera_yaw)) * std::cos(glm::radians(camera_pitch)) * camera_radius;